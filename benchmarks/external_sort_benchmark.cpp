@@ -0,0 +1,369 @@
+// Runs the whole sort on files for every combination of input size, memory,
+// number of runs merged at once, threads, item type and distribution of
+// the input, with the phase times the sort reports. Prints a row per configuration
+// as CSV or JSON to compare between releases.
+// The input is written just before it's sorted, so it's likely in the page
+// cache and split mostly measures sorting rather than the disk
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../external_sort.hpp"
+
+using namespace external_sort;
+
+namespace
+{
+
+// an item with a payload, sorted by the key only
+struct record
+{
+    uint64_t key;
+    uint64_t payload;
+
+    bool operator<( const record& r ) const {
+        return key < r.key;
+    }
+};
+
+template< typename T >
+T make_item( uint64_t value, size_t index );
+
+template<>
+uint32_t make_item< uint32_t >( uint64_t value, size_t ){
+    return static_cast< uint32_t >( value );
+}
+
+template<>
+uint64_t make_item< uint64_t >( uint64_t value, size_t ){
+    return value;
+}
+
+template<>
+double make_item< double >( uint64_t value, size_t ){
+    return static_cast< double >( value ) / 3;
+}
+
+template<>
+record make_item< record >( uint64_t value, size_t index ){
+    return record{ value, index };
+}
+
+const std::vector< std::string > all_distributions{ "uniform", "sorted", "reversed", "few_unique", "zipf", "organ_pipe" };
+
+// Values of the items in the order they are written, up to 2^31
+std::vector< uint64_t > generate_values( const std::string& distribution, size_t items )
+{
+    std::default_random_engine e( 42 );
+    std::vector< uint64_t > values( items );
+    const uint64_t range = 1ull << 31;
+
+    if( distribution == "uniform" || distribution == "sorted" || distribution == "reversed" )
+    {
+        std::uniform_int_distribution< uint64_t > dist( 0, range - 1 );
+        for( auto& v : values ){
+            v = dist( e );
+        }
+
+        if( distribution == "sorted" ){
+            std::sort( values.begin(), values.end() );
+        }
+        else if( distribution == "reversed" ){
+            std::sort( values.begin(), values.end(), []( uint64_t l, uint64_t r ){ return r < l; } );
+        }
+    }
+    else if( distribution == "few_unique" )
+    {
+        std::uniform_int_distribution< uint64_t > dist( 0, 15 );
+        for( auto& v : values ){
+            v = dist( e ) * ( range / 16 );
+        }
+    }
+    else if( distribution == "zipf" )
+    {
+        // rank r of n distinct values comes with probability ~ 1 / r
+        const size_t distinct = std::max< size_t >( std::min< size_t >( items, 1 << 20 ), 1 );
+        std::vector< double > cdf( distinct );
+        double sum = 0;
+        for( size_t r = 0; r < distinct; ++r ){
+            cdf[ r ] = sum += 1.0 / ( r + 1 );
+        }
+
+        std::uniform_real_distribution< double > dist( 0, sum );
+        for( auto& v : values )
+        {
+            size_t rank = std::lower_bound( cdf.begin(), cdf.end(), dist( e ) ) - cdf.begin();
+            v = std::min( rank, distinct - 1 ) * ( range / distinct );
+        }
+    }
+    else if( distribution == "organ_pipe" )
+    {
+        // ascending to the middle, then descending
+        for( size_t i = 0; i < items; ++i ){
+            values[ i ] = std::min( i, items - 1 - i );
+        }
+    }
+    else{
+        throw std::invalid_argument( "Unknown distribution: " + distribution );
+    }
+
+    return values;
+}
+
+struct configuration
+{
+    std::string type;
+    std::string distribution;
+    size_t items;
+    size_t avail_mem;
+    size_t merge_at_once;
+    size_t threads;
+};
+
+struct result
+{
+    size_t item_size;
+    size_t runs;
+    double merge_passes;
+    double split_seconds;
+    double merge_seconds;
+};
+
+template< typename T >
+result run( const configuration& c, const std::string& work_folder )
+{
+    std::string in_file = work_folder + "benchmark_input";
+    std::string out_file = work_folder + "benchmark_output";
+
+    {
+        auto values = generate_values( c.distribution, c.items );
+        std::vector< T > data( c.items );
+        for( size_t i = 0; i < c.items; ++i ){
+            data[ i ] = make_item< T >( values[ i ], i );
+        }
+
+        std::ofstream out( in_file, std::ios::out | std::ofstream::binary );
+        out.write( reinterpret_cast< const char* >( data.data() ), data.size() * sizeof( T ) );
+        if( !out.good() ){
+            throw std::runtime_error( "Couldn't write to file: " + in_file );
+        }
+    }
+
+    statistics stats = external_sort::external_sort< T >( in_file, out_file, c.avail_mem, c.merge_at_once, c.threads );
+
+    std::remove( in_file.c_str() );
+
+    // a result that isn't sorted isn't worth reporting
+    {
+        std::vector< T > sorted( c.items );
+        std::ifstream in( out_file, std::ios::in | std::ifstream::binary );
+        in.read( reinterpret_cast< char* >( sorted.data() ), sorted.size() * sizeof( T ) );
+        if( !in.good() || !std::is_sorted( sorted.begin(), sorted.end() ) ){
+            throw std::runtime_error( "The output isn't sorted" );
+        }
+    }
+
+    std::remove( out_file.c_str() );
+
+    result r;
+    r.item_size = sizeof( T );
+    r.runs = stats.runs;
+    r.merge_passes = stats.merge_passes;
+    r.split_seconds = stats.split.seconds;
+    r.merge_seconds = stats.merge.seconds;
+    return r;
+}
+
+result run( const configuration& c, const std::string& work_folder )
+{
+    if( c.type == "uint32_t" ){
+        return run< uint32_t >( c, work_folder );
+    }
+
+    if( c.type == "uint64_t" ){
+        return run< uint64_t >( c, work_folder );
+    }
+
+    if( c.type == "double" ){
+        return run< double >( c, work_folder );
+    }
+
+    if( c.type == "record" ){
+        return run< record >( c, work_folder );
+    }
+
+    throw std::invalid_argument( "Unknown type: " + c.type );
+}
+
+std::vector< std::string > split_list( const std::string& list )
+{
+    std::vector< std::string > result;
+    std::stringstream stream( list );
+    for( std::string item; std::getline( stream, item, ',' ); ){
+        result.push_back( item );
+    }
+
+    return result;
+}
+
+std::vector< size_t > split_numbers( const std::string& list )
+{
+    std::vector< size_t > result;
+    for( auto& item : split_list( list ) ){
+        result.push_back( std::stoull( item ) );
+    }
+
+    return result;
+}
+
+void print_header( bool json )
+{
+    if( json ){
+        std::cout << "[" << std::endl;
+    }
+    else
+    {
+        std::cout << "type,distribution,items,item_size,avail_mem,merge_at_once,threads,runs,merge_passes,"
+                     "split_s,merge_s,split_mb_s,merge_mb_s,split_el_s,merge_el_s,total_el_s" << std::endl;
+    }
+}
+
+void print_row( bool json, bool first, const configuration& c, const result& r )
+{
+    double mb = static_cast< double >( c.items * r.item_size ) / ( 1 << 20 );
+    double items = static_cast< double >( c.items );
+    double total = r.split_seconds + r.merge_seconds;
+
+    if( !json )
+    {
+        std::cout << c.type << ',' << c.distribution << ',' << c.items << ',' << r.item_size << ','
+                  << c.avail_mem << ',' << c.merge_at_once << ',' << c.threads << ','
+                  << r.runs << ',' << r.merge_passes << ','
+                  << r.split_seconds << ',' << r.merge_seconds << ','
+                  << mb / r.split_seconds << ',' << mb / r.merge_seconds << ','
+                  << items / r.split_seconds << ',' << items / r.merge_seconds << ','
+                  << items / total << std::endl;
+        return;
+    }
+
+    std::cout << ( first ? "" : ",\n" )
+              << "  {\"type\": \"" << c.type << "\", \"distribution\": \"" << c.distribution << "\""
+              << ", \"items\": " << c.items << ", \"item_size\": " << r.item_size
+              << ", \"avail_mem\": " << c.avail_mem << ", \"merge_at_once\": " << c.merge_at_once
+              << ", \"threads\": " << c.threads << ", \"runs\": " << r.runs
+              << ", \"merge_passes\": " << r.merge_passes
+              << ", \"split_s\": " << r.split_seconds << ", \"merge_s\": " << r.merge_seconds
+              << ", \"split_mb_s\": " << mb / r.split_seconds << ", \"merge_mb_s\": " << mb / r.merge_seconds
+              << ", \"split_el_s\": " << items / r.split_seconds << ", \"merge_el_s\": " << items / r.merge_seconds
+              << ", \"total_el_s\": " << items / total << "}";
+}
+
+void usage()
+{
+    std::cerr << "external_sort_benchmark <work folder with a trailing slash> [options]\n"
+                 "  --sizes n,...          items to sort ( 4194304 )\n"
+                 "  --mem bytes,...        avail_mem ( 4194304,33554432 )\n"
+                 "  --merge k,...          merge_at_once ( 4,16 )\n"
+                 "  --threads n,...        threads ( 1,<hardware concurrency> )\n"
+                 "  --types t,...          uint32_t, uint64_t, double, record ( all )\n"
+                 "  --distributions d,...  uniform, sorted, reversed, few_unique, zipf, organ_pipe ( all )\n"
+                 "  --format csv|json      ( csv )" << std::endl;
+}
+
+}
+
+int main( int argc, char* argv[] )
+{
+    if( argc < 2 || argc % 2 )
+    {
+        usage();
+        return 1;
+    }
+
+    std::string work_folder = argv[ 1 ];
+    std::vector< size_t > sizes{ 1 << 22 };
+    std::vector< size_t > mems{ 1 << 22, 1 << 25 };
+    std::vector< size_t > merges{ 4, 16 };
+    std::vector< size_t > threads{ 1, std::max< size_t >( std::thread::hardware_concurrency(), 1 ) };
+    std::vector< std::string > types{ "uint32_t", "uint64_t", "double", "record" };
+    std::vector< std::string > distributions = all_distributions;
+    bool json = false;
+
+    try
+    {
+        for( int arg = 2; arg < argc; arg += 2 )
+        {
+            std::string name = argv[ arg ];
+            std::string value = argv[ arg + 1 ];
+
+            if( name == "--sizes" ){
+                sizes = split_numbers( value );
+            }
+            else if( name == "--mem" ){
+                mems = split_numbers( value );
+            }
+            else if( name == "--merge" ){
+                merges = split_numbers( value );
+            }
+            else if( name == "--threads" ){
+                threads = split_numbers( value );
+            }
+            else if( name == "--types" ){
+                types = split_list( value );
+            }
+            else if( name == "--distributions" ){
+                distributions = split_list( value );
+            }
+            else if( name == "--format" && ( value == "csv" || value == "json" ) ){
+                json = value == "json";
+            }
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+
+        print_header( json );
+
+        // every combination, threads change the fastest
+        size_t total = types.size() * distributions.size() * sizes.size() * mems.size() * merges.size() * threads.size();
+        for( size_t index = 0; index < total; ++index )
+        {
+            size_t i = index;
+            configuration c;
+            c.threads = threads[ i % threads.size() ];
+            i /= threads.size();
+            c.merge_at_once = merges[ i % merges.size() ];
+            i /= merges.size();
+            c.avail_mem = mems[ i % mems.size() ];
+            i /= mems.size();
+            c.items = sizes[ i % sizes.size() ];
+            i /= sizes.size();
+            c.distribution = distributions[ i % distributions.size() ];
+            i /= distributions.size();
+            c.type = types[ i ];
+
+            print_row( json, !index, c, run( c, work_folder ) );
+        }
+
+        if( json ){
+            std::cout << "\n]" << std::endl;
+        }
+    }
+    catch( const std::exception& e )
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+// Compares the loser tree used by mergesort_files with the linear scan
+// over file_parts it replaced, for different numbers of merged parts.
+// Parts are kept in memory so only the selection cost is measured.
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include "../details/file_part.hpp"
+#include "../details/loser_tree.hpp"
+
+using namespace external_sort::merge;
+using parts = std::vector< file_part< size_t > >;
+
+std::vector< std::vector< size_t > > generate_runs( size_t k, size_t items )
+{
+    std::default_random_engine e( 42 );
+    std::uniform_int_distribution< size_t > dist;
+    std::vector< std::vector< size_t > > runs( k );
+
+    for( auto& r : runs )
+    {
+        r.resize( items / k );
+        for( auto& v : r ){
+            v = dist( e );
+        }
+
+        std::sort( r.begin(), r.end() );
+    }
+
+    return runs;
+}
+
+parts make_parts( const std::vector< std::vector< size_t > >& runs )
+{
+    parts result( runs.size() );
+    for( size_t i = 0; i < runs.size(); ++i )
+    {
+        auto copy = runs[ i ];
+        result[ i ].update_data( external_sort::memory::buffer< size_t >( copy.begin(), copy.end() ) );
+        result[ i ].set_file_index( static_cast< int >( i ) );
+    }
+
+    return result;
+}
+
+size_t scan_merge( parts& p, std::vector< size_t >& out )
+{
+    while( true )
+    {
+        file_part< size_t >* min_part{ nullptr };
+        for( auto& part : p )
+        {
+            if( !part.finished() && ( !min_part || min_part->peek_next() > part.peek_next() ) ){
+                min_part = &part;
+            }
+        }
+
+        if( !min_part ){
+            break;
+        }
+
+        out.push_back( min_part->next() );
+    }
+
+    return out.size();
+}
+
+size_t tree_merge( parts& p, std::vector< size_t >& out )
+{
+    loser_tree< parts > tree( p, p.size() );
+    while( !tree.empty() )
+    {
+        out.push_back( p[ tree.top() ].next() );
+        tree.replay();
+    }
+
+    return out.size();
+}
+
+template< typename Merge >
+double measure( const std::vector< std::vector< size_t > >& runs, size_t items, Merge merge, std::vector< size_t >& out )
+{
+    auto p = make_parts( runs );
+    out.clear();
+    out.reserve( items );
+
+    auto start = std::chrono::steady_clock::now();
+    merge( p, out );
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration< double >( end - start ).count();
+}
+
+int main( int argc, char* argv[] )
+{
+    size_t items = argc > 1 ? std::stoul( argv[ 1 ] ) : 1 << 22;
+
+    std::cout << std::setw( 6 ) << "k"
+              << std::setw( 14 ) << "scan, Mel/s"
+              << std::setw( 14 ) << "tree, Mel/s"
+              << std::setw( 10 ) << "speedup" << std::endl;
+
+    for( size_t k = 2; k <= 512; k *= 2 )
+    {
+        auto runs = generate_runs( k, items );
+        size_t total = ( items / k ) * k;
+
+        std::vector< size_t > scan_out, tree_out;
+        double scan = measure( runs, total, scan_merge, scan_out );
+        double tree = measure( runs, total, tree_merge, tree_out );
+
+        if( scan_out != tree_out )
+        {
+            std::cout << "results differ for k = " << k << std::endl;
+            return 1;
+        }
+
+        std::cout << std::setw( 6 ) << k << std::fixed << std::setprecision( 1 )
+                  << std::setw( 14 ) << total / scan / 1e6
+                  << std::setw( 14 ) << total / tree / 1e6
+                  << std::setw( 9 ) << scan / tree << "x" << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+// Compares concurrency::async, the work-stealing pool split and merge
+// run on, with the mutex and polling based pool it replaced:
+// throughput of tiny tasks, and the latency of waking an idle pool up
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../details/async.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+// The pool as it was: one locked queue, idle workers poll it every 5 ms
+class polling_async
+{
+public:
+    explicit polling_async( size_t number_of_threads )
+    {
+        for( size_t thread = 0; thread < number_of_threads; ++thread ){
+            add_thread();
+        }
+    }
+
+    ~polling_async()
+    {
+        m_running = false;
+
+        for( auto& t : m_pool ){
+            t.join();
+        }
+    }
+
+    template< typename PackTask >
+    auto run( std::packaged_task< PackTask() >& task  ) -> std::future< PackTask >
+    {
+        std::unique_lock< std::mutex > l{ m_sync_mutex };
+        ++m_currently_working;
+
+        auto result = task.get_future();
+        m_tasks.push_back( [ &task, this ]
+        {
+            task();
+            --m_currently_working;
+        });
+
+        m_cv.notify_one();
+        return result;
+    }
+
+private:
+    void add_thread()
+    {
+        m_pool.emplace_back( [ this ]()
+        {
+            while( m_running )
+            {
+                std::function< void() > task;
+
+                {
+                    std::unique_lock< std::mutex > l{ m_sync_mutex };
+
+                    if( m_tasks.empty() )
+                    {
+                        m_cv.wait_for( l, std::chrono::duration< int, std::milli >( 5 ) );
+                        continue;
+                    }
+
+                    task = std::move( m_tasks.front() );
+                    m_tasks.pop_front();
+                }
+
+                task();
+            }
+        });
+    }
+
+private:
+    std::vector< std::thread > m_pool;
+    std::deque< std::function< void() > > m_tasks;
+    std::atomic_bool m_running{ true };
+    std::atomic_size_t m_currently_working{ 0 };
+    std::mutex m_sync_mutex;
+    std::condition_variable m_cv;
+};
+
+// Tasks per second, each task just bumps a counter
+template< typename Pool >
+double throughput( size_t threads, size_t tasks_num )
+{
+    Pool pool( threads );
+    std::atomic_size_t counter{ 0 };
+    std::list< std::packaged_task< void() > > tasks;
+    std::list< std::future< void > > results;
+
+    auto start = clock_type::now();
+
+    for( size_t task = 0; task < tasks_num; ++task )
+    {
+        tasks.emplace_back( [ &counter ](){ ++counter; } );
+        results.push_back( pool.run( tasks.back() ) );
+    }
+
+    for( auto& r : results ){
+        r.get();
+    }
+
+    auto end = clock_type::now();
+
+    if( counter != tasks_num ){
+        throw std::runtime_error( "not every task has been run" );
+    }
+
+    return tasks_num / std::chrono::duration< double >( end - start ).count();
+}
+
+// Average microseconds from posting a task to an idle pool until it starts
+template< typename Pool >
+double wake_up_latency( size_t threads, size_t samples )
+{
+    Pool pool( threads );
+    double total = 0;
+
+    for( size_t sample = 0; sample < samples; ++sample )
+    {
+        // let the workers go idle
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+
+        clock_type::time_point started;
+        std::packaged_task< void() > task( [ &started ](){ started = clock_type::now(); } );
+
+        auto posted = clock_type::now();
+        pool.run( task ).get();
+
+        total += std::chrono::duration< double, std::micro >( started - posted ).count();
+    }
+
+    return total / samples;
+}
+
+int main( int argc, char* argv[] )
+{
+    size_t tasks_num = argc > 1 ? std::stoul( argv[ 1 ] ) : 1 << 18;
+    size_t max_threads = std::max< size_t >( std::thread::hardware_concurrency(), 2 );
+
+    std::cout << std::setw( 8 ) << "threads"
+              << std::setw( 18 ) << "polling, Mtask/s"
+              << std::setw( 18 ) << "stealing, Mtask/s"
+              << std::setw( 18 ) << "polling wake, us"
+              << std::setw( 18 ) << "stealing wake, us" << std::endl;
+
+    for( size_t threads = 1; threads <= max_threads; threads *= 2 )
+    {
+        double polling = throughput< polling_async >( threads, tasks_num );
+        double stealing = throughput< external_sort::concurrency::async >( threads, tasks_num );
+        double polling_wake = wake_up_latency< polling_async >( threads, 20 );
+        double stealing_wake = wake_up_latency< external_sort::concurrency::async >( threads, 20 );
+
+        std::cout << std::setw( 8 ) << threads << std::fixed << std::setprecision( 2 )
+                  << std::setw( 18 ) << polling / 1e6
+                  << std::setw( 18 ) << stealing / 1e6
+                  << std::setw( 18 ) << polling_wake
+                  << std::setw( 18 ) << stealing_wake << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+// Compares the in-memory sort chunks go through (sorting::sort)
+// and the vectorized kernel alone (sorting::simd_sort) with std::sort
+// on random keys of different types
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../details/simd_sort.hpp"
+#include "../details/sort.hpp"
+
+template< typename Sort, typename T >
+double measure( Sort sort, std::vector< T > data )
+{
+    auto start = std::chrono::steady_clock::now();
+    sort( data.data(), data.data() + data.size() );
+    auto end = std::chrono::steady_clock::now();
+
+    if( !std::is_sorted( data.begin(), data.end() ) ){
+        throw std::runtime_error( "data is not sorted" );
+    }
+
+    return std::chrono::duration< double >( end - start ).count();
+}
+
+template< typename T >
+void benchmark( const std::string& type, size_t items )
+{
+    std::default_random_engine e( 42 );
+    std::uniform_int_distribution< int64_t > dist( std::numeric_limits< int64_t >::min() / 2,
+                                                   std::numeric_limits< int64_t >::max() / 2 );
+
+    std::vector< T > data( items );
+    for( auto& v : data ){
+        v = static_cast< T >( dist( e ) );
+    }
+
+    double std_sort = measure( []( T* first, T* last ){ std::sort( first, last ); }, data );
+    double sort = measure( &external_sort::sorting::sort< T >, data );
+    double simd_sort = measure( []( T* first, T* last ){ external_sort::sorting::simd_sort( first, last ); }, data );
+
+    std::cout << std::setw( 10 ) << type << std::fixed << std::setprecision( 1 )
+              << std::setw( 18 ) << items / std_sort / 1e6
+              << std::setw( 18 ) << items / sort / 1e6
+              << std::setw( 9 ) << std_sort / sort << "x"
+              << std::setw( 18 ) << items / simd_sort / 1e6
+              << std::setw( 9 ) << std_sort / simd_sort << "x" << std::endl;
+}
+
+int main( int argc, char* argv[] )
+{
+    size_t items = argc > 1 ? std::stoul( argv[ 1 ] ) : 1 << 24;
+
+    std::cout << std::setw( 10 ) << "type"
+              << std::setw( 18 ) << "std::sort, Mel/s"
+              << std::setw( 18 ) << "sort, Mel/s"
+              << std::setw( 10 ) << "speedup"
+              << std::setw( 18 ) << "simd_sort, Mel/s"
+              << std::setw( 10 ) << "speedup" << std::endl;
+
+    benchmark< uint32_t >( "uint32_t", items );
+    benchmark< int32_t >( "int32_t", items );
+    benchmark< float >( "float", items );
+    benchmark< uint64_t >( "uint64_t", items );
+    benchmark< int64_t >( "int64_t", items );
+    benchmark< double >( "double", items );
+
+    return 0;
+}
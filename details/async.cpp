@@ -6,9 +6,26 @@ namespace external_sort
 namespace concurrency
 {
 
+namespace
+{
+
+// the pool and the queue of the worker running on this thread if any
+thread_local const async* current_pool{ nullptr };
+thread_local size_t current_worker{ 0 };
+
+const size_t queue_capacity = 1024;
+
+// rounds a worker looks for tasks before going to sleep
+const size_t spins_before_parking = 64;
+
+}
 
 async::async( size_t number_of_threads )
 {
+    for( size_t thread = 0; thread < number_of_threads; ++thread ){
+        m_queues.emplace_back( new task_queue( queue_capacity ) );
+    }
+
     for( size_t thread = 0; thread < number_of_threads; ++thread ){
         add_thread();
     }
@@ -16,7 +33,12 @@ async::async( size_t number_of_threads )
 
 async::~async()
 {
-    m_running = false;
+    {
+        std::lock_guard< std::mutex > l{ m_park_mutex };
+        m_running = false;
+    }
+
+    m_park.notify_all();
 
     for( auto& t : m_pool ){
         t.join();
@@ -25,41 +47,121 @@ async::~async()
 
 void async::wait_for_first_vacant() const
 {
-    if( m_currently_working == m_pool.size() )
+    if( m_currently_working >= m_pool.size() )
     {
         std::unique_lock< std::mutex > l{ m_sync_mutex };
+        ++m_vacancy_waiters;
         m_done.wait( l, [ this ](){ return m_currently_working < m_pool.size(); } );
+        --m_vacancy_waiters;
     }
 }
 
-
 void async::add_thread()
 {
-    std::thread t{
-                [ this ]()
+    size_t worker = m_pool.size();
+    m_pool.emplace_back( &async::work, this, worker );
+}
+
+void async::push( task&& t )
+{
+    // counted before it's visible, so a worker can't miss it while parking
+    ++m_queued;
+
+    size_t queues = m_queues.size();
+    size_t first = current_pool == this ? current_worker : m_next_queue++ % queues;
+
+    bool pushed = false;
+    for( size_t q = 0; q < queues && !pushed; ++q ){
+        pushed = m_queues[ ( first + q ) % queues ]->push( t );
+    }
+
+    if( !pushed )
+    {
+        std::lock_guard< std::mutex > l{ m_overflow_mutex };
+        m_overflow.push_back( std::move( t ) );
+        ++m_overflow_size;
+    }
+
+    if( m_sleeping )
+    {
+        std::lock_guard< std::mutex > l{ m_park_mutex };
+        m_park.notify_one();
+    }
+}
+
+bool async::try_pop( size_t worker, task& t )
+{
+    // own queue first, then steal
+    size_t queues = m_queues.size();
+    for( size_t q = 0; q < queues; ++q )
+    {
+        if( m_queues[ ( worker + q ) % queues ]->pop( t ) ){
+            return true;
+        }
+    }
+
+    if( m_overflow_size )
     {
-        while( m_running )
+        std::lock_guard< std::mutex > l{ m_overflow_mutex };
+        if( !m_overflow.empty() )
         {
-            std::function< void() > task;
+            t = std::move( m_overflow.front() );
+            m_overflow.pop_front();
+            --m_overflow_size;
+            return true;
+        }
+    }
 
-            {
-                std::unique_lock< std::mutex > l{ m_sync_mutex };
+    return false;
+}
 
-                if( m_tasks.empty() )
-                {
-                    m_cv.wait_for( l, std::chrono::duration< int, std::milli >( 5 ) );
-                    continue;
-                }
+void async::work( size_t worker )
+{
+    current_pool = this;
+    current_worker = worker;
 
-                task = std::move( m_tasks.front() );
-                m_tasks.pop_front();
-            }
+    task t;
+    size_t idle_rounds = 0;
 
-            task();
+    while( true )
+    {
+        if( try_pop( worker, t ) )
+        {
+            --m_queued;
+            t();
+            t = task{};
+            idle_rounds = 0;
+            continue;
         }
-    }};
 
-    m_pool.push_back( std::move( t ) );
+        // tasks left in the queues are still run after the pool is stopped
+        if( !m_running && !m_queued ){
+            break;
+        }
+
+        if( ++idle_rounds < spins_before_parking )
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock< std::mutex > l{ m_park_mutex };
+        ++m_sleeping;
+        m_park.wait( l, [ this ](){ return m_queued || !m_running; } );
+        --m_sleeping;
+        idle_rounds = 0;
+    }
+}
+
+void async::finished()
+{
+    --m_currently_working;
+
+    if( m_vacancy_waiters )
+    {
+        std::lock_guard< std::mutex > l{ m_sync_mutex };
+        m_done.notify_all();
+    }
 }
 
 }// concurrency
@@ -7,7 +7,10 @@
 #include <vector>
 #include <future>
 #include <deque>
+#include <memory>
 #include <condition_variable>
+#include "task.hpp"
+#include "task_queue.hpp"
 
 namespace external_sort
 {
@@ -15,6 +18,11 @@ namespace external_sort
 namespace concurrency
 {
 
+// Work-stealing thread pool.
+// Every worker has a lock-free queue of its own, tasks posted by a worker go to
+// its queue and the ones from outside are spread over all of them. A worker
+// with an empty queue steals from the others, and once there's nothing anywhere
+// it sleeps until a task is posted instead of polling
 class async
 {
 public:
@@ -23,18 +31,54 @@ public:
 
     template< typename PackTask >
     auto run( std::packaged_task< PackTask() >& task  ) -> std::future< PackTask >;
+
+    // Runs a callable, which may be move-only and must not throw
+    template< typename F >
+    void post( F&& f );
+
     void wait_for_first_vacant() const;
 
-private:    
+private:
+    // A posted callable that lets the pool know when it's done
+    template< typename F >
+    struct counted
+    {
+        void operator()()
+        {
+            f();
+            pool->finished();
+        }
+
+        async* pool;
+        F f;
+    };
+
     void add_thread();
+    void push( task&& t );
+    bool try_pop( size_t worker, task& t );
+    void work( size_t worker );
+    void finished();
 
 private:
     std::vector< std::thread > m_pool;
-    std::deque< std::function< void() > > m_tasks;
-    bool m_running{ true };
+    std::vector< std::unique_ptr< task_queue > > m_queues;
+    std::atomic_bool m_running{ true };
+
+    // tasks in the queues, tells parked workers there's something to do
+    std::atomic_size_t m_queued{ 0 };
+    std::atomic_size_t m_next_queue{ 0 };
+    std::atomic_size_t m_sleeping{ 0 };
+    std::mutex m_park_mutex;
+    std::condition_variable m_park;
+
+    // where tasks go if all the queues are full
+    std::deque< task > m_overflow;
+    std::atomic_size_t m_overflow_size{ 0 };
+    std::mutex m_overflow_mutex;
+
     std::atomic_size_t m_currently_working{ 0 };
+    mutable std::atomic_size_t m_vacancy_waiters{ 0 };
     mutable std::mutex m_sync_mutex;
-    mutable std::condition_variable m_cv;
     mutable std::condition_variable m_done;
 };
 
@@ -43,21 +87,23 @@ private:
 template< typename PackTask >
 auto async::run( std::packaged_task< PackTask() >& task  ) -> std::future< PackTask >
 {
-    std::unique_lock< std::mutex > l{ m_sync_mutex };
-
     auto result = task.get_future();
-    m_tasks.push_back( [ &task, this ]
-    {
-        ++m_currently_working;
-        task();
-        --m_currently_working;
-        m_done.notify_one();
-    });
 
-    m_cv.notify_one();
+    std::packaged_task< PackTask() >* t = &task;
+    post( [ t ](){ ( *t )(); } );
+
     return result;
 }
 
+template< typename F >
+void async::post( F&& f )
+{
+    // queued tasks count as working, otherwise wait_for_first_vacant()
+    // lets callers in before the previous task has even started
+    ++m_currently_working;
+    push( task{ counted< typename std::decay< F >::type >{ this, std::forward< F >( f ) } } );
+}
+
 struct Task
 {	
     std::packaged_task< void() > task;
@@ -0,0 +1,436 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "statistics.hpp"
+#include "noexcept_support.hpp"
+
+namespace external_sort
+{
+
+namespace memory
+{
+
+// Buffers of at least this many bytes start at a multiple of it,
+// as O_DIRECT needs for the memory data is read to or written from
+const size_t buffer_alignment = 4096;
+
+// Allocator that default-initializes elements, so resizing a buffer
+// right before reading data into it doesn't zero the memory first.
+// Buffers of a page or more are page aligned
+template< typename T >
+struct default_init_allocator : public std::allocator< T >
+{
+    template< typename U >
+    struct rebind
+    {
+        using other = default_init_allocator< U >;
+    };
+
+    default_init_allocator(){}
+
+    template< typename U >
+    default_init_allocator( const default_init_allocator< U >& ){}
+
+    template< typename U >
+    void construct( U* p )
+    {
+        ::new( static_cast< void* >( p ) ) U;
+    }
+
+    template< typename U, typename... Args >
+    void construct( U* p, Args&&... args )
+    {
+        ::new( static_cast< void* >( p ) ) U( std::forward< Args >( args )... );
+    }
+
+    T* allocate( size_t n, const void* = nullptr )
+    {
+        if( n * sizeof( T ) < buffer_alignment ){
+            return std::allocator< T >::allocate( n );
+        }
+
+        void* p = nullptr;
+#ifdef _WIN32
+        p = _aligned_malloc( n * sizeof( T ), buffer_alignment );
+#else
+        if( posix_memalign( &p, buffer_alignment, n * sizeof( T ) ) ){
+            p = nullptr;
+        }
+#endif
+        if( !p ){
+            throw std::bad_alloc();
+        }
+
+        return static_cast< T* >( p );
+    }
+
+    void deallocate( T* p, size_t n )
+    {
+        if( n * sizeof( T ) < buffer_alignment )
+        {
+            std::allocator< T >::deallocate( p, n );
+            return;
+        }
+
+#ifdef _WIN32
+        _aligned_free( p );
+#else
+        free( p );
+#endif
+    }
+};
+
+// Storage all chunks of data are kept in
+template< typename T >
+using buffer = std::vector< T, default_init_allocator< T > >;
+
+// A bounded pool of buffers shared by the split and the merge phases.
+// Buffers given out plus buffers kept for reuse never exceed max_bytes,
+// idle ones are freed to make room for new allocations when needed and
+// a request that doesn't fit waits for buffers given out to come back.
+// Only buffers the pool gave out are counted, others released to it are freed.
+// Everything reading and writing for a sort has the pool at hand,
+// so it carries the sort's statistics counters as well.
+// Phases running at the same time take pools of their own, each reserving
+// its share of the sort's pool, so one of them can't starve the other
+template< typename T >
+class buffer_pool
+{
+public:
+    explicit buffer_pool( size_t max_bytes );
+
+    // Reserves max_bytes of parent for the buffers of this pool, throws if
+    // they don't fit. Shares the counters of parent and adds its numbers to
+    // those of parent when destroyed, buffers given out must be back by then
+    buffer_pool( buffer_pool& parent, size_t max_bytes );
+    ~buffer_pool();
+
+    buffer_pool( const buffer_pool& ) = delete;
+    buffer_pool& operator=( const buffer_pool& ) = delete;
+
+    // Returns an empty buffer able to hold at least items elements, blocks
+    // while it doesn't fit. Throws if it can't fit even into an empty pool
+    buffer< T > acquire( size_t items );
+
+    // Takes back a buffer it gave out, any other one is freed
+    void release( buffer< T >&& b );
+
+    size_t hits() const;
+    size_t misses() const;
+
+    // The most bytes given out and kept for reuse at once, by this pool
+    // and the pools taking their memory from it
+    size_t peak_bytes() const;
+
+    inline statistics_details::counters& counters() NOEXCEPT;
+
+private:
+    static size_t bytes( const buffer< T >& b );
+    void evict_for( size_t bytes_needed );
+
+    // Takes an idle buffer of exactly items elements, false if there is none
+    bool reuse( size_t items, buffer< T >& result );
+
+    size_t used_bytes() const;
+
+    // Tells the parent how many bytes this pool holds now
+    void update_parent();
+
+    // Called by pools taking their memory from this one, the peak counts
+    // the bytes they hold rather than their whole shares
+    void reserve( size_t bytes );
+    void unreserve( size_t bytes, size_t hits, size_t misses );
+    void update_shared( size_t old_bytes, size_t new_bytes );
+
+private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_released;
+    std::vector< buffer< T > > m_idle;
+    std::unordered_map< const T*, size_t > m_given; // bytes counted for every buffer given out
+    size_t m_idle_bytes{ 0 };
+    size_t m_given_bytes{ 0 };
+    size_t m_reserved_bytes{ 0 }; // shares of pools taking memory from this one
+    size_t m_shared_bytes{ 0 }; // bytes those pools hold
+    size_t m_max_bytes;
+    buffer_pool* m_parent{ nullptr };
+    size_t m_parent_bytes{ 0 }; // bytes the parent was told this pool holds
+    size_t m_hits{ 0 };
+    size_t m_misses{ 0 };
+    size_t m_peak_bytes{ 0 };
+    statistics_details::counters m_counters;
+};
+
+///// implementation
+
+template< typename T >
+buffer_pool< T >::buffer_pool( size_t max_bytes ) : m_max_bytes( max_bytes )
+{
+
+}
+
+template< typename T >
+buffer_pool< T >::buffer_pool( buffer_pool& parent, size_t max_bytes ) : m_max_bytes( max_bytes ), m_parent( &parent )
+{
+    m_parent->reserve( max_bytes );
+}
+
+template< typename T >
+buffer_pool< T >::~buffer_pool()
+{
+    if( !m_parent ){
+        return;
+    }
+
+    m_idle.clear();
+    m_parent->update_shared( m_parent_bytes, 0 );
+    m_parent->unreserve( m_max_bytes, m_hits, m_misses );
+}
+
+template< typename T >
+buffer< T > buffer_pool< T >::acquire( size_t items )
+{
+    size_t needed = items * sizeof( T );
+    if( needed > m_max_bytes ){
+        throw std::runtime_error( "Not enough memory for a buffer of " + std::to_string( needed ) + " bytes" );
+    }
+
+    std::unique_lock< std::mutex > l{ m_mutex };
+    buffer< T > result;
+
+    if( reuse( items, result ) )
+    {
+        ++m_hits;
+        return result;
+    }
+
+    ++m_misses;
+
+    // a buffer coming back may be reused as well
+    m_released.wait( l, [ & ]()
+    {
+        if( reuse( items, result ) ){
+            return true;
+        }
+
+        evict_for( needed );
+        return used_bytes() + needed <= m_max_bytes;
+    });
+
+    if( result.capacity() )
+    {
+        update_parent();
+        return result;
+    }
+
+    m_given_bytes += needed;
+    m_peak_bytes = std::max( m_peak_bytes, m_idle_bytes + m_given_bytes + m_shared_bytes );
+    update_parent();
+    l.unlock();
+
+    try{
+        result.reserve( items );
+    }
+    catch( ... )
+    {
+        l.lock();
+        m_given_bytes -= needed;
+        update_parent();
+        m_released.notify_all();
+        throw;
+    }
+
+    if( needed )
+    {
+        l.lock();
+        m_given[ result.data() ] = needed;
+    }
+
+    return result;
+}
+
+template< typename T >
+bool buffer_pool< T >::reuse( size_t items, buffer< T >& result )
+{
+    // only a buffer of the requested size, callers budget their memory in
+    // the items they ask for and a larger one would take more than their share.
+    // Larger idle buffers are evicted when the pool runs out of room
+    auto best = std::find_if( m_idle.begin(), m_idle.end(), [ items ]( const buffer< T >& b ){
+        return b.capacity() == items; } );
+
+    if( best == m_idle.end() ){
+        return false;
+    }
+
+    result = std::move( *best );
+    m_idle.erase( best );
+    m_idle_bytes -= bytes( result );
+    m_given_bytes += bytes( result );
+    m_given[ result.data() ] = bytes( result );
+    return true;
+}
+
+template< typename T >
+void buffer_pool< T >::release( buffer< T >&& b )
+{
+    size_t size = bytes( b );
+    if( !size ){
+        return;
+    }
+
+    buffer< T > dropped;
+
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+
+        // a buffer from elsewhere is just freed
+        auto given = m_given.find( b.data() );
+        if( given == m_given.end() )
+        {
+            dropped = std::move( b );
+            return;
+        }
+
+        m_given_bytes -= given->second;
+        m_given.erase( given );
+
+        if( used_bytes() + size <= m_max_bytes )
+        {
+            b.clear();
+            m_idle.emplace_back( std::move( b ) );
+            m_idle_bytes += size;
+        }
+        else{
+            dropped = std::move( b ); // freed outside the lock
+        }
+
+        update_parent();
+    }
+
+    m_released.notify_all();
+}
+
+template< typename T >
+size_t buffer_pool< T >::hits() const
+{
+    std::lock_guard< std::mutex > l{ m_mutex };
+    return m_hits;
+}
+
+template< typename T >
+size_t buffer_pool< T >::misses() const
+{
+    std::lock_guard< std::mutex > l{ m_mutex };
+    return m_misses;
+}
+
+template< typename T >
+size_t buffer_pool< T >::peak_bytes() const
+{
+    std::lock_guard< std::mutex > l{ m_mutex };
+    return m_peak_bytes;
+}
+
+template< typename T >
+inline statistics_details::counters& buffer_pool< T >::counters() NOEXCEPT
+{
+    return m_parent ? m_parent->counters() : m_counters;
+}
+
+template< typename T >
+size_t buffer_pool< T >::bytes( const buffer< T >& b )
+{
+    return b.capacity() * sizeof( T );
+}
+
+template< typename T >
+void buffer_pool< T >::evict_for( size_t bytes_needed )
+{
+    // largest buffers go first, they are the least likely to fit
+    while( !m_idle.empty() && used_bytes() + bytes_needed > m_max_bytes )
+    {
+        auto largest = std::max_element( m_idle.begin(), m_idle.end(),
+                                          []( const buffer< T >& l, const buffer< T >& r ){
+                                              return l.capacity() < r.capacity(); } );
+
+        m_idle_bytes -= bytes( *largest );
+        m_idle.erase( largest );
+    }
+}
+
+template< typename T >
+size_t buffer_pool< T >::used_bytes() const
+{
+    return m_idle_bytes + m_given_bytes + m_reserved_bytes;
+}
+
+template< typename T >
+void buffer_pool< T >::update_parent()
+{
+    if( !m_parent ){
+        return;
+    }
+
+    size_t held = m_idle_bytes + m_given_bytes;
+    if( held != m_parent_bytes )
+    {
+        m_parent->update_shared( m_parent_bytes, held );
+        m_parent_bytes = held;
+    }
+}
+
+template< typename T >
+void buffer_pool< T >::reserve( size_t bytes )
+{
+    std::lock_guard< std::mutex > l{ m_mutex };
+
+    evict_for( bytes );
+    if( used_bytes() + bytes > m_max_bytes ){
+        throw std::runtime_error( "Not enough memory to reserve " + std::to_string( bytes ) + " bytes" );
+    }
+
+    m_reserved_bytes += bytes;
+    update_parent();
+}
+
+template< typename T >
+void buffer_pool< T >::unreserve( size_t bytes, size_t hits, size_t misses )
+{
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_reserved_bytes -= bytes;
+        m_hits += hits;
+        m_misses += misses;
+    }
+
+    m_released.notify_all();
+}
+
+template< typename T >
+void buffer_pool< T >::update_shared( size_t old_bytes, size_t new_bytes )
+{
+    std::lock_guard< std::mutex > l{ m_mutex };
+    m_shared_bytes = m_shared_bytes - old_bytes + new_bytes;
+    m_peak_bytes = std::max( m_peak_bytes, m_idle_bytes + m_given_bytes + m_shared_bytes );
+}
+
+}// memory
+
+}// external_sort
+
+#endif
@@ -28,6 +28,12 @@ std::string temp_file_path( const std::string& work_folder, size_t file_index )
     return work_folder + "_temp_"+ std::to_string( file_index );
 }
 
+// Runs made by merging other ones, named apart from the ones split makes
+std::string merged_file_path( const std::string& work_folder, size_t file_index )
+{
+    return work_folder + "_merged_"+ std::to_string( file_index );
+}
+
 }// details
 
 }// external_sort
@@ -0,0 +1,209 @@
+#include "compression.hpp"
+
+#include <fstream>
+#include <vector>
+
+namespace external_sort
+{
+
+namespace compression
+{
+
+namespace
+{
+
+// Every sequence is a token, its literals, then a match unless it's the last one.
+// The token keeps the number of literals in the high nibble and the match length
+// less min_match in the low one, 15 is continued by bytes added up until one
+// is less than 255. A match is the 16 bit distance back to copy from
+const size_t min_match = 4;
+const size_t max_distance = 0xffff;
+const unsigned hash_bits = 12;
+
+uint32_t read32( const char* p )
+{
+    uint32_t v;
+    std::memcpy( &v, p, sizeof( v ) );
+    return v;
+}
+
+size_t hash( uint32_t v ){
+    return ( v * 2654435761u ) >> ( 32 - hash_bits );
+}
+
+char* put_length( char* out, size_t length )
+{
+    for( ; length >= 255; length -= 255 ){
+        *out++ = static_cast< char >( 255 );
+    }
+
+    *out++ = static_cast< char >( length );
+    return out;
+}
+
+size_t get_length( const unsigned char*& in, const unsigned char* end, size_t length )
+{
+    if( length != 15 ){
+        return length;
+    }
+
+    unsigned char byte;
+    do
+    {
+        if( in == end ){
+            throw compression_details::corrupted();
+        }
+
+        byte = *in++;
+        length += byte;
+    }
+    while( byte == 255 );
+
+    return length;
+}
+
+char* put_sequence( char* out, const char* literals, size_t literals_size, size_t distance, size_t match )
+{
+    size_t lit_nibble = std::min< size_t >( literals_size, 15 );
+    size_t match_nibble = match ? std::min< size_t >( match - min_match, 15 ) : 0;
+    *out++ = static_cast< char >( ( lit_nibble << 4 ) | match_nibble );
+
+    if( lit_nibble == 15 ){
+        out = put_length( out, literals_size - 15 );
+    }
+
+    std::memcpy( out, literals, literals_size );
+    out += literals_size;
+
+    // the last sequence has no match
+    if( !match ){
+        return out;
+    }
+
+    *out++ = static_cast< char >( distance & 0xff );
+    *out++ = static_cast< char >( distance >> 8 );
+
+    if( match_nibble == 15 ){
+        out = put_length( out, match - min_match - 15 );
+    }
+
+    return out;
+}
+
+}
+
+size_t lz_bound( size_t size )
+{
+    return size + size / 255 + 16;
+}
+
+size_t lz_compress( const char* src, size_t size, char* dst )
+{
+    // positions of the last places every hash of four bytes was seen at
+    std::vector< uint32_t > table( 1 << hash_bits, 0 );
+
+    char* out = dst;
+    size_t anchor = 0; // literals not written yet start there
+    size_t pos = 0;
+
+    while( pos + min_match <= size )
+    {
+        // a candidate is checked byte by byte, so a stale one is just a miss
+        uint32_t v = read32( src + pos );
+        uint32_t& slot = table[ hash( v ) ];
+        size_t candidate = slot;
+        slot = static_cast< uint32_t >( pos );
+
+        if( candidate >= pos || pos - candidate > max_distance || read32( src + candidate ) != v )
+        {
+            ++pos;
+            continue;
+        }
+
+        size_t match = min_match;
+        while( pos + match < size && src[ candidate + match ] == src[ pos + match ] ){
+            ++match;
+        }
+
+        out = put_sequence( out, src + anchor, pos - anchor, pos - candidate, match );
+        pos += match;
+        anchor = pos;
+    }
+
+    out = put_sequence( out, src + anchor, size - anchor, 0, 0 );
+    return static_cast< size_t >( out - dst );
+}
+
+void lz_decompress( const char* src, size_t size, char* dst, size_t dst_size )
+{
+    const unsigned char* in = reinterpret_cast< const unsigned char* >( src );
+    const unsigned char* end = in + size;
+    size_t done = 0;
+
+    while( in != end )
+    {
+        unsigned char token = *in++;
+
+        size_t literals = get_length( in, end, token >> 4 );
+        if( literals > static_cast< size_t >( end - in ) || literals > dst_size - done ){
+            throw compression_details::corrupted();
+        }
+
+        std::memcpy( dst + done, in, literals );
+        in += literals;
+        done += literals;
+
+        // the last sequence ends with its literals
+        if( in == end ){
+            break;
+        }
+
+        if( end - in < 2 ){
+            throw compression_details::corrupted();
+        }
+
+        size_t distance = in[ 0 ] | ( static_cast< size_t >( in[ 1 ] ) << 8 );
+        in += 2;
+
+        size_t match = get_length( in, end, token & 0x0f ) + min_match;
+        if( !distance || distance > done || match > dst_size - done ){
+            throw compression_details::corrupted();
+        }
+
+        // a match may overlap the bytes it makes, so it's copied byte by byte
+        for( size_t i = 0; i < match; ++i, ++done ){
+            dst[ done ] = dst[ done - distance ];
+        }
+    }
+
+    if( done != dst_size ){
+        throw compression_details::corrupted();
+    }
+}
+
+size_t items_in_run( const std::string& path )
+{
+    std::ifstream in( path, std::ios::in | std::ifstream::binary );
+    if( !in.good() ){
+        throw std::invalid_argument( path + " doesn't exist or occupied by another process" );
+    }
+
+    size_t items = 0;
+    block_header header;
+
+    while( in.read( reinterpret_cast< char* >( &header ), sizeof( header ) ) )
+    {
+        items += header.items;
+        in.seekg( static_cast< std::streamoff >( header.bytes ), std::ios::cur );
+    }
+
+    if( in.gcount() ){
+        throw compression_details::corrupted();
+    }
+
+    return items;
+}
+
+}// compression
+
+}// external_sort
@@ -0,0 +1,253 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "buffer_pool.hpp"
+
+namespace external_sort
+{
+
+namespace compression
+{
+
+// How the payload of a block is stored
+enum class codec : uint64_t
+{
+    none, // items as they are, for blocks that don't get any smaller
+    delta_varint, // integral items: differences between neighbours, zigzag varints
+    lz // anything else: bytes with repeats replaced by references back
+};
+
+// Compressed runs are blocks, each of them starting with a header
+struct block_header
+{
+    uint64_t items;
+    uint64_t bytes; // of the payload following the header
+    uint64_t codec;
+};
+
+// Number of items of a block. A block is compressed and decompressed
+// as a whole, readers take whole blocks only
+template< typename T >
+inline size_t block_items();
+
+// Appends the blocks of [ data, data + items ) to out
+template< typename T >
+void compress( const T* data, size_t items, memory::buffer< char >& out );
+
+// Restores header.items items of a block from its payload
+template< typename T >
+void decompress( const block_header& header, const char* payload, T* out );
+
+// Number of items of a compressed run, only the headers are read
+size_t items_in_run( const std::string& path );
+
+// The byte codec, dst of lz_compress() must have room for lz_bound() bytes
+size_t lz_bound( size_t size );
+size_t lz_compress( const char* src, size_t size, char* dst );
+void lz_decompress( const char* src, size_t size, char* dst, size_t dst_size );
+
+}// compression
+
+namespace compression_details
+{
+
+// Integral items up to 64 bits take the delta codec
+template< typename T >
+using is_delta_coded = std::integral_constant< bool,
+                                               std::is_integral< T >::value &&
+                                               !std::is_same< T, bool >::value &&
+                                               sizeof( T ) <= sizeof( uint64_t ) >;
+
+template< typename T >
+size_t encode( const T* data, size_t items, char* dst, std::true_type );
+
+template< typename T >
+size_t encode( const T* data, size_t items, char* dst, std::false_type );
+
+template< typename T >
+void decode_delta( const char* src, size_t size, T* out, size_t items, std::true_type );
+
+template< typename T >
+void decode_delta( const char* src, size_t size, T* out, size_t items, std::false_type );
+
+// Upper bound of an encoded block of items
+template< typename T >
+size_t bound( size_t items );
+
+inline std::runtime_error corrupted(){
+    return std::runtime_error{ "A compressed run is corrupted" };
+}
+
+}// compression_details
+
+///// implementation
+
+namespace compression
+{
+
+template< typename T >
+inline size_t block_items()
+{
+    const size_t block_bytes = 1 << 15;
+    return std::max< size_t >( block_bytes / sizeof( T ), 1 );
+}
+
+template< typename T >
+void compress( const T* data, size_t items, memory::buffer< char >& out )
+{
+    using delta_coded = compression_details::is_delta_coded< T >;
+
+    for( size_t first = 0; first < items; first += block_items< T >() )
+    {
+        size_t size = std::min( block_items< T >(), items - first );
+        size_t raw_bytes = size * sizeof( T );
+
+        size_t at = out.size();
+        out.resize( at + sizeof( block_header ) + std::max( raw_bytes, compression_details::bound< T >( size ) ) );
+        char* payload = out.data() + at + sizeof( block_header );
+
+        block_header header{ size, 0, static_cast< uint64_t >( delta_coded::value ? codec::delta_varint : codec::lz ) };
+        header.bytes = compression_details::encode( data + first, size, payload, delta_coded{} );
+
+        // random data is stored as it is
+        if( header.bytes >= raw_bytes )
+        {
+            header.bytes = raw_bytes;
+            header.codec = static_cast< uint64_t >( codec::none );
+            std::memcpy( payload, data + first, raw_bytes );
+        }
+
+        std::memcpy( out.data() + at, &header, sizeof( header ) );
+        out.resize( at + sizeof( block_header ) + header.bytes );
+    }
+}
+
+template< typename T >
+void decompress( const block_header& header, const char* payload, T* out )
+{
+    switch( static_cast< codec >( header.codec ) )
+    {
+    case codec::none:
+        if( header.bytes != header.items * sizeof( T ) ){
+            throw compression_details::corrupted();
+        }
+
+        std::memcpy( out, payload, header.bytes );
+        break;
+
+    case codec::delta_varint:
+        compression_details::decode_delta( payload, header.bytes, out, header.items,
+                                           compression_details::is_delta_coded< T >{} );
+        break;
+
+    case codec::lz:
+        lz_decompress( payload, header.bytes, reinterpret_cast< char* >( out ), header.items * sizeof( T ) );
+        break;
+
+    default:
+        throw compression_details::corrupted();
+    }
+}
+
+}// compression
+
+namespace compression_details
+{
+
+template< typename T >
+size_t bound( size_t items )
+{
+    // a varint takes up to 10 bytes
+    return is_delta_coded< T >::value ? items * 10 : compression::lz_bound( items * sizeof( T ) );
+}
+
+template< typename T >
+size_t encode( const T* data, size_t items, char* dst, std::true_type )
+{
+    using unsigned_type = typename std::make_unsigned< T >::type;
+    using signed_type = typename std::make_signed< T >::type;
+
+    // sorted runs have small differences between neighbours, zigzag keeps
+    // the negative ones of unsorted data small as well
+    unsigned char* out = reinterpret_cast< unsigned char* >( dst );
+    unsigned_type prev = 0;
+
+    for( size_t i = 0; i < items; ++i )
+    {
+        unsigned_type value = static_cast< unsigned_type >( data[ i ] );
+        int64_t delta = static_cast< signed_type >( static_cast< unsigned_type >( value - prev ) );
+        uint64_t zigzag = ( static_cast< uint64_t >( delta ) << 1 ) ^ static_cast< uint64_t >( delta >> 63 );
+        prev = value;
+
+        while( zigzag >= 0x80 )
+        {
+            *out++ = static_cast< unsigned char >( zigzag | 0x80 );
+            zigzag >>= 7;
+        }
+
+        *out++ = static_cast< unsigned char >( zigzag );
+    }
+
+    return static_cast< size_t >( reinterpret_cast< char* >( out ) - dst );
+}
+
+template< typename T >
+size_t encode( const T* data, size_t items, char* dst, std::false_type )
+{
+    return compression::lz_compress( reinterpret_cast< const char* >( data ), items * sizeof( T ), dst );
+}
+
+template< typename T >
+void decode_delta( const char* src, size_t size, T* out, size_t items, std::true_type )
+{
+    using unsigned_type = typename std::make_unsigned< T >::type;
+
+    const unsigned char* in = reinterpret_cast< const unsigned char* >( src );
+    const unsigned char* end = in + size;
+    unsigned_type prev = 0;
+
+    for( size_t i = 0; i < items; ++i )
+    {
+        uint64_t zigzag = 0;
+        for( unsigned shift = 0; ; shift += 7 )
+        {
+            if( in == end || shift > 63 ){
+                throw corrupted();
+            }
+
+            uint64_t byte = *in++;
+            zigzag |= ( byte & 0x7f ) << shift;
+            if( !( byte & 0x80 ) ){
+                break;
+            }
+        }
+
+        int64_t delta = static_cast< int64_t >( zigzag >> 1 ) ^ -static_cast< int64_t >( zigzag & 1 );
+        prev = static_cast< unsigned_type >( prev + static_cast< unsigned_type >( delta ) );
+        out[ i ] = static_cast< T >( prev );
+    }
+
+    if( in != end ){
+        throw corrupted();
+    }
+}
+
+template< typename T >
+void decode_delta( const char*, size_t, T*, size_t, std::false_type )
+{
+    // only integral items are delta coded
+    throw corrupted();
+}
+
+}// compression_details
+
+}// external_sort
+
+#endif
@@ -2,9 +2,18 @@
 #define FILE_CHUNK_READER_HPP
 
 #include <fstream>
+#include <functional>
+#include <future>
+#include <limits>
 #include <stdexcept>
 #include <memory>
+#include <utility>
 #include <vector>
+#include "buffer_pool.hpp"
+#include "raw_file.hpp"
+#include "mapped_file.hpp"
+#include "compression.hpp"
+#include "io_thread.hpp"
 #include "noexcept_support.hpp"
 
 namespace external_sort
@@ -13,15 +22,40 @@ namespace external_sort
 namespace file
 {
 
-// Reads files by chunks of items
+// Items [ first, second ) of a file
+using item_range = std::pair< size_t, size_t >;
+
+const item_range whole_file{ 0, std::numeric_limits< size_t >::max() };
+
+// Reads files by chunks of items.
+// In prefetch mode the next chunk is read in the background
+// while the caller works with the current one, by a thread the reader
+// keeps for all its reads.
+// Chunks are taken from the pool if there is one.
+// Reading may be limited to a range of items of the file.
+// Files read in a mode other than buffered go through a raw_file,
+// in direct mode chunks are cut at aligned positions of the file:
+// a range starting in the middle of a block gets a short first chunk
+// up to the next block and only the last chunk may end in the middle of one,
+// the block size can't be less than a block of the disk then.
+// In mapped mode chunks are windows of a memory mapping: get_next_chunk()
+// copies them to buffers and get_next_view() gives the window itself.
+// Compressed files are read whole, by whole blocks: a chunk is as many
+// blocks as fit into the block size, at least one. Blocks are decompressed
+// by the read, so in prefetch mode it's done in the background as well.
+// Bytes read and the time spent waiting for chunks go to the pool's counters
 template< class T >
 class file_chunk_reader
 {
 public:
-    using value_type = std::vector< T >;
+    using value_type = memory::buffer< T >;
+    using view_type = std::pair< const T*, const T* >;
 
-public:  
-    explicit file_chunk_reader();
+public:
+    // compressed files aren't mapped, mapped mode reads them as buffered
+    explicit file_chunk_reader( memory::buffer_pool< T >* pool = nullptr,
+                                io_mode mode = io_mode::buffered,
+                                bool compressed = false );
     file_chunk_reader( const file_chunk_reader& ) = delete;
     file_chunk_reader& operator=( const file_chunk_reader& ) = delete;
 
@@ -29,18 +63,66 @@ public:
     // due to VS2013 bug (doesn't generate them even though it should)
     file_chunk_reader( file_chunk_reader&& other );
     file_chunk_reader& operator=( file_chunk_reader&& other );
+    ~file_chunk_reader();
 
-    void open( const std::string& file_path, size_t block_size );
+    void open( const std::string& file_path, size_t block_size, bool prefetch = false, const item_range& range = whole_file );
     void close();
-    const value_type get_next_chunk();
+    value_type get_next_chunk();
+
+    // Next chunk of a mapped file, valid until the next one is asked for
+    view_type get_next_view();
+    inline bool mapped() const NOEXCEPT;
     inline bool completed() const NOEXCEPT;
 
+    // Number of items of the range not read yet
+    inline size_t left() const NOEXCEPT;
+
 private:
-    const std::vector< T > read( size_t number_of_items );
+    struct chunk
+    {
+        value_type data;
+        bool eof{ false };
+    };
+
+    // State of reading a compressed file, shared with the background read
+    struct compressed_input
+    {
+        compression::block_header next; // header of the block the last chunk had no room for
+        bool has_next{ false };
+        memory::buffer< char > payload;
+    };
+
+    static chunk read( std::ifstream& in, size_t number_of_items, memory::buffer_pool< T >* pool );
+    static chunk read_raw( raw_file& in, size_t number_of_items, memory::buffer_pool< T >* pool );
+    static chunk read_compressed( std::ifstream& in,
+                                  raw_file& raw,
+                                  compressed_input& state,
+                                  size_t number_of_items,
+                                  memory::buffer_pool< T >* pool );
+
+    // false if the file ends right away, throws if it ends in the middle
+    static bool read_bytes( std::ifstream& in, raw_file& raw, char* data, size_t bytes );
+    static void count_read( memory::buffer_pool< T >* pool, size_t bytes );
+    chunk read_next();
+    void start_prefetch();
+
+    // Gives a chunk prefetched but never asked for back to the pool
+    void drop_prefetched();
+    size_t next_size();
 
 private:
     std::unique_ptr< std::ifstream > m_in;
+    std::unique_ptr< raw_file > m_raw; // used instead of the stream if open
+    std::unique_ptr< mapped_file > m_map; // same
+    std::unique_ptr< compressed_input > m_compressed; // only for compressed files
+    std::future< chunk > m_next; // chunk being prefetched
+    std::unique_ptr< concurrency::io_thread > m_io; // prefetches, joined before the files above are gone
+    memory::buffer_pool< T >* m_pool;
     size_t m_block_size{ 0 }; // number of items read at once
+    size_t m_left{ 0 }; // items of the range not requested yet
+    size_t m_next_item{ 0 }; // the first of them
+    io_mode m_mode;
+    bool m_prefetch{ false };
     bool m_completed{ false };
 };
 
@@ -49,7 +131,17 @@ private:
 template< typename T >
 file_chunk_reader< T >::file_chunk_reader( file_chunk_reader&& other ) :
     m_in( std::move( other.m_in ) ),
+    m_raw( std::move( other.m_raw ) ),
+    m_map( std::move( other.m_map ) ),
+    m_compressed( std::move( other.m_compressed ) ),
+    m_next( std::move( other.m_next ) ),
+    m_io( std::move( other.m_io ) ),
+    m_pool( other.m_pool ),
     m_block_size( other.m_block_size ),
+    m_left( other.m_left ),
+    m_next_item( other.m_next_item ),
+    m_mode( other.m_mode ),
+    m_prefetch( other.m_prefetch ),
     m_completed( other.m_completed )
 {
 
@@ -58,87 +150,411 @@ file_chunk_reader< T >::file_chunk_reader( file_chunk_reader&& other ) :
 template< typename T >
 file_chunk_reader< T >& file_chunk_reader< T >::operator=( file_chunk_reader&& other )
 {
+    // the old thread finishes its reads before the files they use are replaced
+    drop_prefetched();
+    m_io = std::move( other.m_io );
     m_in = std::move( other.m_in );
+    m_raw = std::move( other.m_raw );
+    m_map = std::move( other.m_map );
+    m_compressed = std::move( other.m_compressed );
+    m_next = std::move( other.m_next );
+    m_pool = other.m_pool;
     m_block_size = other.m_block_size;
+    m_left = other.m_left;
+    m_next_item = other.m_next_item;
+    m_mode = other.m_mode;
+    m_prefetch = other.m_prefetch;
     m_completed = other.m_completed;
 
     return *this;
 }
 
+template< typename T >
+file_chunk_reader< T >::~file_chunk_reader()
+{
+    drop_prefetched();
+}
+
 
 template< class T >
-file_chunk_reader< T >::file_chunk_reader() :
-    m_in( std::unique_ptr< std::ifstream >{ new std::ifstream() } )
+file_chunk_reader< T >::file_chunk_reader( memory::buffer_pool< T >* pool, io_mode mode, bool compressed ) :
+    m_in( std::unique_ptr< std::ifstream >{ new std::ifstream() } ),
+    m_raw( std::unique_ptr< raw_file >{ new raw_file() } ),
+    m_map( std::unique_ptr< mapped_file >{ new mapped_file() } ),
+    m_pool( pool ),
+    m_mode( compressed && mode == io_mode::mapped ? io_mode::buffered : mode )
 {
+    if( compressed ){
+        m_compressed.reset( new compressed_input() );
+    }
 
 }
 
 template< class T >
-const std::vector< T > file_chunk_reader< T >::get_next_chunk()
+typename file_chunk_reader< T >::value_type file_chunk_reader< T >::get_next_chunk()
 {
-    return read( m_block_size );
+    if( m_completed ){
+        return value_type{};
+    }
+
+    // a copy straight from the mapping to the buffer
+    if( m_map->is_open() )
+    {
+        view_type view = get_next_view();
+        size_t items = static_cast< size_t >( view.second - view.first );
+
+        value_type data = m_pool ? m_pool->acquire( items ) : value_type{};
+        data.assign( view.first, view.second );
+        return data;
+    }
+
+    chunk result;
+    {
+        statistics_details::stall_timer stall( m_pool ? &m_pool->counters() : nullptr, statistics_details::stall::read );
+        result = m_prefetch ? m_next.get() : read_next();
+    }
+
+    m_completed = result.eof || !m_left;
+
+    if( m_prefetch && !m_completed ){
+        start_prefetch();
+    }
+
+    return std::move( result.data );
 }
 
 template< class T >
-void file_chunk_reader< T >::open( const std::string& file_path, size_t block_size )
+void file_chunk_reader< T >::open( const std::string& file_path, size_t block_size, bool prefetch, const item_range& range )
 {
+    close();
+
     m_block_size = block_size;
+    m_prefetch = prefetch && m_mode != io_mode::mapped; // the mapping is read ahead anyway
     m_completed = false;
 
-    if( m_in->is_open() ){
-        m_in->close();
+    size_t file_size = 0;
+
+    if( m_mode == io_mode::mapped && mapped_file::supported() )
+    {
+        if( !m_map->open( file_path ) )
+        {
+            throw std::invalid_argument(
+                        file_path + " doesn't exist or occupied by another process" );
+        }
+
+        file_size = m_map->size();
     }
+    else if( m_mode != io_mode::buffered && m_mode != io_mode::mapped && raw_file::supported() )
+    {
+        if( !m_raw->open_read( file_path, m_mode ) )
+        {
+            throw std::invalid_argument(
+                        file_path + " doesn't exist or occupied by another process" );
+        }
 
-    m_in->open( file_path, std::ios::in | std::ifstream::binary | std::ios::ate );
+        file_size = m_raw->size();
 
-    if( !m_in->good() )
+        // a chunk read directly is at least a block of the disk, a smaller
+        // one would take more memory than its reader was given
+        if( m_raw->direct() && block_size < aligned_items< T >() )
+        {
+            throw std::invalid_argument(
+                        file_path + " is read directly, chunks can't be smaller than a disk block" );
+        }
+    }
+    else
     {
-        throw std::invalid_argument(
-                    file_path + " doesn't exist or occupied by another process" );
+        m_in->clear();
+        m_in->open( file_path, std::ios::in | std::ifstream::binary | std::ios::ate );
+
+        if( !m_in->good() )
+        {
+            throw std::invalid_argument(
+                        file_path + " doesn't exist or occupied by another process" );
+        }
+
+        // cals size
+        file_size = static_cast< size_t >( m_in->tellg() );
+        m_in->seekg( 0, m_in->beg );
     }
 
-    // cals size
-    auto file_size = m_in->tellg();
-    m_in->seekg( 0, m_in->beg );
+    if( m_compressed )
+    {
+        if( range.first ){
+            throw std::invalid_argument( file_path + " is compressed, it can only be read from the start" );
+        }
+
+        // the number of items isn't known, the end of the file tells when it's read
+        m_compressed->has_next = false;
+        m_left = std::numeric_limits< size_t >::max();
+        m_next_item = 0;
+
+        if( m_prefetch ){
+            start_prefetch();
+        }
+
+        return;
+    }
 
     if( file_size % sizeof( T ) )
     {
         throw std::length_error{
             file_path + " has size incompatible with the specified type or is corrupted" };
     }
+
+    size_t items = file_size / sizeof( T );
+    size_t first = std::min( range.first, items );
+    m_left = std::max( std::min( range.second, items ), first ) - first;
+    m_next_item = first;
+
+    if( m_raw->is_open() ){
+        m_raw->seek( first * sizeof( T ) );
+    }
+    else{
+        m_in->seekg( first * sizeof( T ), m_in->beg );
+    }
+
+    if( m_prefetch ){
+        start_prefetch();
+    }
 }
 
 template< class T >
 void file_chunk_reader< T >::close(  )
 {
-    m_in->close();
+    // the stream can't be closed under a pending read
+    drop_prefetched();
+
+    if( m_in->is_open() ){
+        m_in->close();
+    }
+
+    m_raw->close();
+    m_map->close();
+}
+
+template< class T >
+typename file_chunk_reader< T >::chunk file_chunk_reader< T >::read( std::ifstream& in,
+                                                                      size_t number_of_items,
+                                                                      memory::buffer_pool< T >* pool )
+{
+    chunk result;
+    if( pool ){
+        result.data = pool->acquire( number_of_items );
+    }
+
+    result.data.resize( number_of_items ); // no zeroing, the buffer allocator leaves items uninitialized
+    in.read( reinterpret_cast< char* >( result.data.data() ), number_of_items * sizeof( T ) );
+    result.data.resize( in.gcount() / sizeof( T ) ); // resize if red less numbers that specified
+    result.eof = in.eof();
+    count_read( pool, static_cast< size_t >( in.gcount() ) );
+
+    return result;
+}
+
+template< class T >
+typename file_chunk_reader< T >::chunk file_chunk_reader< T >::read_raw( raw_file& in,
+                                                                          size_t number_of_items,
+                                                                          memory::buffer_pool< T >* pool )
+{
+    chunk result;
+    if( pool ){
+        result.data = pool->acquire( number_of_items );
+    }
+
+    result.data.resize( number_of_items );
+    size_t bytes = in.read( reinterpret_cast< char* >( result.data.data() ), number_of_items * sizeof( T ) );
+    result.data.resize( bytes / sizeof( T ) );
+    result.eof = bytes < number_of_items * sizeof( T );
+    count_read( pool, bytes );
+
+    return result;
 }
 
 template< class T >
-const std::vector< T > file_chunk_reader< T >::read( size_t number_of_items )
+typename file_chunk_reader< T >::chunk file_chunk_reader< T >::read_compressed( std::ifstream& in,
+                                                                                raw_file& raw,
+                                                                                compressed_input& state,
+                                                                                size_t number_of_items,
+                                                                                memory::buffer_pool< T >* pool )
 {
-    std::vector< T > result;
+    chunk result;
+    if( pool ){
+        result.data = pool->acquire( number_of_items );
+    }
 
-    if( !m_completed )
+    while( true )
     {
-        result.resize( number_of_items );
-        m_in->read( reinterpret_cast< char* >( &result[0] ), number_of_items * sizeof( T ) );
-        result.resize( m_in->gcount() / sizeof( T ) ); // resize if red less numbers that specified
+        if( !state.has_next )
+        {
+            state.has_next = read_bytes( in, raw, reinterpret_cast< char* >( &state.next ), sizeof( state.next ) );
+            if( !state.has_next )
+            {
+                result.eof = true;
+                break;
+            }
+        }
 
-        if( m_in->eof() ){
-            m_completed = true;
+        // a block that doesn't fit starts the next chunk
+        size_t size = result.data.size();
+        if( size && size + state.next.items > number_of_items ){
+            break;
         }
+
+        state.payload.resize( state.next.bytes );
+        if( !read_bytes( in, raw, state.payload.data(), state.payload.size() ) && state.next.bytes ){
+            throw std::runtime_error{ "A compressed run is corrupted" };
+        }
+
+        result.data.resize( size + state.next.items );
+        compression::decompress( state.next, state.payload.data(), result.data.data() + size );
+        state.has_next = false;
+        count_read( pool, sizeof( state.next ) + state.payload.size() );
     }
 
     return result;
 }
 
+template< class T >
+bool file_chunk_reader< T >::read_bytes( std::ifstream& in, raw_file& raw, char* data, size_t bytes )
+{
+    size_t done = 0;
+    if( raw.is_open() ){
+        done = raw.read( data, bytes );
+    }
+    else
+    {
+        in.read( data, bytes );
+        done = static_cast< size_t >( in.gcount() );
+    }
+
+    if( done && done < bytes ){
+        throw std::runtime_error{ "A compressed run is corrupted" };
+    }
+
+    return done == bytes;
+}
+
+template< class T >
+void file_chunk_reader< T >::count_read( memory::buffer_pool< T >* pool, size_t bytes )
+{
+    if( pool ){
+        pool->counters().bytes_read.fetch_add( bytes, std::memory_order_relaxed );
+    }
+}
+
+template< class T >
+typename file_chunk_reader< T >::chunk file_chunk_reader< T >::read_next()
+{
+    if( m_compressed ){
+        return read_compressed( *m_in, *m_raw, *m_compressed, m_block_size, m_pool );
+    }
+
+    if( m_raw->is_open() ){
+        return read_raw( *m_raw, next_size(), m_pool );
+    }
+
+    return read( *m_in, next_size(), m_pool );
+}
+
+template< class T >
+void file_chunk_reader< T >::start_prefetch()
+{
+    // only the stream itself is shared with the background read,
+    // it lives on the heap so the reader stays movable
+    std::packaged_task< chunk() > read;
+    if( m_compressed ){
+        read = std::packaged_task< chunk() >{ std::bind( &file_chunk_reader< T >::read_compressed,
+                                                         std::ref( *m_in ), std::ref( *m_raw ), std::ref( *m_compressed ),
+                                                         m_block_size, m_pool ) };
+    }
+    else if( m_raw->is_open() ){
+        read = std::packaged_task< chunk() >{ std::bind( &file_chunk_reader< T >::read_raw, std::ref( *m_raw ), next_size(), m_pool ) };
+    }
+    else{
+        read = std::packaged_task< chunk() >{ std::bind( &file_chunk_reader< T >::read, std::ref( *m_in ), next_size(), m_pool ) };
+    }
+
+    if( !m_io ){
+        m_io.reset( new concurrency::io_thread() );
+    }
+
+    m_next = read.get_future();
+    m_io->post( std::move( read ) );
+}
+
+template< class T >
+void file_chunk_reader< T >::drop_prefetched()
+{
+    if( !m_next.valid() ){
+        return;
+    }
+
+    // a failed read is of no interest any more
+    try
+    {
+        chunk unused = m_next.get();
+        if( m_pool ){
+            m_pool->release( std::move( unused.data ) );
+        }
+    }
+    catch( ... ){}
+}
+
+template< class T >
+size_t file_chunk_reader< T >::next_size()
+{
+    size_t size = std::min( m_block_size, m_left );
+
+    // direct reads need chunks starting and ending at aligned positions
+    if( m_raw->direct() )
+    {
+        size_t step = aligned_items< T >();
+        size_t misaligned = m_next_item % step;
+
+        size = misaligned ? step - misaligned : m_block_size - m_block_size % step;
+        size = std::min( size, m_left );
+    }
+
+    m_left -= size;
+    m_next_item += size;
+    return size;
+}
+
+template< class T >
+typename file_chunk_reader< T >::view_type file_chunk_reader< T >::get_next_view()
+{
+    if( m_completed ){
+        return view_type{ nullptr, nullptr };
+    }
+
+    size_t first = m_next_item;
+    size_t items = next_size();
+    const T* data = reinterpret_cast< const T* >( m_map->map( first * sizeof( T ), items * sizeof( T ) ) );
+    m_completed = !m_left;
+    count_read( m_pool, items * sizeof( T ) );
+
+    return view_type{ data, data + items };
+}
+
+template< class T >
+inline bool file_chunk_reader< T >::mapped() const NOEXCEPT
+{
+    return m_map->is_open();
+}
+
 template< class T >
 inline bool file_chunk_reader< T >::completed() const NOEXCEPT
 {
     return m_completed;
 }
 
+template< class T >
+inline size_t file_chunk_reader< T >::left() const NOEXCEPT
+{
+    return m_left;
+}
+
 }// file
 
 }// external_sort
@@ -2,7 +2,10 @@
 #define FILE_PART_HPP
 
 #include <functional>
+#include <stdexcept>
 #include <vector>
+#include "buffer_pool.hpp"
+#include "noexcept_support.hpp"
 
 namespace external_sort
 {
@@ -10,22 +13,29 @@ namespace external_sort
 namespace merge
 {
 
-// A wrapper around a file being read during the merge
+// A wrapper around a file being read during the merge.
+// The items are either a buffer of its own or a range it is given,
+// e.g. a window of a mapped file, which is only valid until the next one
 template< class T >
 class file_part
 {
 public:
     void clear();
-    void update_data( std::vector< T >&& d );
+    void update_data( memory::buffer< T >&& d );
+    void update_view( const T* first, const T* last );
+    memory::buffer< T > release();
 	void set_file_index(int index) NOEXCEPT;
     const T& peek_next() const;
     const T& next() const;
+    inline const T& current() const NOEXCEPT;
 	inline bool empty() const NOEXCEPT;
 	inline int file_index() const NOEXCEPT;
 	inline bool finished() const NOEXCEPT;
 
 private:
-    std::vector< T > m_data;
+    memory::buffer< T > m_data;
+    const T* m_items{ nullptr }; // either the data or the range given
+    size_t m_size{ 0 };
     int m_file_index{ -1 };
     mutable size_t m_iterator{ 0 };
 };
@@ -36,13 +46,35 @@ template< class T >
 void file_part< T >::clear()
 {
     m_data.clear();
+    m_items = nullptr;
+    m_size = 0;
     m_iterator = 0;
 }
 
 template< class T >
-void file_part< T >::update_data( std::vector< T >&& d )
+void file_part< T >::update_data( memory::buffer< T >&& d )
 {
     m_data = std::move( d );
+    m_items = m_data.data();
+    m_size = m_data.size();
+}
+
+template< class T >
+void file_part< T >::update_view( const T* first, const T* last )
+{
+    m_items = first;
+    m_size = static_cast< size_t >( last - first );
+    m_iterator = 0;
+}
+
+// Gives up the data buffer, e.g. to return it to a pool
+template< class T >
+memory::buffer< T > file_part< T >::release()
+{
+    m_iterator = 0;
+    m_items = nullptr;
+    m_size = 0;
+    return std::move( m_data );
 }
 
 template< class T >
@@ -54,27 +86,34 @@ void file_part< T >::set_file_index( int index ) NOEXCEPT
 template< class T >
 const T& file_part< T >::peek_next() const
 {
-    if( m_data.empty() ){
+    if( !m_size ){
         throw std::out_of_range{ "Part is empty" };
     }
 
-    return m_data[ m_iterator ];
+    return m_items[ m_iterator ];
 }
 
 template< class T >
 const T& file_part< T >::next() const
 {
-    if( m_data.empty() ){
+    if( !m_size ){
         throw std::out_of_range{ "Part is empty" };
     }
 
-    return m_data[ m_iterator++ ];
+    return m_items[ m_iterator++ ];
+}
+
+// Unchecked peek_next() for the hot merge loop, the part must not be finished
+template< class T >
+inline const T& file_part< T >::current() const NOEXCEPT
+{
+    return m_items[ m_iterator ];
 }
 
 template< class T >
 inline bool file_part< T >::empty() const NOEXCEPT
 {
-    return m_data.empty();
+    return !m_size;
 }
 
 template< class T >
@@ -86,7 +125,7 @@ inline int file_part< T >::file_index() const NOEXCEPT
 template< class T >
 inline bool file_part< T >::finished() const NOEXCEPT
 {
-    return m_iterator == m_data.size();
+    return m_iterator == m_size;
 }
 
 } // sort
@@ -1,9 +1,19 @@
 #ifndef FILE_WRITER_HPP
 #define FILE_WRITER_HPP
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <mutex>
 #include <stdexcept>
 #include <memory>
+#include <thread>
+#include <vector>
+#include "buffer_pool.hpp"
+#include "raw_file.hpp"
+#include "compression.hpp"
+#include "stream.hpp"
 
 namespace external_sort
 {
@@ -11,12 +21,24 @@ namespace external_sort
 namespace file
 {
 
-// JUst a handy wrapper to write data to a file
+// JUst a handy wrapper to write data to a file.
+// In write-behind mode buffers are written by a dedicated flush thread:
+// write() hands the filled buffer over and gives back an empty recycled one,
+// so the caller keeps filling memory while the disk is busy.
+// Buffers given up by the caller go back to the pool if there is one,
+// so do the recycled ones when the writer is destroyed.
+// No more than buffers_num - 1 buffers wait to be written, recycled or
+// given up alike, write() blocks until the flush thread catches up.
+// Files written in a mode other than buffered go through a raw_file.
+// A compressed file is written as blocks of compression::block_items(),
+// compressed by whoever writes them, the flush thread in write-behind mode.
+// Data may go to a consumer instead of a file, it gets the buffers as they're written.
+// Bytes written and the time the caller waits for writes go to the pool's counters
 template< typename T >
 class file_writer
 {
-public:	
-    explicit file_writer();
+public:
+    explicit file_writer( memory::buffer_pool< T >* pool = nullptr );
 
     file_writer( const file_writer& ) = delete;
     file_writer& operator=( const file_writer& ) = delete;
@@ -26,18 +48,76 @@ public:
     file_writer( file_writer&& other );
     file_writer& operator=( file_writer&& other );
 
-    void open( const std::string& out_file );
-    void write( std::vector< T > data );
+    ~file_writer();
+
+    // buffers_num is the total number of buffers cycled in write-behind mode
+    // including the one held by the caller, less than 2 means synchronous writes
+    void open( const std::string& out_file,
+               size_t buffers_num = 1,
+               io_mode mode = io_mode::buffered,
+               bool compressed = false );
+
+    // Hands the data to the consumer instead of writing it to a file
+    void open( const stream::consumer< T >& consumer, size_t buffers_num = 1 );
+
+    // Opens an existing file without truncating it, writing from the given item on
+    void open_at( const std::string& out_file, size_t position, size_t buffers_num = 1, io_mode mode = io_mode::buffered );
+
+    // Writes the data, leaving the buffer empty but with its capacity kept
+    void write( memory::buffer< T >& data );
+
+    // Writes the data giving up the buffer, which is not recycled
+    void write( memory::buffer< T >&& data );
+
+    // Waits until everything handed over is on disk
+    void flush();
+    inline bool flushed() const;
     void close();
 
+private:
+    // State shared with the flush thread, lives on the heap to keep the writer movable
+    struct write_queue
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque< memory::buffer< T > > pending;
+        std::deque< bool > recycle; // whether a pending buffer goes back to free ones
+        std::vector< memory::buffer< T > > free;
+        size_t max_pending{ 0 }; // buffers handed over and not written yet
+        bool writing{ false };
+        bool stop{ false };
+        std::exception_ptr error;
+        memory::buffer_pool< T >* pool{ nullptr };
+        bool compressed{ false };
+        memory::buffer< char > blocks; // compressed data being written
+        stream::consumer< T > consumer; // the data goes to it if there is one
+    };
+
+    // Opens the raw file if the mode needs it, false if streams are to be used
+    bool open_raw( const std::string& out_file, io_mode mode, bool truncate );
+    void start( const std::string& out_file, size_t buffers_num );
+    static void write_data( std::ofstream& out, raw_file& raw, write_queue& q, const memory::buffer< T >& data );
+    static void write_bytes( std::ofstream& out, raw_file& raw, const char* data, size_t bytes );
+    void enqueue( memory::buffer< T >& data, bool recycle );
+    static void flush_loop( write_queue* queue, std::ofstream* out, raw_file* raw );
+    void rethrow();
+    static void give_up( memory::buffer_pool< T >* pool, memory::buffer< T >& data );
+
 private:
     std::unique_ptr< std::ofstream > m_out;
+    std::unique_ptr< raw_file > m_raw; // used instead of the stream if open
+    std::unique_ptr< write_queue > m_queue;
+    std::thread m_flush_thread;
 };
 
 ///// implementation
 
 template< typename T >
-file_writer< T >::file_writer( file_writer&& other ) : m_out( std::move( other.m_out ) )
+file_writer< T >::file_writer( file_writer&& other ) :
+    m_out( std::move( other.m_out ) ),
+    m_raw( std::move( other.m_raw ) ),
+    m_queue( std::move( other.m_queue ) ),
+    m_flush_thread( std::move( other.m_flush_thread ) )
 {
 
 }
@@ -46,34 +126,351 @@ template< typename T >
 file_writer< T >& file_writer< T >::operator=( file_writer&& other )
 {
     m_out = std::move( other.m_out );
+    m_raw = std::move( other.m_raw );
+    m_queue = std::move( other.m_queue );
+    m_flush_thread = std::move( other.m_flush_thread );
     return *this;
 }
 
 template< typename T >
-file_writer< T >::file_writer() : m_out( std::unique_ptr< std::ofstream >{ new std::ofstream() } )
+file_writer< T >::file_writer( memory::buffer_pool< T >* pool ) :
+    m_out( std::unique_ptr< std::ofstream >{ new std::ofstream() } ),
+    m_raw( std::unique_ptr< raw_file >{ new raw_file() } ),
+    m_queue( std::unique_ptr< write_queue >{ new write_queue() } )
+{
+    m_queue->pool = pool;
+}
+
+template< typename T >
+file_writer< T >::~file_writer()
+{
+    if( m_flush_thread.joinable() )
+    {
+        {
+            std::lock_guard< std::mutex > l{ m_queue->mutex };
+            m_queue->stop = true;
+        }
+
+        m_queue->cv.notify_all();
+        m_flush_thread.join();
+    }
+
+    // buffers swapped in by write() may come from the pool
+    if( m_queue )
+    {
+        for( auto& data : m_queue->free ){
+            give_up( m_queue->pool, data );
+        }
+    }
+}
+
+template< typename T >
+void file_writer< T >::open( const std::string& out_file, size_t buffers_num, io_mode mode, bool compressed )
+{
+    m_queue->compressed = compressed;
+    m_queue->consumer = nullptr;
+    if( !open_raw( out_file, mode, true ) ){
+        m_out->open( out_file, std::ios::out | std::ofstream::binary );
+    }
+
+    start( out_file, buffers_num );
+}
+
+template< typename T >
+void file_writer< T >::open_at( const std::string& out_file, size_t position, size_t buffers_num, io_mode mode )
+{
+    m_queue->compressed = false;
+    m_queue->consumer = nullptr;
+    if( open_raw( out_file, mode, false ) ){
+        m_raw->seek( position * sizeof( T ) );
+    }
+    else
+    {
+        m_out->open( out_file, std::ios::in | std::ios::out | std::ofstream::binary );
+        m_out->seekp( position * sizeof( T ) );
+    }
+
+    start( out_file, buffers_num );
+}
+
+template< typename T >
+void file_writer< T >::open( const stream::consumer< T >& consumer, size_t buffers_num )
+{
+    m_queue->compressed = false;
+    m_queue->consumer = consumer;
+    start( "consumer", buffers_num );
+}
+
+template< typename T >
+bool file_writer< T >::open_raw( const std::string& out_file, io_mode mode, bool truncate )
 {
+    if( mode == io_mode::buffered || !raw_file::supported() ){
+        return false;
+    }
+
+    if( !m_raw->open_write( out_file, mode, truncate ) ){
+        throw std::runtime_error{ "Couldn't write to file: " + out_file };
+    }
 
+    return true;
 }
 
 template< typename T >
-void file_writer< T >::open( const std::string& out_file )
+void file_writer< T >::start( const std::string& out_file, size_t buffers_num )
 {
-    m_out->open( out_file, std::ios::out | std::ofstream::binary );
-    if( !m_out->good() ){
+    if( !m_queue->consumer && !m_raw->is_open() && !m_out->good() ){
         throw std::runtime_error{ "Couldn't write to file: " + out_file };
     }
+
+    if( buffers_num > 1 )
+    {
+        // recycled buffers survive reopening, they get their capacity on first use
+        m_queue->free.resize( buffers_num - 1 );
+        m_queue->max_pending = buffers_num - 1;
+        m_queue->stop = false;
+        m_queue->error = nullptr;
+        m_flush_thread = std::thread{ &file_writer< T >::flush_loop, m_queue.get(), m_out.get(), m_raw.get() };
+    }
 }
 
 template< typename T >
 void file_writer< T >::close()
 {
-    m_out->close();
+    if( m_flush_thread.joinable() )
+    {
+        flush();
+
+        {
+            std::lock_guard< std::mutex > l{ m_queue->mutex };
+            m_queue->stop = true;
+        }
+
+        m_queue->cv.notify_all();
+        m_flush_thread.join();
+    }
+
+    memory::buffer< char >{}.swap( m_queue->blocks );
+
+    // a raw file writes what it has staged on closing
+    std::exception_ptr error;
+    if( m_raw->is_open() )
+    {
+        try{
+            m_raw->close();
+        }
+        catch( ... ){
+            error = std::current_exception();
+        }
+    }
+    else if( m_out->is_open() ){
+        m_out->close();
+    }
+
+    // the flush thread's error comes first, it's the earlier one
+    rethrow();
+
+    if( error ){
+        std::rethrow_exception( error );
+    }
+}
+
+template< typename T >
+void file_writer< T >::write( memory::buffer< T >& data )
+{
+    statistics_details::stall_timer stall( m_queue->pool ? &m_queue->pool->counters() : nullptr, statistics_details::stall::write );
+    if( m_flush_thread.joinable() ){
+        enqueue( data, true );
+    }
+    else
+    {
+        write_data( *m_out, *m_raw, *m_queue, data );
+        data.clear();
+    }
+}
+
+template< typename T >
+void file_writer< T >::write( memory::buffer< T >&& data )
+{
+    statistics_details::stall_timer stall( m_queue->pool ? &m_queue->pool->counters() : nullptr, statistics_details::stall::write );
+    if( m_flush_thread.joinable() ){
+        enqueue( data, false );
+    }
+    else
+    {
+        write_data( *m_out, *m_raw, *m_queue, data );
+        give_up( m_queue->pool, data );
+    }
+}
+
+template< typename T >
+void file_writer< T >::flush()
+{
+    statistics_details::stall_timer stall( m_queue->pool ? &m_queue->pool->counters() : nullptr, statistics_details::stall::write );
+    std::unique_lock< std::mutex > l{ m_queue->mutex };
+    m_queue->cv.wait( l, [ this ](){ return m_queue->pending.empty() && !m_queue->writing; } );
+    l.unlock();
+
+    rethrow();
+}
+
+template< typename T >
+inline bool file_writer< T >::flushed() const
+{
+    std::lock_guard< std::mutex > l{ m_queue->mutex };
+    return m_queue->pending.empty() && !m_queue->writing;
+}
+
+template< typename T >
+void file_writer< T >::write_data( std::ofstream& out, raw_file& raw, write_queue& q, const memory::buffer< T >& data )
+{
+    if( q.consumer )
+    {
+        if( !data.empty() ){
+            q.consumer( data.data(), data.size() );
+        }
+
+        return;
+    }
+
+    const char* bytes = reinterpret_cast< const char* >( data.data() );
+    size_t size = data.size() * sizeof( T );
+
+    if( q.compressed )
+    {
+        q.blocks.clear();
+        compression::compress( data.data(), data.size(), q.blocks );
+        bytes = q.blocks.data();
+        size = q.blocks.size();
+    }
+
+    write_bytes( out, raw, bytes, size );
+    if( q.pool ){
+        q.pool->counters().bytes_written.fetch_add( size, std::memory_order_relaxed );
+    }
+}
+
+template< typename T >
+void file_writer< T >::write_bytes( std::ofstream& out, raw_file& raw, const char* data, size_t bytes )
+{
+    if( raw.is_open() )
+    {
+        raw.write( data, bytes );
+        return;
+    }
+
+    if( bytes ){
+        out.write( data, bytes );
+    }
+
+    if( !out.good() ){
+        throw std::runtime_error{ "Couldn't write to file" };
+    }
+}
+
+template< typename T >
+void file_writer< T >::enqueue( memory::buffer< T >& data, bool recycle )
+{
+    std::unique_lock< std::mutex > l{ m_queue->mutex };
+
+    // wait for a free buffer to swap with if the flush thread lags behind,
+    // buffers given up count against the same limit, so memory stays bounded
+    write_queue& q = *m_queue;
+    q.cv.wait( l, [ &q, recycle ](){
+        return ( q.pending.size() < q.max_pending && ( !recycle || !q.free.empty() ) ) || q.error; } );
+
+    if( m_queue->error )
+    {
+        l.unlock();
+        rethrow();
+    }
+
+    size_t capacity = data.capacity();
+    m_queue->pending.emplace_back( std::move( data ) );
+    m_queue->recycle.push_back( recycle );
+
+    if( recycle )
+    {
+        data = std::move( m_queue->free.back() );
+        m_queue->free.pop_back();
+
+        data.clear();
+        data.reserve( capacity );
+    }
+
+    l.unlock();
+    m_queue->cv.notify_all();
+}
+
+template< typename T >
+void file_writer< T >::flush_loop( write_queue* queue, std::ofstream* out, raw_file* raw )
+{
+    write_queue& q = *queue;
+    std::unique_lock< std::mutex > l{ q.mutex };
+
+    while( true )
+    {
+        q.cv.wait( l, [ &q ](){ return !q.pending.empty() || q.stop; } );
+        if( q.pending.empty() ){
+            break; // stopped with nothing left to write
+        }
+
+        // write outside the lock, the buffer stays in the queue meanwhile
+        q.writing = true;
+        memory::buffer< T >& data = q.pending.front();
+        l.unlock();
+
+        std::exception_ptr error;
+        try{
+            write_data( *out, *raw, q, data );
+        }
+        catch( ... ){
+            error = std::current_exception();
+        }
+
+        l.lock();
+        if( error && !q.error ){
+            q.error = error;
+        }
+
+        if( q.recycle.front() )
+        {
+            data.clear();
+            q.free.emplace_back( std::move( data ) );
+        }
+        else{
+            give_up( q.pool, data );
+        }
+
+        q.pending.pop_front();
+        q.recycle.pop_front();
+        q.writing = false;
+        q.cv.notify_all();
+    }
+}
+
+template< typename T >
+void file_writer< T >::rethrow()
+{
+    std::exception_ptr error;
+
+    {
+        std::lock_guard< std::mutex > l{ m_queue->mutex };
+        std::swap( error, m_queue->error );
+    }
+
+    if( error ){
+        std::rethrow_exception( error );
+    }
 }
 
 template< typename T >
-void file_writer< T >::write( std::vector< T > data )
+void file_writer< T >::give_up( memory::buffer_pool< T >* pool, memory::buffer< T >& data )
 {
-     m_out->write( ( char* )&data[0], data.size() * sizeof( T ) );
+    if( pool ){
+        pool->release( std::move( data ) );
+    }
+
+    memory::buffer< T >{}.swap( data );
 }
 
 }// file
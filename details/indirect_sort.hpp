@@ -0,0 +1,113 @@
+#ifndef INDIRECT_SORT_HPP
+#define INDIRECT_SORT_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "key_traits.hpp"
+#include "radix_sort.hpp"
+
+namespace external_sort
+{
+
+namespace sorting_details
+{
+
+// What is actually sorted instead of a large record
+template< typename P >
+struct prefix_entry
+{
+    P prefix;
+    uint32_t index;
+};
+
+} // sorting_details
+
+template< typename P >
+struct key_traits< sorting_details::prefix_entry< P > >
+{
+    using key_type = P;
+
+    static key_type key( const sorting_details::prefix_entry< P >& e ){
+        return e.prefix;
+    }
+};
+
+namespace sorting
+{
+
+// Sorts records by their key prefixes (see key_prefix_traits): the prefixes
+// are radix sorted along with the indices of their records, runs of equal
+// prefixes are sorted comparing the records, then the records are put
+// in place following the cycles of the permutation, each moved once.
+// Takes a prefix and an index per record on top of the records
+template< typename T >
+void indirect_sort( T* first, T* last )
+{
+    using prefix_type = typename key_prefix_traits< T >::prefix_type;
+    using entry = sorting_details::prefix_entry< prefix_type >;
+
+    size_t size = last - first;
+    if( size > std::numeric_limits< uint32_t >::max() )
+    {
+        std::sort( first, last );
+        return;
+    }
+
+    std::vector< entry > entries( size );
+    for( size_t i = 0; i < size; ++i ){
+        entries[ i ] = entry{ key_prefix_traits< T >::prefix( first[ i ] ), static_cast< uint32_t >( i ) };
+    }
+
+    radix_sort( entries.data(), entries.data() + size );
+
+    // ties of the prefixes are settled by the records themselves
+    auto less = [ first ]( const entry& l, const entry& r ){ return first[ l.index ] < first[ r.index ]; };
+    for( auto run = entries.begin(); run != entries.end(); )
+    {
+        auto run_end = run + 1;
+        while( run_end != entries.end() && run_end->prefix == run->prefix ){
+            ++run_end;
+        }
+
+        if( run_end - run > 1 ){
+            std::sort( run, run_end, less );
+        }
+
+        run = run_end;
+    }
+
+    // entries[ i ].index is the record going to i, a cycle ends at the record it starts with
+    for( size_t start = 0; start < size; ++start )
+    {
+        if( entries[ start ].index == start ){
+            continue;
+        }
+
+        T v = std::move( first[ start ] );
+        size_t hole = start;
+
+        while( true )
+        {
+            size_t from = entries[ hole ].index;
+            entries[ hole ].index = static_cast< uint32_t >( hole );
+
+            if( from == start ){
+                break;
+            }
+
+            first[ hole ] = std::move( first[ from ] );
+            hole = from;
+        }
+
+        first[ hole ] = std::move( v );
+    }
+}
+
+} // sorting
+
+} // external_sort
+
+#endif
@@ -0,0 +1,60 @@
+#include "io_thread.hpp"
+
+namespace external_sort
+{
+
+namespace concurrency
+{
+
+io_thread::~io_thread()
+{
+    if( !m_thread.joinable() ){
+        return;
+    }
+
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_stop = true;
+    }
+
+    m_cv.notify_one();
+    m_thread.join();
+}
+
+void io_thread::post( task&& t )
+{
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_tasks.emplace_back( std::move( t ) );
+
+        if( !m_thread.joinable() ){
+            m_thread = std::thread{ &io_thread::work, this };
+        }
+    }
+
+    m_cv.notify_one();
+}
+
+void io_thread::work()
+{
+    std::unique_lock< std::mutex > l{ m_mutex };
+
+    while( true )
+    {
+        m_cv.wait( l, [ this ](){ return !m_tasks.empty() || m_stop; } );
+        if( m_tasks.empty() ){
+            break; // stopped with nothing left to run
+        }
+
+        task t = std::move( m_tasks.front() );
+        m_tasks.pop_front();
+
+        l.unlock();
+        t();
+        l.lock();
+    }
+}
+
+}// concurrency
+
+}// external_sort
@@ -0,0 +1,46 @@
+#ifndef IO_THREAD_HPP
+#define IO_THREAD_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "task.hpp"
+
+namespace external_sort
+{
+
+namespace concurrency
+{
+
+// A single thread kept for the background reads of a reader, so reading
+// ahead doesn't start a thread per chunk. The thread is started by the first
+// task and runs tasks in the order they're posted, the ones left are run
+// before it's joined on destruction
+class io_thread
+{
+public:
+    io_thread() = default;
+    io_thread( const io_thread& ) = delete;
+    io_thread& operator=( const io_thread& ) = delete;
+    ~io_thread();
+
+    // Runs a callable, which may be move-only and must not throw
+    void post( task&& t );
+
+private:
+    void work();
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque< task > m_tasks;
+    bool m_stop{ false };
+    std::thread m_thread;
+};
+
+}// concurrency
+
+}// external_sort
+
+#endif
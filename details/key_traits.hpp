@@ -0,0 +1,113 @@
+#ifndef KEY_TRAITS_HPP
+#define KEY_TRAITS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace external_sort
+{
+
+// Order preserving mapping of T to an unsigned integral key:
+// a < b should hold if and only if key( a ) < key( b ).
+// Types having it are sorted in memory with radix sort instead of std::sort.
+// Defined for arithmetic types, specialize it for your own ones, e.g.
+//
+// template<> struct key_traits< record >
+// {
+//     using key_type = uint64_t;
+//     static key_type key( const record& r ){ return r.id; }
+// };
+template< typename T, typename Enable = void >
+struct key_traits
+{
+};
+
+template< typename T >
+struct key_traits< T, typename std::enable_if< std::is_integral< T >::value && std::is_unsigned< T >::value >::type >
+{
+    using key_type = T;
+
+    static key_type key( T v ){
+        return v;
+    }
+};
+
+// flipping the sign bit puts negative numbers first
+template< typename T >
+struct key_traits< T, typename std::enable_if< std::is_integral< T >::value && std::is_signed< T >::value >::type >
+{
+    using key_type = typename std::make_unsigned< T >::type;
+
+    static key_type key( T v ){
+        return static_cast< key_type >( v ) ^ ( key_type( 1 ) << ( sizeof( T ) * 8 - 1 ) );
+    }
+};
+
+// IEEE 754: positive numbers get the sign bit set, negative ones get all bits
+// flipped so that larger magnitudes come first
+template< typename T >
+struct key_traits< T, typename std::enable_if< std::is_floating_point< T >::value &&
+                                               ( sizeof( T ) == 4 || sizeof( T ) == 8 ) >::type >
+{
+    using key_type = typename std::conditional< sizeof( T ) == 4, uint32_t, uint64_t >::type;
+
+    static key_type key( T v )
+    {
+        key_type bits;
+        std::memcpy( &bits, &v, sizeof( v ) );
+
+        const key_type sign = key_type( 1 ) << ( sizeof( T ) * 8 - 1 );
+        return ( bits & sign ) ? ~bits : bits | sign;
+    }
+};
+
+// Whether T has key_traits
+template< typename T >
+struct has_key_traits
+{
+private:
+    template< typename U >
+    static std::true_type check( typename key_traits< U >::key_type* );
+
+    template< typename U >
+    static std::false_type check( ... );
+
+public:
+    static const bool value = decltype( check< T >( nullptr ) )::value;
+};
+
+// A fixed width prefix of the key of T for large records, which are then
+// sorted indirectly: (prefix, index) pairs are sorted, records with equal
+// prefixes are compared as a whole and every record is moved once at the end.
+// prefix( a ) < prefix( b ) should imply a < b, equal prefixes mean nothing.
+// Takes precedence over key_traits, specialize it for your own types, e.g.
+//
+// template<> struct key_prefix_traits< trade >
+// {
+//     using prefix_type = uint64_t;
+//     static prefix_type prefix( const trade& t ){ return t.timestamp; }
+// };
+template< typename T, typename Enable = void >
+struct key_prefix_traits
+{
+};
+
+// Whether T has key_prefix_traits
+template< typename T >
+struct has_key_prefix_traits
+{
+private:
+    template< typename U >
+    static std::true_type check( typename key_prefix_traits< U >::prefix_type* );
+
+    template< typename U >
+    static std::false_type check( ... );
+
+public:
+    static const bool value = decltype( check< T >( nullptr ) )::value;
+};
+
+}// external_sort
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef LOSER_TREE_HPP
+#define LOSER_TREE_HPP
+
+#include <cstdint>
+#include <vector>
+#include "noexcept_support.hpp"
+
+namespace external_sort
+{
+
+namespace merge
+{
+
+// A tournament tree of losers built over sorted sources (e.g. file_parts).
+// Finds the source with the smallest head in O(log k) comparisons instead of
+// scanning all of them. A source should provide finished() and current(),
+// finished sources always lose. Once the winner has been advanced (and refilled
+// if needed) call replay() to restore the tree, no rebuild is required
+template< class Parts >
+class loser_tree
+{
+public:
+    loser_tree( Parts& parts, size_t size );
+
+    inline size_t top() const NOEXCEPT;
+    inline bool empty() const NOEXCEPT;
+    void replay() NOEXCEPT;
+
+private:
+    // on ties the right hand side wins, which keeps the current winner in place
+    inline bool less( uint32_t left, uint32_t right ) const NOEXCEPT;
+
+private:
+    Parts& m_parts;
+    std::vector< uint32_t > m_nodes; // [0] is the winner, the rest store losers
+    uint32_t m_size;
+};
+
+///// implementation
+
+template< class Parts >
+loser_tree< Parts >::loser_tree( Parts& parts, size_t size ) :
+    m_parts( parts ),
+    m_nodes( size ? size : 1, 0 ),
+    m_size( static_cast< uint32_t >( size ) )
+{
+    // leafs are [ size, 2 * size ), node n has children 2n and 2n + 1
+    std::vector< uint32_t > winners( 2 * m_size );
+    for( uint32_t leaf = 0; leaf < m_size; ++leaf ){
+        winners[ m_size + leaf ] = leaf;
+    }
+
+    for( uint32_t node = m_size ? m_size - 1 : 0; node > 0; --node )
+    {
+        uint32_t left = winners[ 2 * node ];
+        uint32_t right = winners[ 2 * node + 1 ];
+
+        bool right_wins = less( right, left );
+        winners[ node ] = right_wins ? right : left;
+        m_nodes[ node ] = right_wins ? left : right;
+    }
+
+    m_nodes[ 0 ] = m_size > 1 ? winners[ 1 ] : 0;
+}
+
+template< class Parts >
+inline size_t loser_tree< Parts >::top() const NOEXCEPT
+{
+    return m_nodes[ 0 ];
+}
+
+template< class Parts >
+inline bool loser_tree< Parts >::empty() const NOEXCEPT
+{
+    return !m_size || m_parts[ m_nodes[ 0 ] ].finished();
+}
+
+template< class Parts >
+void loser_tree< Parts >::replay() NOEXCEPT
+{
+    uint32_t winner = m_nodes[ 0 ];
+
+    for( uint32_t node = ( winner + m_size ) / 2; node > 0; node /= 2 )
+    {
+        if( less( m_nodes[ node ], winner ) ){
+            std::swap( m_nodes[ node ], winner );
+        }
+    }
+
+    m_nodes[ 0 ] = winner;
+}
+
+template< class Parts >
+inline bool loser_tree< Parts >::less( uint32_t left, uint32_t right ) const NOEXCEPT
+{
+    const auto& l = m_parts[ left ];
+    const auto& r = m_parts[ right ];
+
+    if( l.finished() ){
+        return false;
+    }
+
+    if( r.finished() ){
+        return true;
+    }
+
+    return l.current() < r.current();
+}
+
+} // merge
+
+} // external_sort
+
+#endif
@@ -0,0 +1,115 @@
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#define EXTERNAL_SORT_MAPPED_FILE 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace external_sort
+{
+
+namespace file
+{
+
+#ifdef EXTERNAL_SORT_MAPPED_FILE
+
+bool mapped_file::supported()
+{
+    return true;
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+bool mapped_file::open( const std::string& path )
+{
+    close();
+
+    m_fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    return m_fd >= 0;
+}
+
+void mapped_file::close()
+{
+    unmap();
+
+    if( m_fd >= 0 )
+    {
+        ::close( m_fd );
+        m_fd = -1;
+    }
+}
+
+size_t mapped_file::size() const
+{
+    struct stat st;
+    if( fstat( m_fd, &st ) ){
+        throw std::runtime_error( std::string( "Couldn't get file size: " ) + std::strerror( errno ) );
+    }
+
+    return static_cast< size_t >( st.st_size );
+}
+
+const char* mapped_file::map( size_t offset, size_t bytes )
+{
+    unmap();
+
+    if( !bytes ){
+        return nullptr;
+    }
+
+    // a mapping starts at a page
+    static const size_t page = static_cast< size_t >( sysconf( _SC_PAGESIZE ) );
+    size_t shift = offset % page;
+
+    void* window = mmap( nullptr, bytes + shift, PROT_READ, MAP_PRIVATE, m_fd, static_cast< off_t >( offset - shift ) );
+    if( window == MAP_FAILED ){
+        throw std::runtime_error( std::string( "Couldn't map file: " ) + std::strerror( errno ) );
+    }
+
+    m_window = window;
+    m_window_size = bytes + shift;
+
+    // the window is read once from start to end, all of it is about to be needed
+    madvise( m_window, m_window_size, MADV_SEQUENTIAL );
+    madvise( m_window, m_window_size, MADV_WILLNEED );
+
+    return static_cast< const char* >( m_window ) + shift;
+}
+
+void mapped_file::unmap()
+{
+    if( m_window )
+    {
+        munmap( m_window, m_window_size );
+        m_window = nullptr;
+        m_window_size = 0;
+    }
+}
+
+#else
+
+// files are read by streams where they can't be mapped
+
+bool mapped_file::supported(){ return false; }
+mapped_file::~mapped_file(){}
+bool mapped_file::open( const std::string& ){ return false; }
+void mapped_file::close(){}
+size_t mapped_file::size() const{ return 0; }
+const char* mapped_file::map( size_t, size_t ){ return nullptr; }
+void mapped_file::unmap(){}
+
+#endif
+
+}// file
+
+}// external_sort
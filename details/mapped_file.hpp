@@ -0,0 +1,53 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace external_sort
+{
+
+namespace file
+{
+
+// A file read through a window mapped into memory. Only one window is
+// mapped at a time, mapping the next one unmaps the previous one, so the
+// memory taken stays within the window size whatever the size of the file.
+// Windows are advised to be read ahead sequentially as soon as mapped
+class mapped_file
+{
+public:
+    // false if files can't be mapped here
+    static bool supported();
+
+    mapped_file() = default;
+    mapped_file( const mapped_file& ) = delete;
+    mapped_file& operator=( const mapped_file& ) = delete;
+    ~mapped_file();
+
+    // false if the file can't be opened
+    bool open( const std::string& path );
+    void close();
+    size_t size() const;
+
+    // Maps bytes of the file from offset, nullptr for an empty window
+    const char* map( size_t offset, size_t bytes );
+
+    inline bool is_open() const{
+        return m_fd >= 0;
+    }
+
+private:
+    void unmap();
+
+private:
+    int m_fd{ -1 };
+    void* m_window{ nullptr };
+    size_t m_window_size{ 0 };
+};
+
+}// file
+
+}// external_sort
+
+#endif
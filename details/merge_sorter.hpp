@@ -1,14 +1,21 @@
 #ifndef MERGE_SORTER_HPP
 #define MERGE_SORTER_HPP
 
-#include <sstream>
+#include <algorithm>
+#include <limits>
 #include <list>
 
 #include "multiple_file_reader.hpp"
 #include "file_writer.hpp"
 #include "file_part.hpp"
+#include "loser_tree.hpp"
+#include "run_scheduler.hpp"
+#include "reducer.hpp"
+#include "parallel_sort.hpp"
 #include "async.hpp"
 #include "common.hpp"
+#include "options.hpp"
+#include "stream.hpp"
 
 namespace external_sort
 {
@@ -30,80 +37,215 @@ struct io_handler;
 template<typename T >
 class out_buffer;
 
-string thread_id();
+void remove_files( const strings& files );
 
-// Renames files a thread wants to claim with it's own temp names
-void rename_input_files( size_t first, size_t last, const string& folder, const strings& temp_names );
+// The runs split left in the work folder
+std::vector< sorted_run > split_runs( const string& folder, size_t files_num, size_t item_size, bool compressed );
 
-// Renames a thread's output file to put it back into work queue
-void rename_out_file( const string& out_file, const string& folder, size_t files_num );
+// Size in bytes of a merge buffer, a prefetched file needs two of them
+// plus there are output buffers cycled by the writer
+template< typename T >
+size_t buffer_size( size_t simul_merge, size_t avail_mem, size_t threads, const options& opts );
 
-void remove_files( const strings& files );
+// Buffers a merging thread holds at once
+size_t buffers_per_thread( size_t simul_merge, const options& opts );
 
-// Claims files for a thread to prevent them from being used by another thread
-size_t lock_next_files( const strings& temp_names, const string& folder, size_t& files_num, size_t simul_merge );
+// The smallest buffer a chunk fits in, a compressed one holds whole blocks
+// and a direct one whole blocks of the disk
+template< typename T >
+size_t min_buffer_size( const options& opts );
 
-// Mergesort files into one output file
+// Threads merging at once, fewer than asked if their buffers would
+// be too small for a chunk otherwise
+template< typename T >
+size_t merge_threads( size_t simul_merge, size_t avail_mem, size_t threads, const options& opts );
+
+template< typename T >
+std::vector< io_handler< T > > make_io_handlers( size_t simul_merge,
+                                                 size_t buffer_size,
+                                                 size_t threads,
+                                                 const options& opts,
+                                                 const reducer< T >& reduce,
+                                                 memory::buffer_pool< T >& pool );
+
+// Mergesort files into one output file, reducing equal items on the way
 template< typename T >
 void mergesort_parts( file_parts< T >& parts, out_buffer< T >& out, size_t files_merged, io_handler< T >& h );
 
-// The loop threads run while mergesoring files
+// Gives a part the next chunk of its file, a mapped one is read in place
 template< typename T >
-void run( io_handler< T >& h, const string& folder, size_t& files_num, size_t simul_merge, size_t buff_size );
+void next_chunk( file_part< T >& part, size_t file, io_handler< T >& h );
+
+// The loop threads run while mergesoring files. Threads take jobs
+// from the scheduler until the runs left are up to the final merge
+template< typename T >
+void run( io_handler< T >& h, run_scheduler& scheduler, size_t simul_merge, size_t buff_size, size_t write_buffers );
+
+// The last pass: the runs are cut into key ranges, one per thread, and each
+// thread merges its range straight into its place in the output file.
+// Reduced parts don't know their places, they are merged by a single thread,
+// as is the output handed to a consumer instead of written to out_file
+template< typename T >
+void final_merge( std::vector< io_handler< T > >& io_handlers,
+                  concurrency::async& async,
+                  const std::vector< sorted_run >& runs,
+                  const string& out_file,
+                  const stream::consumer< T >& consumer,
+                  size_t buff_size,
+                  size_t write_buffers );
+
+// Picks parts_num - 1 keys splitting the runs into parts of close sizes
+template< typename T >
+std::vector< T > sample_splitters( const strings& runs, const std::vector< size_t >& sizes, size_t parts_num );
+
+// Number of items of a run less than key
+template< typename T >
+size_t run_lower_bound( std::ifstream& run, size_t size, const T& key );
+
+template< typename T >
+T read_item( std::ifstream& run, size_t index );
+
+size_t items_in_file( const string& file, size_t item_size );
+
+// Whether every run starts where the one before ends, as when the input is
+// presorted, so that putting them one after another sorts them. Items of
+// different runs have to differ if equal ones are reduced
+template< typename T >
+bool runs_in_order( const std::vector< sorted_run >& runs, bool distinct );
+
+// Puts runs in order one after another into the output: the first one
+// is renamed to it and the others are appended
+template< typename T >
+void concatenate( const std::vector< sorted_run >& runs,
+                  const string& out_file,
+                  size_t avail_mem,
+                  const options& opts,
+                  memory::buffer_pool< T >& pool );
+
+// Number of items of a temp run, compressed ones are counted by their headers
+size_t items_in_run( const string& run, size_t item_size, bool compressed );
 
 } //merge_details
 
 namespace merge
 {
 
+// Merges the runs the scheduler hands out with all threads,
+// returns once the runs left are up to the final merge
 template< typename T >
-void merge( const std::string& out_file, size_t files_num, size_t simul_merge, size_t avail_mem, size_t threads )
+void merge_jobs( run_scheduler& scheduler,
+                 size_t simul_merge,
+                 size_t avail_mem,
+                 size_t threads,
+                 const options& opts,
+                 const reducer< T >& reduce,
+                 memory::buffer_pool< T >& pool )
 {
-    // calc buffer in bytes
-    size_t buffer_size = avail_mem / (  simul_merge * threads );
+    threads = merge_details::merge_threads< T >( simul_merge, avail_mem, threads, opts );
+    size_t buffer_size = merge_details::buffer_size< T >( simul_merge, avail_mem, threads, opts );
+    auto io_handlers = merge_details::make_io_handlers( simul_merge, buffer_size, threads, opts, reduce, pool );
 
-    if( buffer_size < sizeof( T ) ){
-         throw std::runtime_error( "Not enough memory to merge specified number of files simultaneously" );
+    concurrency::async async( threads );
+    sorting_details::run_on_pool( async, threads, [ & ]( size_t thread )
+    {
+        merge_details::run( io_handlers[ thread ], scheduler, simul_merge, buffer_size, opts.write_buffers );
+    });
+}
+
+// Merges the last runs into the output file, every thread takes a key range
+template< typename T >
+void merge_last( const std::string& out_file,
+                 const std::vector< sorted_run >& runs,
+                 size_t avail_mem,
+                 size_t threads,
+                 const options& opts,
+                 const reducer< T >& reduce,
+                 memory::buffer_pool< T >& pool )
+{
+    // a single run is sorted and reduced already, unless it has to be decompressed
+    if( runs.size() == 1 && !opts.compress_runs )
+    {
+        std::rename( runs.front().path.c_str(), out_file.c_str() );
+        return;
     }
 
-    buffer_size -= buffer_size % sizeof( T );
+    size_t files_num = std::max< size_t >( runs.size(), 1 );
+    threads = merge_details::merge_threads< T >( files_num, avail_mem, threads, opts );
+    size_t buffer_size = merge_details::buffer_size< T >( files_num, avail_mem, threads, opts );
+    auto io_handlers = merge_details::make_io_handlers( files_num, buffer_size, threads, opts, reduce, pool );
 
-    // create readers &  writers
-    std::vector< merge_details::io_handler< T > > io_handlers;
-    std::mutex io_mutex;
+    concurrency::async async( threads );
+    merge_details::final_merge( io_handlers, async, runs, out_file, stream::consumer< T >(), buffer_size, opts.write_buffers );
+}
 
-    for( size_t reader_ind = 0; reader_ind < threads; ++reader_ind ){			
-        io_handlers.emplace_back( simul_merge, buffer_size / sizeof(T), io_mutex );
-    }
+// Merges the last runs handing the output to the consumer, with a single thread
+template< typename T >
+void merge_last( const stream::consumer< T >& consumer,
+                 const std::vector< sorted_run >& runs,
+                 size_t avail_mem,
+                 const options& opts,
+                 const reducer< T >& reduce,
+                 memory::buffer_pool< T >& pool )
+{
+    size_t files_num = std::max< size_t >( runs.size(), 1 );
+    size_t buffer_size = merge_details::buffer_size< T >( files_num, avail_mem, 1, opts );
+    auto io_handlers = merge_details::make_io_handlers( files_num, buffer_size, 1, opts, reduce, pool );
 
+    concurrency::async async( 1 );
+    merge_details::final_merge( io_handlers, async, runs, std::string(), consumer, buffer_size, opts.write_buffers );
+}
+
+template< typename T >
+void merge( const std::string& out_file,
+            size_t files_num,
+            size_t simul_merge,
+            size_t avail_mem,
+            size_t threads,
+            const options& opts,
+            const reducer< T >& reduce,
+            memory::buffer_pool< T >& pool )
+{
     std::string folder = common::get_folder_from_path( out_file );
-    std::list< concurrency::Task > tasks;
-    concurrency::async async( threads );
+    auto runs = merge_details::split_runs( folder, files_num, sizeof( T ), opts.compress_runs );
 
-    // start threads
-    for( size_t thread_id = 0; thread_id < threads; ++thread_id )
+    // runs of presorted input don't overlap, there's nothing to merge, the ones
+    // of reversed input come in reverse order. Compressed runs can't be checked
+    // without reading them and cut ones are too long together
+    if( runs.size() > 1 && !opts.compress_runs && reduce.limit() == std::numeric_limits< size_t >::max() )
     {
-        auto merge_func = std::bind( &merge_details::run< T >,
-                                     std::ref( io_handlers[ thread_id ] ),
-                                     folder,
-                                     std::ref( files_num ),
-                                     simul_merge,
-                                     buffer_size );
+        std::vector< sorted_run > reversed( runs.rbegin(), runs.rend() );
 
-        tasks.emplace_back();
-        concurrency::Task& curr = tasks.back();
-        curr.task = std::move( std::packaged_task< void() >{ merge_func } );
-        curr.result = std::move( async.run( curr.task ) );
+        for( auto* order : { &runs, &reversed } )
+        {
+            if( merge_details::runs_in_order< T >( *order, reduce.enabled() ) )
+            {
+                merge_details::concatenate( *order, out_file, avail_mem, opts, pool );
+                return;
+            }
+        }
     }
 
-    // wait for finish
-    for (auto& t : tasks){
-        t.result.get();
-    }
+    run_scheduler scheduler( std::move( runs ), simul_merge, folder );
+    merge_jobs( scheduler, simul_merge, avail_mem, threads, opts, reduce, pool );
+    merge_last( out_file, scheduler.runs(), avail_mem, threads, opts, reduce, pool );
+}
 
-    // rename last output file
-    std::string result_temp_file = common::temp_file_path( folder, 1 );
-    std::rename( result_temp_file.c_str(), out_file.c_str() );
+// Merges the runs split left in the work folder handing the output to the consumer
+template< typename T >
+void merge( const stream::consumer< T >& consumer,
+            const std::string& work_folder,
+            size_t files_num,
+            size_t simul_merge,
+            size_t avail_mem,
+            size_t threads,
+            const options& opts,
+            const reducer< T >& reduce,
+            memory::buffer_pool< T >& pool )
+{
+    run_scheduler scheduler( merge_details::split_runs( work_folder, files_num, sizeof( T ), opts.compress_runs ),
+                             simul_merge, work_folder );
+    merge_jobs( scheduler, simul_merge, avail_mem, threads, opts, reduce, pool );
+    merge_last( consumer, scheduler.runs(), avail_mem, opts, reduce, pool );
 }
 
 } //split
@@ -115,9 +257,17 @@ namespace merge_details
 template< typename T >
 struct io_handler
 {
-    io_handler(  size_t in_number, size_t block_size, std::mutex& m ) :
-        reader( in_number, block_size ),
-        io_mutex( m ){}
+    // mapped runs are read neither through io_uring nor around the cache,
+    // compressed ones aren't mapped
+    io_handler(  size_t in_number, size_t block_size, const options& opts, const reducer< T >& r, memory::buffer_pool< T >& p ) :
+        reader( in_number, block_size, opts.prefetch, &p, opts.io_uring && !opts.mmap,
+                opts.mmap && !opts.compress_runs ? file::io_mode::mapped : file::temp_io( opts.direct_io ),
+                opts.compress_runs ),
+        writer( &p ),
+        pool( p ),
+        reduce( r ),
+        mode( file::temp_io( opts.direct_io ) ),
+        compressed( opts.compress_runs ){}
 
     io_handler( const io_handler& ) = delete;
     io_handler& operator=( const io_handler& ) = delete;
@@ -127,7 +277,10 @@ struct io_handler
     io_handler( io_handler&& other ) :
         reader( std::move( other.reader ) ),
         writer( std::move( other.writer ) ),
-        io_mutex( other.io_mutex )
+        pool( other.pool ),
+        reduce( other.reduce ),
+        mode( other.mode ),
+        compressed( other.compressed )
 	{
 
 	}
@@ -136,14 +289,18 @@ struct io_handler
 	{
 		reader = std::move(other.reader);
 		writer = std::move(other.writer);
-		io_mutex = other.io_mutex;
+		mode = other.mode;
+		compressed = other.compressed;
 
 		return *this;
 	}
 
     file::multiple_file_reader< T > reader;
     file::file_writer< T > writer;
-    std::mutex& io_mutex;
+    memory::buffer_pool< T >& pool;
+    const reducer< T >& reduce;
+    file::io_mode mode; // of temp runs written
+    bool compressed; // temp runs are
 };
 
 // A handy wrapper around output buffer used by a thread
@@ -151,13 +308,11 @@ template<typename T >
 class out_buffer
 {
 public:
-    out_buffer( size_t max_size ) : m_max_size( max_size ){}
-
-    void add( const T& data ){
-        m_buffer.emplace_back( data );
+    out_buffer( size_t max_size ) : m_max_size( max_size ){
+        m_buffer.reserve( max_size / sizeof( T ) );
     }
 
-    std::vector< T >& data(){
+    memory::buffer< T >& data(){
         return m_buffer;
     }
 
@@ -165,52 +320,103 @@ public:
         return m_buffer.size();
     }
 
-	inline bool full() const NOEXCEPT{
-        return m_buffer.size() * sizeof( T ) == m_max_size;
+	inline size_t capacity() const NOEXCEPT{
+        return m_max_size / sizeof( T );
     }
 private:
-    std::vector< T > m_buffer;
+    memory::buffer< T > m_buffer;
     size_t m_max_size;
 };
 
-std::string thread_id()
+void remove_files( const strings& files )
+{
+    for( auto& file : files ){
+        std::remove( file.c_str() );
+    }
+}
+
+template< typename T >
+size_t buffer_size( size_t simul_merge, size_t avail_mem, size_t threads, const options& opts )
 {
-    std::ostringstream ss;
-    ss << std::this_thread::get_id();
-    return ss.str();
+    size_t buffer_size = avail_mem / ( buffers_per_thread( simul_merge, opts ) * threads );
+
+    if( buffer_size < min_buffer_size< T >( opts ) ){
+         throw std::runtime_error( "Not enough memory to merge specified number of files simultaneously" );
+    }
+
+    // full buffers are then read and written directly, without staging
+    size_t unit = opts.direct_io ? file::aligned_items< T >() * sizeof( T ) : sizeof( T );
+    return buffer_size - buffer_size % unit;
 }
 
-void rename_input_files( size_t first, size_t last, const std::string& folder, const strings& temp_names )
+size_t buffers_per_thread( size_t simul_merge, const options& opts )
 {
-    for( size_t file = first; file < last; ++file  )
-    {
-        std::rename( common::temp_file_path( folder, file ).c_str(),
-                     temp_names[ file - first ].c_str() );
+    // a mapped file takes a single window, compressed ones are neither mapped nor read through io_uring
+    bool mapped = opts.mmap && !opts.compress_runs;
+    bool io_uring = opts.io_uring && !opts.compress_runs;
+    size_t buffers_per_file = !mapped && ( opts.prefetch || io_uring ) ? 2 : 1;
+    size_t out_buffers = std::max< size_t >( opts.write_buffers, 1 );
+    return simul_merge * buffers_per_file + out_buffers;
+}
+
+template< typename T >
+size_t min_buffer_size( const options& opts )
+{
+    size_t items = opts.compress_runs ? compression::block_items< T >() : 1;
+    if( opts.direct_io ){
+        items = std::max( items, file::aligned_items< T >() );
     }
+
+    return items * sizeof( T );
 }
 
-void rename_out_file( const std::string& out_file, const std::string& folder, size_t files_num )
+template< typename T >
+size_t merge_threads( size_t simul_merge, size_t avail_mem, size_t threads, const options& opts )
 {
-    std::string next_file = common::temp_file_path( folder, files_num );
-    std::rename( out_file.c_str(), next_file.c_str() );
+    size_t fit = avail_mem / ( buffers_per_thread( simul_merge, opts ) * min_buffer_size< T >( opts ) );
+    return std::max< size_t >( std::min( threads, fit ), 1 );
 }
 
-void remove_files( const strings& files )
+template< typename T >
+std::vector< io_handler< T > > make_io_handlers( size_t simul_merge,
+                                                 size_t buffer_size,
+                                                 size_t threads,
+                                                 const options& opts,
+                                                 const reducer< T >& reduce,
+                                                 memory::buffer_pool< T >& pool )
 {
-    for( auto& file : files ){
-        std::remove( file.c_str() );
+    std::vector< io_handler< T > > io_handlers;
+    for( size_t reader_ind = 0; reader_ind < threads; ++reader_ind ){
+        io_handlers.emplace_back( simul_merge, buffer_size / sizeof( T ), opts, reduce, pool );
     }
+
+    return io_handlers;
 }
 
-size_t lock_next_files( const strings& temp_names, const std::string& folder, size_t& files_num, size_t simul_merge )
+std::vector< sorted_run > split_runs( const std::string& folder, size_t files_num, size_t item_size, bool compressed )
 {
-    size_t files_merged = std::min( files_num, simul_merge );
-    files_num -= files_merged;
+    std::vector< sorted_run > runs;
+    for( size_t file = 1; file <= files_num; ++file )
+    {
+        std::string path = common::temp_file_path( folder, file );
+        size_t size = items_in_run( path, item_size, compressed );
+        runs.push_back( sorted_run{ std::move( path ), size } );
+    }
 
-    size_t first_file = files_num + 1;
-    rename_input_files( first_file, first_file + files_merged, folder, temp_names );
+    return runs;
+}
 
-    return files_merged;
+template< typename T >
+void next_chunk( file_part< T >& part, size_t file, io_handler< T >& h )
+{
+    if( h.reader.mapped() )
+    {
+        auto view = h.reader.get_next_view( file );
+        part.update_view( view.first, view.second );
+    }
+    else{
+        part.update_data( h.reader.get_next_chunk( file ) );
+    }
 }
 
 template< typename T >
@@ -220,100 +426,331 @@ void mergesort_files( file_parts< T >& parts, out_buffer< T >& out, size_t files
     for( size_t file = 0;  file < files_merged; ++file )
     {
         auto& part = parts[ file ];
-        part.update_data( h.reader.get_next_chunk( file ) );
+        next_chunk( part, file, h );
         part.set_file_index( file );
     }
 
-    // while there's data in the files being merged
-    while( true )
+    loser_tree< file_parts< T > > tree( parts, files_merged );
+    size_t merged = 0;
+
+    // while there's data in the files being merged and the limit isn't reached
+    while( !tree.empty() && merged < h.reduce.limit() )
     {
-        // find current min
-        file_part< T >* min_part{ nullptr };
-        for( auto& p : parts )
-        {
-            if( !p.finished() && ( !min_part || min_part->peek_next() > p.peek_next() ) ){
-                min_part = &p;
-            }
+        // a full buffer is written once the next item doesn't go into its last one
+        auto& min_part = parts[ tree.top() ];
+        if( h.reduce.push( out.data(), out.capacity(), min_part.next(), h.writer ) ){
+            ++merged;
         }
 
-        if( min_part )
+        // fill file buffer if depleted, the tree picks up the new head on replay
+        if( min_part.finished() )
         {
-            out.add( min_part->next() );
-
-            // fill file buffer if depleted
-            if( min_part->finished() )
-            {
-                min_part->clear();
-                min_part->update_data( h.reader.get_next_chunk( min_part->file_index() ) );
-            }
-
-            // write buffer if necessary
-            if( out.full() ){
-                h.writer.write( std::move( out.data() ) );
-            }
-        }
-        else{
-            break; // files have been fully processed
+            h.reader.release( min_part.release() );
+            next_chunk( min_part, min_part.file_index(), h );
         }
+
+        tree.replay();
     }
 
     // flush buffer if necessary
     if( out.size() ){
-        h.writer.write( std::move( out.data() ) );
+        h.writer.write( out.data() );
     }
+
+    for( size_t file = 0;  file < files_merged; ++file ){
+        h.reader.release( parts[ file ].release() );
+    }
+
+    h.pool.counters().items_merged.fetch_add( merged, std::memory_order_relaxed );
 }
 
 template< typename T >
-void run( io_handler< T >& h, const std::string& folder, size_t& files_num, size_t simul_merge, size_t buff_size )
+void run( io_handler< T >& h, run_scheduler& scheduler, size_t simul_merge, size_t buff_size, size_t write_buffers )
 {
     file_parts< T > parts( simul_merge );
     out_buffer< T > out_buff( buff_size );
 
-    // define temp names for files this thread will work with
-    std::string in_file_pattern{ folder +  thread_id() + "_thread_temp_" };
-    std::string out_file{ folder + "temp_out_" +  thread_id() };
+    merge_job job;
+    strings inputs;
 
-    strings temp_file_names;
-    for( size_t file_id = 0; file_id < simul_merge; ++ file_id ){
-        temp_file_names.emplace_back( in_file_pattern + std::to_string( file_id ) );
+    try
+    {
+        // loop over jobs
+        while( scheduler.next_job( job ) )
+        {
+            inputs.clear();
+            for( auto& input : job.inputs ){
+                inputs.push_back( input.path );
+            }
+
+            // open writer and reader
+            h.writer.open( job.output.path, write_buffers, h.mode, h.compressed );
+            h.reader.open( inputs, inputs.size() );
+
+            // loop over files until empty, filling out buffer with sorted sequence
+            mergesort_files( parts, out_buff, inputs.size(), h );
+
+            h.writer.close();
+            h.reader.close();
+
+            // remove processed files and put the merged one back into work
+            remove_files( inputs );
+            scheduler.complete( job );
+            h.pool.counters().merges.fetch_add( 1, std::memory_order_relaxed );
+        }
+    }
+    catch( ... )
+    {
+        // the others may be waiting for this job
+        scheduler.cancel();
+        throw;
     }
+}
+
+template< typename T >
+void final_merge( std::vector< io_handler< T > >& io_handlers,
+                  concurrency::async& async,
+                  const std::vector< sorted_run >& catalog,
+                  const std::string& out_file,
+                  const stream::consumer< T >& consumer,
+                  size_t buff_size,
+                  size_t write_buffers )
+{
+    strings runs;
+    std::vector< size_t > sizes;
+    size_t total = 0;
 
-    // loop over files
-    while( true )
+    for( auto& r : catalog )
     {
-        size_t files_this_iteration;
+        runs.push_back( r.path );
+        sizes.push_back( r.size );
+        total += r.size;
+    }
+
+    size_t files_num = runs.size();
 
+    // too little work to share, compressed runs can't be searched for the cuts
+    const size_t min_part = 1 << 16;
+    size_t parts_num = std::max< size_t >( std::min( io_handlers.size(), total / min_part ), 1 );
+    bool reduced = io_handlers.front().reduce.enabled();
+    if( io_handlers.front().compressed || reduced || consumer ){
+        parts_num = 1;
+    }
+
+    // cuts[ part ][ run ] is where the part starts within the run
+    std::vector< std::vector< size_t > > cuts( parts_num + 1, std::vector< size_t >( files_num, 0 ) );
+    cuts[ parts_num ] = sizes;
+
+    if( parts_num > 1 )
+    {
+        std::vector< T > splitters = sample_splitters< T >( runs, sizes, parts_num );
+
+        for( size_t file = 0; file < files_num; ++file )
         {
-            std::lock_guard< std::mutex > l{ h.io_mutex };
-            files_this_iteration = lock_next_files( temp_file_names, folder, files_num, simul_merge );
+            std::ifstream in( runs[ file ], std::ios::in | std::ifstream::binary );
+            for( size_t part = 1; part < parts_num; ++part ){
+                cuts[ part ][ file ] = run_lower_bound( in, sizes[ file ], splitters[ part - 1 ] );
+            }
+        }
+    }
+
+    // the parts are written at their offsets, so the file has to exist beforehand
+    if( !consumer )
+    {
+        std::ofstream out( out_file, std::ios::out | std::ofstream::binary );
+        if( total && !reduced ){
+            out.seekp( total * sizeof( T ) - 1 );
+            out.put( 0 );
+        }
+
+        if( !out.good() ){
+            throw std::runtime_error{ "Couldn't write to file: " + out_file };
         }
+    }
+
+    io_handlers.front().pool.counters().merges.fetch_add( 1, std::memory_order_relaxed );
 
-        // open writer and reader
-        h.writer.open( out_file );
-        h.reader.open( temp_file_names, files_this_iteration );
+    std::vector< size_t > offsets( parts_num, 0 );
+    for( size_t part = 1; part < parts_num; ++part )
+    {
+        offsets[ part ] = offsets[ part - 1 ];
+        for( size_t file = 0; file < files_num; ++file ){
+            offsets[ part ] += cuts[ part ][ file ] - cuts[ part - 1 ][ file ];
+        }
+    }
+
+    sorting_details::run_on_pool( async, parts_num, [ & ]( size_t part )
+    {
+        io_handler< T >& h = io_handlers[ part ];
 
-        // loop over files until empty, filling out buffer with sorted sequence
-        mergesort_files( parts, out_buff, files_this_iteration, h );
+        std::vector< file::item_range > ranges;
+        for( size_t file = 0; file < files_num; ++file ){
+            ranges.emplace_back( cuts[ part ][ file ], cuts[ part + 1 ][ file ] );
+        }
+
+        file_parts< T > parts( files_num );
+        out_buffer< T > out_buff( buff_size );
+
+        // the output isn't a temp file, it's left in the cache unless it bypasses it
+        file::io_mode out_mode = h.mode == file::io_mode::direct ? file::io_mode::direct : file::io_mode::buffered;
+        if( consumer ){
+            h.writer.open( consumer, write_buffers );
+        }
+        else{
+            h.writer.open_at( out_file, offsets[ part ], write_buffers, out_mode );
+        }
+        h.reader.open( runs, ranges );
+
+        mergesort_files( parts, out_buff, files_num, h );
 
         h.writer.close();
         h.reader.close();
+    });
+
+    remove_files( runs );
+}
+
+template< typename T >
+std::vector< T > sample_splitters( const strings& runs, const std::vector< size_t >& sizes, size_t parts_num )
+{
+    // regular sampling as for in-memory chunks, but every sample is a disk seek
+    const size_t samples_per_run = 8 * parts_num;
+    std::vector< T > samples;
 
-        std::lock_guard< std::mutex > l{ h.io_mutex };
+    for( size_t file = 0; file < runs.size(); ++file )
+    {
+        std::ifstream in( runs[ file ], std::ios::in | std::ifstream::binary );
+        for( size_t sample = 0; sample < samples_per_run && sizes[ file ]; ++sample ){
+            samples.push_back( read_item< T >( in, sizes[ file ] * sample / samples_per_run ) );
+        }
+    }
 
-        // remove processed empty files
-        remove_files( temp_file_names );
+    std::sort( samples.begin(), samples.end() );
 
-        // rename merged file to put it back into work
-         ++files_num;
-        rename_out_file( out_file, folder, files_num );
+    std::vector< T > splitters;
+    for( size_t part = 1; part < parts_num; ++part ){
+        splitters.push_back( samples[ samples.size() * part / parts_num ] );
+    }
+
+    return splitters;
+}
 
-        // exit if there's only one file left atm
-        if( files_num == 1 )
+template< typename T >
+size_t run_lower_bound( std::ifstream& run, size_t size, const T& key )
+{
+    size_t first = 0;
+    while( size )
+    {
+        size_t half = size / 2;
+        if( read_item< T >( run, first + half ) < key )
         {
-            std::remove( out_file.c_str() );
-            break;
+            first += half + 1;
+            size -= half + 1;
+        }
+        else{
+            size = half;
         }
     }
+
+    return first;
+}
+
+template< typename T >
+T read_item( std::ifstream& run, size_t index )
+{
+    T item;
+    run.seekg( index * sizeof( T ), run.beg );
+    run.read( reinterpret_cast< char* >( &item ), sizeof( T ) );
+
+    if( !run.good() ){
+        throw std::runtime_error{ "Couldn't read a run" };
+    }
+
+    return item;
+}
+
+size_t items_in_file( const std::string& file, size_t item_size )
+{
+    std::ifstream in( file, std::ios::in | std::ifstream::binary | std::ios::ate );
+    if( !in.good() ){
+        throw std::invalid_argument( file + " doesn't exist or occupied by another process" );
+    }
+
+    return static_cast< size_t >( in.tellg() ) / item_size;
+}
+
+template< typename T >
+bool runs_in_order( const std::vector< sorted_run >& runs, bool distinct )
+{
+    bool has_last = false;
+    T last{};
+
+    for( auto& r : runs )
+    {
+        if( !r.size ){
+            continue;
+        }
+
+        std::ifstream in( r.path, std::ios::in | std::ifstream::binary );
+        T first = read_item< T >( in, 0 );
+
+        if( has_last && ( distinct ? !( last < first ) : first < last ) ){
+            return false;
+        }
+
+        last = read_item< T >( in, r.size - 1 );
+        has_last = true;
+    }
+
+    return true;
+}
+
+template< typename T >
+void concatenate( const std::vector< sorted_run >& runs,
+                  const std::string& out_file,
+                  size_t avail_mem,
+                  const options& opts,
+                  memory::buffer_pool< T >& pool )
+{
+    // the output isn't a temp file, it's left in the cache unless it bypasses it
+    file::io_mode out_mode = opts.direct_io ? file::io_mode::direct : file::io_mode::buffered;
+    size_t buffers = ( opts.prefetch ? 2 : 1 ) + std::max< size_t >( opts.write_buffers, 1 );
+    size_t block_size = avail_mem / ( buffers * sizeof( T ) );
+
+    // direct chunks are whole blocks of the disk
+    size_t unit = min_buffer_size< T >( opts ) / sizeof( T );
+    if( block_size < unit ){
+        throw std::runtime_error( "Not enough memory to put the runs together" );
+    }
+
+    block_size -= block_size % unit;
+
+    std::remove( out_file.c_str() );
+    if( std::rename( runs.front().path.c_str(), out_file.c_str() ) ){
+        throw std::runtime_error{ "Couldn't write to file: " + out_file };
+    }
+
+    file::file_writer< T > writer( &pool );
+    writer.open_at( out_file, runs.front().size, opts.write_buffers, out_mode );
+
+    file::file_chunk_reader< T > reader( &pool, file::temp_io( opts.direct_io ) );
+    for( size_t run = 1; run < runs.size(); ++run )
+    {
+        reader.open( runs[ run ].path, block_size, opts.prefetch );
+        while( !reader.completed() ){
+            writer.write( reader.get_next_chunk() );
+        }
+
+        reader.close();
+        std::remove( runs[ run ].path.c_str() );
+    }
+
+    writer.close();
+}
+
+size_t items_in_run( const std::string& run, size_t item_size, bool compressed )
+{
+    return compressed ? compression::items_in_run( run ) : items_in_file( run, item_size );
 }
 
 } //merge_details
@@ -1,7 +1,10 @@
 #ifndef MULTIPLE_FILE_READER_HPP
 #define MULTIPLE_FILE_READER_HPP
 
+#include <memory>
+
 #include "file_chunk_reader.hpp"
+#include "uring_reader.hpp"
 #include "noexcept_support.hpp"
 
 namespace external_sort
@@ -11,13 +14,25 @@ namespace file
 {
 
 // A wrapper around multiple file_chunk_readers
-// to ease the work of merge stage where several files have to be read at once
+// to ease the work of merge stage where several files have to be read at once.
+// With prefetch on every file is double buffered: the next chunk of a file
+// is being read while the previous one is merged.
+// With io_uring on and supported the reads of all files go through a single
+// ring instead, the file_chunk_readers are used where it isn't available.
+// Mapped files are read without a copy through get_next_view().
+// Compressed files are read by the file_chunk_readers, never through io_uring
 
 template< class T >
 class multiple_file_reader
 {
 public:
-    explicit multiple_file_reader( size_t simul_readings, size_t block_size );
+    explicit multiple_file_reader( size_t simul_readings,
+                                   size_t block_size,
+                                   bool prefetch = false,
+                                   memory::buffer_pool< T >* pool = nullptr,
+                                   bool io_uring = false,
+                                   io_mode mode = io_mode::buffered,
+                                   bool compressed = false );
     multiple_file_reader( const multiple_file_reader& ) = delete;
     multiple_file_reader& operator=( const multiple_file_reader& ) = delete;
 
@@ -27,13 +42,29 @@ public:
     multiple_file_reader& operator=( multiple_file_reader&& other );
 
     void open( const std::vector< std::string >& files, size_t number  );
+
+    // Opens files reading only the given range of items of each
+    void open( const std::vector< std::string >& files, const std::vector< item_range >& ranges );
     void close();
-    std::vector< T > get_next_chunk( size_t reader );
+    typename file_chunk_reader< T >::value_type get_next_chunk( size_t reader );
+
+    // Next chunk of a mapped file, valid until the next one of this file is asked for
+    typename file_chunk_reader< T >::view_type get_next_view( size_t reader );
+    inline bool mapped() const NOEXCEPT;
 	inline bool reader_completed(size_t reader) const NOEXCEPT;
 
+    // Gives back a chunk that has been consumed
+    void release( typename file_chunk_reader< T >::value_type&& chunk );
+
 private:
     std::vector< file_chunk_reader< T > > m_readers;
     size_t m_block_size;
+    bool m_prefetch;
+    memory::buffer_pool< T >* m_pool;
+
+#ifdef EXTERNAL_SORT_IO_URING
+    std::unique_ptr< uring_reader< T > > m_uring;
+#endif
 };
 
 
@@ -42,7 +73,12 @@ private:
 template< typename T >
 multiple_file_reader< T >::multiple_file_reader( multiple_file_reader&& other ) :
     m_readers( std::move( other.m_readers ) ),
-    m_block_size( other.m_block_size )
+    m_block_size( other.m_block_size ),
+    m_prefetch( other.m_prefetch ),
+    m_pool( other.m_pool )
+#ifdef EXTERNAL_SORT_IO_URING
+    , m_uring( std::move( other.m_uring ) )
+#endif
 {
 
 }
@@ -52,16 +88,39 @@ multiple_file_reader< T >& multiple_file_reader< T >::operator=( multiple_file_r
 {
     m_readers = std::move( other.m_readers );
     m_block_size = other.m_block_size;
+    m_prefetch = other.m_prefetch;
+    m_pool = other.m_pool;
+#ifdef EXTERNAL_SORT_IO_URING
+    m_uring = std::move( other.m_uring );
+#endif
 
     return *this;
 }
 
 
 template< typename T >
-multiple_file_reader< T >::multiple_file_reader( size_t simul_readings, size_t block_size ) :
-    m_block_size( block_size )
+multiple_file_reader< T >::multiple_file_reader( size_t simul_readings,
+                                                 size_t block_size,
+                                                 bool prefetch,
+                                                 memory::buffer_pool< T >* pool,
+                                                 bool io_uring,
+                                                 io_mode mode,
+                                                 bool compressed ) :
+    m_block_size( block_size ),
+    m_prefetch( prefetch ),
+    m_pool( pool )
 {
-    m_readers.resize( simul_readings );
+#ifdef EXTERNAL_SORT_IO_URING
+    if( io_uring && !compressed ){
+        m_uring = uring_reader< T >::create( simul_readings, block_size, pool );
+    }
+#else
+    ( void )io_uring;
+#endif
+
+    for( size_t reader = 0; reader < simul_readings; ++reader ){
+        m_readers.emplace_back( pool, mode, compressed );
+    }
 }
 
 template< typename T >
@@ -71,31 +130,112 @@ void multiple_file_reader< T >::open( const std::vector< std::string >& files, s
         throw std::invalid_argument( "Wring number of files to open" );
     }
 
+#ifdef EXTERNAL_SORT_IO_URING
+    if( m_uring )
+    {
+        m_uring->open( std::vector< std::string >( files.begin(), files.begin() + number ),
+                       std::vector< item_range >( number, whole_file ) );
+        return;
+    }
+#endif
+
     for( size_t file = 0; file < number; ++file ){
-        m_readers[ file ].open( files[ file ], m_block_size );
+        m_readers[ file ].open( files[ file ], m_block_size, m_prefetch );
+    }
+}
+
+template< typename T >
+void multiple_file_reader< T >::open( const std::vector< std::string >& files, const std::vector< item_range >& ranges )
+{
+    if( files.size() > m_readers.size() || ranges.size() != files.size() ){
+        throw std::invalid_argument( "Wring number of files to open" );
+    }
+
+#ifdef EXTERNAL_SORT_IO_URING
+    if( m_uring )
+    {
+        m_uring->open( files, ranges );
+        return;
+    }
+#endif
+
+    for( size_t file = 0; file < files.size(); ++file ){
+        m_readers[ file ].open( files[ file ], m_block_size, m_prefetch, ranges[ file ] );
     }
 }
 
 template< typename T >
 void multiple_file_reader< T >::close()
 {
+#ifdef EXTERNAL_SORT_IO_URING
+    if( m_uring ){
+        m_uring->close();
+    }
+#endif
+
     for( auto& r : m_readers ){
         r.close();
     }
 }
 
 template< typename T >
-std::vector< T > multiple_file_reader< T >::get_next_chunk( size_t reader )
+typename file_chunk_reader< T >::value_type multiple_file_reader< T >::get_next_chunk( size_t reader )
 {
+#ifdef EXTERNAL_SORT_IO_URING
+    if( m_uring ){
+        return m_uring->get_next_chunk( reader );
+    }
+#endif
+
     return m_readers[ reader ].get_next_chunk();
 }
 
 template< typename T >
 inline bool multiple_file_reader< T >::reader_completed(size_t reader) const NOEXCEPT
 {
+#ifdef EXTERNAL_SORT_IO_URING
+    if( m_uring ){
+        return m_uring->completed( reader );
+    }
+#endif
+
     return m_readers[ reader ].completed();
 }
 
+template< typename T >
+typename file_chunk_reader< T >::view_type multiple_file_reader< T >::get_next_view( size_t reader )
+{
+    return m_readers[ reader ].get_next_view();
+}
+
+template< typename T >
+inline bool multiple_file_reader< T >::mapped() const NOEXCEPT
+{
+#ifdef EXTERNAL_SORT_IO_URING
+    if( m_uring ){
+        return false;
+    }
+#endif
+
+    return !m_readers.empty() && m_readers.front().mapped();
+}
+
+template< typename T >
+void multiple_file_reader< T >::release( typename file_chunk_reader< T >::value_type&& chunk )
+{
+#ifdef EXTERNAL_SORT_IO_URING
+    if( m_uring )
+    {
+        m_uring->release( std::move( chunk ) );
+        return;
+    }
+#endif
+
+    if( m_pool ){
+        m_pool->release( std::move( chunk ) );
+    }
+}
+
 }// file
 
 }// external_sort
@@ -0,0 +1,67 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+namespace external_sort
+{
+
+// Optional knobs of external_sort, the defaults suit most setups
+struct options
+{
+    // Read the next block of every merged file in the background while
+    // the current one is being merged. Input buffers take twice the memory
+    bool prefetch{ true };
+
+    // Number of output buffers a writer cycles through. With 2 or more a filled
+    // buffer is written by a background thread while the next one is being
+    // filled, 1 means synchronous writes. Split writes sorted chunks in the
+    // background whenever it is more than 1, keeping up to a chunk per thread
+    // in flight, so its chunks get twice smaller
+    size_t write_buffers{ 1 };
+
+    // Split reads one chunk at a time and sorts it with all threads
+    // instead of giving every thread a chunk of its own. Chunks don't depend
+    // on the number of threads, so there are fewer and longer runs to merge
+    bool parallel_chunk_sort{ false };
+
+    // Split generates runs by replacement selection: a heap taking most of
+    // the memory keeps sending out the smallest item not less than the last
+    // one written. Runs are about twice the memory on random data and nearly
+    // sorted input becomes a single run, leaving nothing to merge.
+    // Runs one thread, takes precedence over parallel_chunk_sort
+    bool replacement_selection{ false };
+
+    // Merge runs while split is still making the next ones instead of
+    // waiting for it to finish. Until split is done both phases get
+    // half of the memory and of the threads
+    bool pipelined_merge{ false };
+
+    // Merge reads go through io_uring on Linux: reads of all merged files
+    // are submitted in batches into buffers registered with the kernel.
+    // Takes two buffers a file like prefetch, ignored where io_uring
+    // isn't available
+    bool io_uring{ false };
+
+    // Temp runs and the output file bypass the page cache with O_DIRECT,
+    // so a sort doesn't evict everything else from it. Reads and writes
+    // are cut at block boundaries, partial blocks go through the cache.
+    // Otherwise temp runs are accessed with hints to drop them from the cache
+    // once done with. Ignored by io_uring reads
+    bool direct_io{ false };
+
+    // The input and the runs are read through memory mappings. Split copies
+    // chunks straight from the mapping to its buffers, merge reads the runs
+    // in place, mapping a window of a buffer's size of each at a time.
+    // Takes precedence over io_uring and direct_io for reads
+    bool mmap{ false };
+
+    // Temp runs are compressed by blocks, integral items with a delta codec
+    // and the rest with a byte codec, trading CPU for disk traffic. Blocks are
+    // decompressed by the merge reads, in the background with prefetch on.
+    // Compressed runs are read neither through io_uring nor mappings, and
+    // as they can't be searched the final merge isn't split between threads
+    bool compress_runs{ false };
+};
+
+}// external_sort
+
+#endif
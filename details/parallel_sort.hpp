@@ -0,0 +1,196 @@
+#ifndef PARALLEL_SORT_HPP
+#define PARALLEL_SORT_HPP
+
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <vector>
+
+#include "async.hpp"
+#include "buffer_pool.hpp"
+#include "loser_tree.hpp"
+#include "noexcept_support.hpp"
+#include "sort.hpp"
+
+namespace external_sort
+{
+
+namespace sorting_details
+{
+
+// A sorted range of memory merged by the loser tree
+template< typename T >
+struct range_part
+{
+    inline bool finished() const NOEXCEPT{
+        return first == last;
+    }
+
+    inline const T& current() const NOEXCEPT{
+        return *first;
+    }
+
+    const T* first;
+    const T* last;
+};
+
+// Runs func( 0 ) ... func( tasks_num - 1 ) on the pool and waits for all of them
+void run_on_pool( concurrency::async& async, size_t tasks_num, const std::function< void( size_t ) >& func );
+
+// Picks parts_num - 1 keys splitting sorted pieces into parts of close sizes
+template< typename T >
+std::vector< T > sample_splitters( const T* data, const std::vector< size_t >& bounds, size_t parts_num );
+
+// Merges [ bounds[ i ], bounds[ i + 1 ] ) pieces within [ lows[ i ], highs[ i ] ) into out
+template< typename T >
+void merge_ranges( const T* data, const std::vector< size_t >& lows, const std::vector< size_t >& highs, T* out );
+
+} // sorting_details
+
+namespace sorting
+{
+
+// Multiway mergesort of a chunk with all threads of the pool:
+// each thread sorts a piece of the chunk, then the pieces are cut by sampled
+// splitter keys, and each thread merges its own key range straight into its place
+// in the output. Needs a scratch buffer as large as the chunk, taken from the pool:
+// the chunk is sorted into it and its own buffer goes to the pool instead
+template< typename T >
+void parallel_sort( memory::buffer< T >& data, concurrency::async& async, size_t threads, memory::buffer_pool< T >& pool )
+{
+    // too little work to share
+    const size_t min_piece = 1 << 14;
+    size_t pieces_num = std::min( threads, data.size() / min_piece );
+
+    if( pieces_num < 2 )
+    {
+        sorting::sort( data.data(), data.data() + data.size() );
+        return;
+    }
+
+    std::vector< size_t > bounds( pieces_num + 1 );
+    for( size_t piece = 0; piece <= pieces_num; ++piece ){
+        bounds[ piece ] = data.size() * piece / pieces_num;
+    }
+
+    T* first = data.data();
+    sorting_details::run_on_pool( async, pieces_num, [ & ]( size_t piece )
+    {
+        sorting::sort( first + bounds[ piece ], first + bounds[ piece + 1 ] );
+    });
+
+    std::vector< T > splitters = sorting_details::sample_splitters( first, bounds, pieces_num );
+
+    // cuts[ part ][ piece ] is where the part starts within the piece
+    std::vector< std::vector< size_t > > cuts( pieces_num + 1, std::vector< size_t >( pieces_num ) );
+    for( size_t piece = 0; piece < pieces_num; ++piece )
+    {
+        cuts[ 0 ][ piece ] = bounds[ piece ];
+        cuts[ pieces_num ][ piece ] = bounds[ piece + 1 ];
+
+        for( size_t part = 1; part < pieces_num; ++part )
+        {
+            cuts[ part ][ piece ] = std::lower_bound( first + bounds[ piece ],
+                                                      first + bounds[ piece + 1 ],
+                                                      splitters[ part - 1 ] ) - first;
+        }
+    }
+
+    std::vector< size_t > offsets( pieces_num + 1, 0 );
+    for( size_t part = 0; part < pieces_num; ++part )
+    {
+        offsets[ part + 1 ] = offsets[ part ];
+        for( size_t piece = 0; piece < pieces_num; ++piece ){
+            offsets[ part + 1 ] += cuts[ part + 1 ][ piece ] - cuts[ part ][ piece ];
+        }
+    }
+
+    memory::buffer< T > out = pool.acquire( data.size() );
+    out.resize( data.size() );
+
+    T* out_first = out.data();
+    sorting_details::run_on_pool( async, pieces_num, [ & ]( size_t part )
+    {
+        sorting_details::merge_ranges( first, cuts[ part ], cuts[ part + 1 ], out_first + offsets[ part ] );
+    });
+
+    data.swap( out );
+    pool.release( std::move( out ) );
+}
+
+} // sorting
+
+namespace sorting_details
+{
+
+void run_on_pool( concurrency::async& async, size_t tasks_num, const std::function< void( size_t ) >& func )
+{
+    std::list< concurrency::Task > tasks;
+
+    for( size_t task = 0; task < tasks_num; ++task )
+    {
+        tasks.emplace_back();
+        concurrency::Task& curr = tasks.back();
+        curr.task = std::packaged_task< void() >{ std::bind( func, task ) };
+        curr.result = async.run( curr.task );
+    }
+
+    // wait for all before rethrowing, the tasks reference caller's data
+    for( auto& t : tasks ){
+        t.result.wait();
+    }
+
+    for( auto& t : tasks ){
+        t.result.get();
+    }
+}
+
+template< typename T >
+std::vector< T > sample_splitters( const T* data, const std::vector< size_t >& bounds, size_t parts_num )
+{
+    // regular sampling: the same number of evenly spaced keys from every piece
+    const size_t samples_per_piece = 32 * parts_num;
+    std::vector< T > samples;
+    samples.reserve( samples_per_piece * ( bounds.size() - 1 ) );
+
+    for( size_t piece = 0; piece + 1 < bounds.size(); ++piece )
+    {
+        size_t size = bounds[ piece + 1 ] - bounds[ piece ];
+        for( size_t sample = 0; sample < samples_per_piece; ++sample ){
+            samples.push_back( data[ bounds[ piece ] + size * sample / samples_per_piece ] );
+        }
+    }
+
+    std::sort( samples.begin(), samples.end() );
+
+    std::vector< T > splitters;
+    for( size_t part = 1; part < parts_num; ++part ){
+        splitters.push_back( samples[ samples.size() * part / parts_num ] );
+    }
+
+    return splitters;
+}
+
+template< typename T >
+void merge_ranges( const T* data, const std::vector< size_t >& lows, const std::vector< size_t >& highs, T* out )
+{
+    std::vector< range_part< T > > parts( lows.size() );
+    for( size_t piece = 0; piece < lows.size(); ++piece )
+    {
+        parts[ piece ].first = data + lows[ piece ];
+        parts[ piece ].last = data + highs[ piece ];
+    }
+
+    merge::loser_tree< std::vector< range_part< T > > > tree( parts, parts.size() );
+    while( !tree.empty() )
+    {
+        *out++ = *parts[ tree.top() ].first++;
+        tree.replay();
+    }
+}
+
+} // sorting_details
+
+} // external_sort
+
+#endif
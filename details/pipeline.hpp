@@ -0,0 +1,87 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <future>
+#include <string>
+
+#include "split_sorter.hpp"
+#include "merge_sorter.hpp"
+#include "run_scheduler.hpp"
+#include "common.hpp"
+#include "options.hpp"
+#include "statistics.hpp"
+
+namespace external_sort
+{
+
+namespace pipeline
+{
+
+// Splits and merges at the same time: merge jobs start on the runs already
+// on disk while later chunks are still being read and sorted.
+// While both phases run each of them gets half of avail_mem and of the threads,
+// taking its buffers from a pool of its own that reserves its half,
+// the final merge takes all of them. Returns the number of runs split made,
+// split_end is taken once split is done
+template< typename T >
+size_t sort( const std::string& in_file,
+             const std::string& out_file,
+             size_t avail_mem,
+             size_t merge_at_once,
+             size_t threads_num,
+             const options& opts,
+             const merge::reducer< T >& reduce,
+             memory::buffer_pool< T >& pool,
+             statistics_details::snapshot& split_end )
+{
+    std::string work_folder = common::get_folder_from_path( out_file );
+
+    size_t merge_threads = std::max< size_t >( threads_num / 2, 1 );
+    size_t split_threads = std::max< size_t >( threads_num - merge_threads, 1 );
+    size_t merge_mem = avail_mem / 2;
+
+    merge::run_scheduler scheduler( {}, merge_at_once, work_folder, true );
+    size_t files_num = 0;
+
+    {
+        // each phase takes buffers only from its own share
+        memory::buffer_pool< T > merge_pool( pool, merge_mem );
+        memory::buffer_pool< T > split_pool( pool, avail_mem - merge_mem );
+
+        auto merging = std::async( std::launch::async, [ & ]()
+        {
+            merge::merge_jobs( scheduler, merge_at_once, merge_mem, merge_threads, opts, reduce, merge_pool );
+        });
+
+        auto on_run = [ &scheduler, &opts ]( const std::string& run )
+        {
+            scheduler.add( merge::sorted_run{ run, merge_details::items_in_run( run, sizeof( T ), opts.compress_runs ) } );
+        };
+
+        try{
+            files_num = split::split< T >( in_file, work_folder, avail_mem - merge_mem, split_threads, opts, reduce, split_pool, on_run );
+        }
+        catch( ... )
+        {
+            // merge threads may be waiting for runs that won't come
+            scheduler.cancel();
+            merging.wait();
+            throw;
+        }
+
+        split_end = statistics_details::take( pool.counters() );
+
+        scheduler.close();
+        merging.get();
+    }
+
+    merge::merge_last( out_file, scheduler.runs(), avail_mem, threads_num, opts, reduce, pool );
+
+    return files_num;
+}
+
+}// pipeline
+
+}// external_sort
+
+#endif
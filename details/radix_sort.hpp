@@ -0,0 +1,153 @@
+#ifndef RADIX_SORT_HPP
+#define RADIX_SORT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include "key_traits.hpp"
+#include "simd_sort.hpp"
+
+namespace external_sort
+{
+
+namespace sorting_details
+{
+
+template< typename T >
+inline unsigned digit( const T& v, unsigned shift )
+{
+    return static_cast< unsigned >( key_traits< T >::key( v ) >> shift ) & 0xff;
+}
+
+template< typename T >
+void insertion_sort_by_key( T* first, T* last )
+{
+    for( T* curr = first + 1; curr < last; ++curr )
+    {
+        T v = std::move( *curr );
+        auto k = key_traits< T >::key( v );
+
+        T* hole = curr;
+        for( ; hole != first && k < key_traits< T >::key( *( hole - 1 ) ); --hole ){
+            *hole = std::move( *( hole - 1 ) );
+        }
+
+        *hole = std::move( v );
+    }
+}
+
+// Small buckets of 32 bit keys go to the vectorized kernel, which beats
+// insertion sort on them by far. For 64 bit keys it doesn't pay off
+template< typename T >
+struct simd_buckets : std::integral_constant< bool, simd_sortable< T >::value && sizeof( T ) == 4 >
+{
+};
+
+template< typename T >
+struct small_bucket : std::integral_constant< size_t, simd_buckets< T >::value ? 512 : 64 >
+{
+};
+
+template< typename T >
+void sort_small_bucket( T* first, T* last, std::true_type /*simd*/ )
+{
+    T scratch[ small_bucket< T >::value ]; // 2KB
+    sorting::simd_sort( first, last, scratch );
+}
+
+template< typename T >
+void sort_small_bucket( T* first, T* last, std::false_type /*simd*/ )
+{
+    insertion_sort_by_key( first, last );
+}
+
+// In-place MSD radix sort (american flag sort) by byte digits of the key
+// starting with the one at shift. Needs no memory besides the counters
+template< typename T >
+void radix_sort( T* first, T* last, unsigned shift )
+{
+    while( true )
+    {
+        size_t size = last - first;
+        if( size < small_bucket< T >::value )
+        {
+            sort_small_bucket( first, last, simd_buckets< T >() );
+            return;
+        }
+
+        size_t counts[ 256 ] = { 0 };
+        for( T* v = first; v != last; ++v ){
+            ++counts[ digit( *v, shift ) ];
+        }
+
+        // all keys share the digit, go straight to the next one
+        if( counts[ digit( *first, shift ) ] == size )
+        {
+            if( !shift ){
+                return;
+            }
+
+            shift -= 8;
+            continue;
+        }
+
+        size_t heads[ 256 ], tails[ 256 ];
+        size_t offset = 0;
+        for( size_t bucket = 0; bucket < 256; ++bucket )
+        {
+            heads[ bucket ] = offset;
+            offset += counts[ bucket ];
+            tails[ bucket ] = offset;
+        }
+
+        // cycle every item into its bucket
+        for( size_t bucket = 0; bucket < 256; ++bucket )
+        {
+            while( heads[ bucket ] < tails[ bucket ] )
+            {
+                T v = std::move( first[ heads[ bucket ] ] );
+                unsigned d = digit( v, shift );
+
+                while( d != bucket )
+                {
+                    std::swap( v, first[ heads[ d ]++ ] );
+                    d = digit( v, shift );
+                }
+
+                first[ heads[ bucket ]++ ] = std::move( v );
+            }
+        }
+
+        if( !shift ){
+            return;
+        }
+
+        for( size_t bucket = 0, begin = 0; bucket < 256; begin += counts[ bucket++ ] )
+        {
+            if( counts[ bucket ] > 1 ){
+                radix_sort( first + begin, first + begin + counts[ bucket ], shift - 8 );
+            }
+        }
+
+        return;
+    }
+}
+
+} // sorting_details
+
+namespace sorting
+{
+
+// Radix sort for types having key_traits
+template< typename T >
+void radix_sort( T* first, T* last )
+{
+    using key_type = typename key_traits< T >::key_type;
+    sorting_details::radix_sort( first, last, ( sizeof( key_type ) - 1 ) * 8 );
+}
+
+} // sorting
+
+} // external_sort
+
+#endif
@@ -0,0 +1,368 @@
+#include "raw_file.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+
+#if defined( __unix__ ) || defined( __APPLE__ )
+#define EXTERNAL_SORT_RAW_FILE 1
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace external_sort
+{
+
+namespace file
+{
+
+const size_t raw_file::alignment;
+
+#ifdef EXTERNAL_SORT_RAW_FILE
+
+namespace
+{
+
+const size_t stage_size = 1 << 20;
+
+bool aligned( size_t value ){
+    return !( value % raw_file::alignment );
+}
+
+bool aligned( const void* p ){
+    return aligned( reinterpret_cast< uintptr_t >( p ) );
+}
+
+void advise( int fd, size_t offset, size_t bytes, int advice )
+{
+#ifdef POSIX_FADV_NORMAL
+    posix_fadvise( fd, static_cast< off_t >( offset ), static_cast< off_t >( bytes ), advice );
+#else
+    ( void )fd; ( void )offset; ( void )bytes; ( void )advice;
+#endif
+}
+
+std::runtime_error io_error( const char* what ){
+    return std::runtime_error( std::string( what ) + ": " + std::strerror( errno ) );
+}
+
+// Reads until bytes or the end of the file
+size_t read_fd( int fd, char* data, size_t bytes, size_t offset )
+{
+    size_t done = 0;
+    while( done < bytes )
+    {
+        ssize_t result = pread( fd, data + done, bytes - done, static_cast< off_t >( offset + done ) );
+        if( result < 0 )
+        {
+            if( errno == EINTR ){
+                continue;
+            }
+
+            throw io_error( "Couldn't read file" );
+        }
+
+        if( !result ){
+            break;
+        }
+
+        done += static_cast< size_t >( result );
+    }
+
+    return done;
+}
+
+}
+
+bool raw_file::supported()
+{
+    return true;
+}
+
+raw_file::~raw_file()
+{
+    try{
+        close();
+    }
+    catch( ... ){
+    }
+}
+
+bool raw_file::open_read( const std::string& path, io_mode mode )
+{
+    close();
+
+    m_fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if( m_fd < 0 ){
+        return false;
+    }
+
+    m_mode = mode;
+    m_pos = 0;
+    m_dropped = 0;
+
+#ifdef O_DIRECT
+    // not every file system takes O_DIRECT, those get the hints instead
+    if( mode == io_mode::direct ){
+        m_direct_fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT );
+    }
+#endif
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    if( mode != io_mode::buffered ){
+        advise( m_fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+    }
+#endif
+
+    return true;
+}
+
+bool raw_file::open_write( const std::string& path, io_mode mode, bool truncate )
+{
+    close();
+
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | ( truncate ? O_TRUNC : 0 );
+    m_fd = ::open( path.c_str(), flags, 0644 );
+    if( m_fd < 0 ){
+        return false;
+    }
+
+    m_mode = mode;
+    m_pos = 0;
+    m_dropped = 0;
+
+#ifdef O_DIRECT
+    if( mode == io_mode::direct ){
+        m_direct_fd = ::open( path.c_str(), O_WRONLY | O_CLOEXEC | O_DIRECT );
+    }
+#endif
+
+    return true;
+}
+
+size_t raw_file::size() const
+{
+    struct stat st;
+    if( fstat( m_fd, &st ) ){
+        throw io_error( "Couldn't get file size" );
+    }
+
+    return static_cast< size_t >( st.st_size );
+}
+
+void raw_file::seek( size_t offset )
+{
+    flush();
+    m_pos = offset;
+    m_dropped = offset;
+}
+
+size_t raw_file::read( char* data, size_t bytes )
+{
+    size_t done = 0;
+
+    // whole blocks from an aligned position to aligned memory bypass the cache,
+    // a direct read falls short only at the end of the file
+    if( direct() && aligned( m_pos ) && aligned( data ) )
+    {
+        size_t direct_bytes = bytes - bytes % alignment;
+        done = read_direct( data, direct_bytes );
+        if( done < direct_bytes )
+        {
+            m_pos += done;
+            return done;
+        }
+    }
+
+    done += read_fd( m_fd, data + done, bytes - done, m_pos + done );
+    m_pos += done;
+    drop_cache( m_pos );
+
+    return done;
+}
+
+void raw_file::write( const char* data, size_t bytes )
+{
+    if( !direct() )
+    {
+        write_fd( m_fd, data, bytes, m_pos );
+        m_pos += bytes;
+
+        // what's been written before starts being written back and is dropped once clean
+        drop_cache( m_pos - bytes );
+        return;
+    }
+
+    size_t staged = m_stage.size();
+
+    // up to an aligned position through the cache
+    if( !staged && !aligned( m_pos ) )
+    {
+        size_t head = std::min( bytes, alignment - m_pos % alignment );
+        write_fd( m_fd, data, head, m_pos );
+        drop_cache( m_pos + head );
+
+        m_pos += head;
+        data += head;
+        bytes -= head;
+    }
+
+    // aligned memory goes straight to the disk
+    if( !staged && aligned( data ) )
+    {
+        size_t direct_bytes = bytes - bytes % alignment;
+        write_fd( m_direct_fd, data, direct_bytes, m_pos );
+
+        m_pos += direct_bytes;
+        data += direct_bytes;
+        bytes -= direct_bytes;
+    }
+
+    // the rest is copied to aligned memory first
+    while( bytes )
+    {
+        m_stage.reserve( stage_size );
+
+        size_t size = std::min( bytes, stage_size - m_stage.size() );
+        m_stage.insert( m_stage.end(), data, data + size );
+        data += size;
+        bytes -= size;
+
+        if( m_stage.size() == stage_size )
+        {
+            write_fd( m_direct_fd, m_stage.data(), m_stage.size(), m_pos );
+            m_pos += m_stage.size();
+            m_stage.clear();
+        }
+    }
+}
+
+void raw_file::flush()
+{
+    if( m_stage.empty() ){
+        return;
+    }
+
+    // the partial block at the end goes through the cache
+    size_t direct_bytes = m_stage.size() - m_stage.size() % alignment;
+    write_fd( m_direct_fd, m_stage.data(), direct_bytes, m_pos );
+    write_fd( m_fd, m_stage.data() + direct_bytes, m_stage.size() - direct_bytes, m_pos + direct_bytes );
+
+    m_pos += m_stage.size();
+    m_stage.clear();
+    drop_cache( m_pos );
+}
+
+void raw_file::close()
+{
+    if( m_fd < 0 ){
+        return;
+    }
+
+    // descriptors are closed even if the last write fails
+    std::exception_ptr error;
+    try{
+        flush();
+    }
+    catch( ... ){
+        error = std::current_exception();
+    }
+
+    if( m_direct_fd >= 0 ){
+        ::close( m_direct_fd );
+    }
+
+    ::close( m_fd );
+    m_fd = m_direct_fd = -1;
+    memory::buffer< char >{}.swap( m_stage );
+
+    if( error ){
+        std::rethrow_exception( error );
+    }
+}
+
+size_t raw_file::read_direct( char* data, size_t bytes )
+{
+    size_t done = 0;
+    while( done < bytes )
+    {
+        ssize_t result = pread( m_direct_fd, data + done, bytes - done, static_cast< off_t >( m_pos + done ) );
+        if( result < 0 )
+        {
+            if( errno == EINTR ){
+                continue;
+            }
+
+            throw io_error( "Couldn't read file" );
+        }
+
+        done += static_cast< size_t >( result );
+
+        // a part of a block is the end of the file
+        if( !result || !aligned( static_cast< size_t >( result ) ) ){
+            break;
+        }
+    }
+
+    return done;
+}
+
+void raw_file::write_fd( int fd, const char* data, size_t bytes, size_t offset )
+{
+    size_t done = 0;
+    while( done < bytes )
+    {
+        ssize_t result = pwrite( fd, data + done, bytes - done, static_cast< off_t >( offset + done ) );
+        if( result < 0 )
+        {
+            if( errno == EINTR ){
+                continue;
+            }
+
+            throw io_error( "Couldn't write to file" );
+        }
+
+        done += static_cast< size_t >( result );
+    }
+}
+
+void raw_file::drop_cache( size_t end )
+{
+#ifdef POSIX_FADV_DONTNEED
+    if( m_mode != io_mode::buffered && end > m_dropped )
+    {
+        advise( m_fd, m_dropped, end - m_dropped, POSIX_FADV_DONTNEED );
+        m_dropped = end;
+    }
+#else
+    ( void )end;
+#endif
+}
+
+#else
+
+// streams are used where there are no file descriptors
+
+bool raw_file::supported(){ return false; }
+raw_file::~raw_file(){}
+bool raw_file::open_read( const std::string&, io_mode ){ return false; }
+bool raw_file::open_write( const std::string&, io_mode, bool ){ return false; }
+size_t raw_file::size() const{ return 0; }
+void raw_file::seek( size_t ){}
+size_t raw_file::read( char*, size_t ){ return 0; }
+void raw_file::write( const char*, size_t ){}
+void raw_file::flush(){}
+void raw_file::close(){}
+size_t raw_file::read_direct( char*, size_t ){ return 0; }
+void raw_file::write_fd( int, const char*, size_t, size_t ){}
+void raw_file::drop_cache( size_t ){}
+
+#endif
+
+}// file
+
+}// external_sort
@@ -0,0 +1,110 @@
+#ifndef RAW_FILE_HPP
+#define RAW_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "buffer_pool.hpp"
+
+namespace external_sort
+{
+
+namespace file
+{
+
+// How a file is accessed
+enum class io_mode
+{
+    buffered, // through the page cache as usual
+    cache_hints, // through the page cache, telling the kernel not to keep what's done with
+    direct, // around the page cache with O_DIRECT
+    mapped // reading through a memory mapping
+};
+
+// Temp runs are read once, so they don't get to stay in the page cache
+inline io_mode temp_io( bool direct ){
+    return direct ? io_mode::direct : io_mode::cache_hints;
+}
+
+// A file accessed through a descriptor, for the io modes streams can't do.
+// In direct mode reads and writes of whole aligned blocks from and to aligned
+// memory bypass the page cache, the rest, like the partial block at the end
+// of a file, go through a second buffered descriptor. Writes from unaligned
+// memory are staged in an aligned buffer first.
+// Direct mode falls back to cache hints where O_DIRECT isn't supported
+class raw_file
+{
+public:
+    // Direct reads and writes have to start at and be a multiple of it
+    static const size_t alignment = memory::buffer_alignment;
+
+    // false if there are no file descriptors here, streams have to be used
+    static bool supported();
+
+    raw_file() = default;
+    raw_file( const raw_file& ) = delete;
+    raw_file& operator=( const raw_file& ) = delete;
+    ~raw_file();
+
+    // false if the file can't be opened
+    bool open_read( const std::string& path, io_mode mode );
+    bool open_write( const std::string& path, io_mode mode, bool truncate );
+
+    size_t size() const;
+    void seek( size_t offset );
+
+    // Reads from the current position, fewer bytes only at the end of the file
+    size_t read( char* data, size_t bytes );
+    void write( const char* data, size_t bytes );
+
+    // Writes what has been staged, closing flushes as well
+    void flush();
+    void close();
+
+    inline bool is_open() const{
+        return m_fd >= 0;
+    }
+
+    inline bool direct() const{
+        return m_direct_fd >= 0;
+    }
+
+private:
+    size_t read_direct( char* data, size_t bytes );
+    void write_fd( int fd, const char* data, size_t bytes, size_t offset );
+
+    // Drops [ m_dropped, end ) from the page cache in hinted modes
+    void drop_cache( size_t end );
+
+private:
+    int m_fd{ -1 };
+    int m_direct_fd{ -1 };
+    io_mode m_mode{ io_mode::buffered };
+    size_t m_pos{ 0 }; // where staged data goes
+    size_t m_dropped{ 0 };
+    memory::buffer< char > m_stage;
+};
+
+// Number of items a direct read or write has to be a multiple of,
+// so that it starts at an aligned position and ends on an item boundary
+template< typename T >
+size_t aligned_items()
+{
+    size_t a = raw_file::alignment;
+    size_t b = sizeof( T );
+
+    while( b )
+    {
+        size_t r = a % b;
+        a = b;
+        b = r;
+    }
+
+    return raw_file::alignment / a;
+}
+
+}// file
+
+}// external_sort
+
+#endif
@@ -0,0 +1,630 @@
+#ifndef RECORD_SORTER_HPP
+#define RECORD_SORTER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <list>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "file_writer.hpp"
+#include "key_traits.hpp"
+#include "loser_tree.hpp"
+#include "radix_sort.hpp"
+#include "run_scheduler.hpp"
+#include "parallel_sort.hpp"
+#include "async.hpp"
+#include "common.hpp"
+#include "options.hpp"
+
+namespace external_sort
+{
+
+namespace records_details
+{
+
+// A record of a chunk along with its first bytes, so most comparisons
+// don't have to look at the chunk itself
+struct record_entry
+{
+    uint64_t prefix; // the first 8 bytes, big endian, zero padded
+    size_t offset;
+    size_t length;
+};
+
+} //records_details
+
+template<>
+struct key_traits< records_details::record_entry >
+{
+    using key_type = uint64_t;
+
+    static key_type key( const records_details::record_entry& e ){
+        return e.prefix;
+    }
+};
+
+namespace records_details
+{
+
+using merge::sorted_run;
+using merge::merge_job;
+using merge::run_scheduler;
+
+// A record in memory, records are ordered as byte strings
+struct record_view
+{
+    const char* data;
+    size_t length;
+
+    bool operator<( const record_view& r ) const;
+};
+
+// Reads the newline-delimited records of a file one by one, a block at a time.
+// The block comes from the pool, a record longer than it makes the block grow
+class record_reader
+{
+public:
+    void open( const std::string& path, size_t block_size, memory::buffer_pool< char >& pool );
+    void close();
+    void next();
+
+    inline const record_view& current() const NOEXCEPT{
+        return m_current;
+    }
+
+    inline bool finished() const NOEXCEPT{
+        return m_finished;
+    }
+
+private:
+    void find_record();
+    void refill();
+
+private:
+    std::ifstream m_in;
+    memory::buffer_pool< char >* m_pool{ nullptr };
+    memory::buffer< char > m_buffer;
+    size_t m_pos{ 0 }; // where the current record starts
+    record_view m_current{ nullptr, 0 };
+    bool m_eof{ false };
+    bool m_finished{ true };
+};
+
+uint64_t record_prefix( const char* data, size_t length );
+
+// Doubles the capacity of a buffer from the pool keeping its data. Only records
+// longer than the memory given to a buffer need it, so the larger buffer
+// is allocated past the pool, which takes the old one back
+void grow( memory::buffer< char >& b, memory::buffer_pool< char >& pool );
+
+// Where the entries of a chunk start, right after its records
+size_t entries_offset( size_t chunk_bytes );
+
+// Appends a record and its delimiter to the buffer, writing it out once full.
+// The buffer never grows, a record that doesn't fit goes out by itself
+void write_record( file::file_writer< char >& writer, memory::buffer< char >& out, size_t max_size, const char* data, size_t length );
+
+// Fills the chunk with whole records of the carry and the input as long as
+// they fit into its capacity along with their entries, grows it for a record
+// that doesn't fit alone. Returns the number of records,
+// what's read past the last one is left in the carry
+size_t fill_chunk( std::ifstream& in, memory::buffer< char >& chunk, memory::buffer< char >& carry,
+                   size_t read_size, bool& eof, memory::buffer_pool< char >& pool );
+
+// Sorts the records of a chunk through an array of their offsets kept past
+// them in the chunk and writes them into a run. Gives the chunk back to the pool
+void sort_chunk( memory::buffer< char >& chunk, size_t records, const std::string& file_name, size_t out_size, memory::buffer_pool< char >& pool );
+
+// Cuts the input into chunks of whole records, sorts and writes them on the pool
+size_t split( const std::string& file_path, const std::string& work_folder, size_t avail_mem, size_t threads_num, memory::buffer_pool< char >& pool );
+
+// Streams the records of the runs into one file
+void merge_runs( const std::vector< sorted_run >& inputs, const std::string& out_file, size_t block_size, size_t write_buffers,
+                 memory::buffer_pool< char >& pool );
+
+} //records_details
+
+namespace records
+{
+
+// Sorts a file of newline-delimited records in byte order. The last record
+// may lack the newline, the output ends every record with one.
+// Runs are merged with all threads until the last merge, which takes one.
+// Buffers come from the pool, capped at avail_mem
+size_t sort( const std::string& in_file,
+             const std::string& out_file,
+             size_t avail_mem,
+             size_t merge_at_once,
+             size_t threads_num,
+             const options& opts,
+             memory::buffer_pool< char >& pool )
+{
+    std::string work_folder = common::get_folder_from_path( out_file );
+    size_t runs_num = records_details::split( in_file, work_folder, avail_mem, threads_num, pool );
+
+    std::vector< records_details::sorted_run > runs;
+    for( size_t run = 1; run <= runs_num; ++run )
+    {
+        std::string path = common::temp_file_path( work_folder, run );
+        std::ifstream in( path, std::ios::in | std::ifstream::binary | std::ios::ate );
+        runs.push_back( records_details::sorted_run{ path, static_cast< size_t >( in.tellg() ) } );
+    }
+
+    if( runs.size() == 1 )
+    {
+        std::rename( runs.front().path.c_str(), out_file.c_str() );
+        return runs_num;
+    }
+
+    // every merge has a block per run and an output buffer,
+    // no more threads than there is memory for a byte of each
+    size_t out_buffers = std::max< size_t >( opts.write_buffers, 1 );
+    size_t merge_threads = std::max< size_t >( std::min( threads_num, avail_mem / ( merge_at_once + out_buffers ) ), 1 );
+    size_t block_size = std::max< size_t >( avail_mem / ( ( merge_at_once + out_buffers ) * merge_threads ), 1 );
+
+    records_details::run_scheduler scheduler( std::move( runs ), merge_at_once, work_folder );
+
+    concurrency::async async( merge_threads );
+    sorting_details::run_on_pool( async, merge_threads, [ & ]( size_t )
+    {
+        try
+        {
+            records_details::merge_job job;
+            while( scheduler.next_job( job ) )
+            {
+                records_details::merge_runs( job.inputs, job.output.path, block_size, opts.write_buffers, pool );
+                scheduler.complete( job );
+            }
+        }
+        catch( ... )
+        {
+            scheduler.cancel();
+            throw;
+        }
+    });
+
+    runs = scheduler.runs();
+    size_t last_block = std::max< size_t >( avail_mem / ( runs.size() + out_buffers ), 1 );
+    records_details::merge_runs( runs, out_file, last_block, opts.write_buffers, pool );
+
+    return runs_num;
+}
+
+} //records
+
+namespace records_details
+{
+
+bool record_view::operator<( const record_view& r ) const
+{
+    int result = std::memcmp( data, r.data, std::min( length, r.length ) );
+    return result < 0 || ( !result && length < r.length );
+}
+
+void record_reader::open( const std::string& path, size_t block_size, memory::buffer_pool< char >& pool )
+{
+    close();
+    m_in.clear();
+    m_in.open( path, std::ios::in | std::ifstream::binary );
+
+    if( !m_in.good() ){
+        throw std::invalid_argument( path + " doesn't exist or occupied by another process" );
+    }
+
+    m_pool = &pool;
+    m_buffer = m_pool->acquire( std::max< size_t >( block_size, 1 ) );
+    m_pos = 0;
+    m_eof = false;
+    m_finished = false;
+
+    find_record();
+}
+
+void record_reader::close()
+{
+    m_in.close();
+    if( m_pool ){
+        m_pool->release( std::move( m_buffer ) );
+    }
+
+    memory::buffer< char >{}.swap( m_buffer );
+    m_finished = true;
+}
+
+void record_reader::next()
+{
+    m_pos += m_current.length + 1;
+    find_record();
+}
+
+void record_reader::find_record()
+{
+    while( true )
+    {
+        const char* begin = m_buffer.data() + m_pos;
+        const char* end = m_buffer.data() + m_buffer.size();
+        const char* delimiter = static_cast< const char* >( std::memchr( begin, '\n', end - begin ) );
+
+        if( delimiter )
+        {
+            m_current = record_view{ begin, static_cast< size_t >( delimiter - begin ) };
+            return;
+        }
+
+        if( m_eof )
+        {
+            // the last record may go without a delimiter
+            if( begin != end )
+            {
+                if( m_buffer.size() == m_buffer.capacity() ){
+                    grow( m_buffer, *m_pool );
+                }
+
+                m_buffer.push_back( '\n' );
+                continue;
+            }
+
+            m_finished = true;
+            return;
+        }
+
+        refill();
+    }
+}
+
+void record_reader::refill()
+{
+    // the part of a record left goes to the front
+    size_t left = m_buffer.size() - m_pos;
+    std::memmove( m_buffer.data(), m_buffer.data() + m_pos, left );
+    m_pos = 0;
+
+    if( left == m_buffer.capacity() ){
+        grow( m_buffer, *m_pool );
+    }
+
+    size_t capacity = m_buffer.capacity();
+    m_buffer.resize( capacity ); // no zeroing, the buffer allocator leaves items uninitialized
+    m_in.read( m_buffer.data() + left, capacity - left );
+    m_buffer.resize( left + static_cast< size_t >( m_in.gcount() ) );
+    m_eof = m_in.eof();
+}
+
+uint64_t record_prefix( const char* data, size_t length )
+{
+    uint64_t prefix = 0;
+    for( size_t byte = 0; byte < 8; ++byte ){
+        prefix = ( prefix << 8 ) | ( byte < length ? static_cast< unsigned char >( data[ byte ] ) : 0 );
+    }
+
+    return prefix;
+}
+
+void grow( memory::buffer< char >& b, memory::buffer_pool< char >& pool )
+{
+    memory::buffer< char > larger;
+    larger.reserve( std::max< size_t >( 2 * b.capacity(), 1 ) );
+    larger.assign( b.begin(), b.end() );
+
+    pool.release( std::move( b ) );
+    b = std::move( larger );
+}
+
+size_t entries_offset( size_t chunk_bytes )
+{
+    const size_t alignment = alignof( record_entry );
+    return ( chunk_bytes + alignment - 1 ) / alignment * alignment;
+}
+
+void write_record( file::file_writer< char >& writer, memory::buffer< char >& out, size_t max_size, const char* data, size_t length )
+{
+    if( out.size() + length + 1 > out.capacity() )
+    {
+        writer.write( out );
+
+        if( length + 1 > out.capacity() )
+        {
+            memory::buffer< char > record( data, data + length );
+            record.push_back( '\n' );
+            writer.write( std::move( record ) );
+            return;
+        }
+    }
+
+    out.insert( out.end(), data, data + length );
+    out.push_back( '\n' );
+
+    if( out.size() >= max_size ){
+        writer.write( out );
+    }
+}
+
+size_t fill_chunk( std::ifstream& in, memory::buffer< char >& chunk, memory::buffer< char >& carry,
+                   size_t read_size, bool& eof, memory::buffer_pool< char >& pool )
+{
+    while( chunk.capacity() < carry.size() ){
+        grow( chunk, pool );
+    }
+
+    chunk.assign( carry.begin(), carry.end() );
+
+    size_t records = 0;
+    size_t whole = 0; // bytes of the records taken
+    size_t scanned = 0;
+
+    auto fits = [ &chunk ]( size_t bytes, size_t records_num ){
+        return entries_offset( bytes ) + records_num * sizeof( record_entry ) <= chunk.capacity();
+    };
+
+    while( true )
+    {
+        bool full = false;
+        while( scanned < chunk.size() )
+        {
+            if( chunk[ scanned ] == '\n' )
+            {
+                if( !fits( scanned + 1, records + 1 ) )
+                {
+                    if( records )
+                    {
+                        full = true;
+                        break;
+                    }
+
+                    grow( chunk, pool );
+                    continue;
+                }
+
+                ++records;
+                whole = scanned + 1;
+            }
+
+            ++scanned;
+        }
+
+        if( full ){
+            break;
+        }
+
+        if( eof )
+        {
+            // the last record may go without a delimiter
+            if( whole < chunk.size() )
+            {
+                if( !fits( chunk.size() + 1, records + 1 ) )
+                {
+                    if( records ){
+                        break;
+                    }
+
+                    grow( chunk, pool );
+                    continue;
+                }
+
+                chunk.push_back( '\n' );
+                ++records;
+                whole = scanned = chunk.size();
+            }
+
+            break;
+        }
+
+        if( chunk.size() == chunk.capacity() )
+        {
+            if( records ){
+                break;
+            }
+
+            grow( chunk, pool ); // a record longer than the chunk
+        }
+
+        size_t filled = chunk.size();
+        chunk.resize( std::min( chunk.capacity(), filled + read_size ) );
+        in.read( chunk.data() + filled, chunk.size() - filled );
+        chunk.resize( filled + static_cast< size_t >( in.gcount() ) );
+        eof = in.eof();
+    }
+
+    carry.assign( chunk.begin() + whole, chunk.end() );
+    chunk.resize( whole );
+
+    return records;
+}
+
+void sort_chunk( memory::buffer< char >& chunk, size_t records, const std::string& file_name, size_t out_size, memory::buffer_pool< char >& pool )
+{
+    memory::buffer< char > out;
+
+    try
+    {
+        const char* data = chunk.data();
+        record_entry* entries = reinterpret_cast< record_entry* >( chunk.data() + entries_offset( chunk.size() ) );
+        record_entry* entries_end = entries + records;
+
+        size_t pos = 0;
+        for( record_entry* e = entries; e != entries_end; ++e )
+        {
+            const char* delimiter = static_cast< const char* >( std::memchr( data + pos, '\n', chunk.size() - pos ) );
+            size_t length = delimiter - ( data + pos );
+
+            ::new( static_cast< void* >( e ) ) record_entry{ record_prefix( data + pos, length ), pos, length };
+            pos += length + 1;
+        }
+
+        // by the prefixes first, then records with equal ones as a whole
+        sorting::radix_sort( entries, entries_end );
+
+        auto less = [ data ]( const record_entry& l, const record_entry& r ){
+            return record_view{ data + l.offset, l.length } < record_view{ data + r.offset, r.length };
+        };
+
+        for( record_entry* run = entries; run != entries_end; )
+        {
+            record_entry* run_end = run + 1;
+            while( run_end != entries_end && run_end->prefix == run->prefix ){
+                ++run_end;
+            }
+
+            if( run_end - run > 1 ){
+                std::sort( run, run_end, less );
+            }
+
+            run = run_end;
+        }
+
+        // records are gathered in their order on the way out
+        file::file_writer< char > writer( &pool );
+        writer.open( file_name );
+
+        out = pool.acquire( out_size );
+
+        for( record_entry* e = entries; e != entries_end; ++e ){
+            write_record( writer, out, out_size, data + e->offset, e->length );
+        }
+
+        writer.write( out );
+        writer.close();
+    }
+    catch( ... )
+    {
+        pool.release( std::move( out ) );
+        pool.release( std::move( chunk ) );
+        throw;
+    }
+
+    pool.release( std::move( out ) );
+    pool.release( std::move( chunk ) );
+}
+
+size_t split( const std::string& file_path, const std::string& work_folder, size_t avail_mem, size_t threads_num, memory::buffer_pool< char >& pool )
+{
+    // a thread's share of the memory takes its chunk along with the entries
+    // of the records in it, the output buffer and the carry, which is
+    // no longer than a read in most cases
+    threads_num = std::max< size_t >( std::min( threads_num, avail_mem / 2 ), 1 );
+    size_t share = avail_mem / threads_num;
+    size_t out_size = std::max< size_t >( share / 16, 1 );
+    size_t read_size = out_size;
+    size_t chunk_size = share > out_size + read_size ? share - out_size - read_size : 1;
+
+    std::ifstream in( file_path, std::ios::in | std::ifstream::binary );
+    if( !in.good() ){
+        throw std::invalid_argument( file_path + " doesn't exist or occupied by another process" );
+    }
+
+    concurrency::async async( threads_num );
+    std::list< concurrency::Task > tasks;
+
+    memory::buffer< char > carry; // the beginning of a record cut by the end of a chunk
+    size_t total_started = 0;
+    bool eof = false;
+
+    auto clear_finished = [ &tasks ]( bool wait )
+    {
+        tasks.remove_if( [ wait ]( concurrency::Task& t )
+        {
+            if( !wait && t.result.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready ){
+                return false;
+            }
+
+            t.result.get(); // rethrow
+            return true;
+        });
+    };
+
+    while( !eof || !carry.empty() )
+    {
+        async.wait_for_first_vacant();
+        clear_finished( false );
+
+        memory::buffer< char > chunk = pool.acquire( chunk_size );
+        size_t records = fill_chunk( in, chunk, carry, read_size, eof, pool );
+
+        if( !records )
+        {
+            pool.release( std::move( chunk ) );
+            break;
+        }
+
+        std::string file_name = common::temp_file_path( work_folder, ++total_started );
+
+        tasks.emplace_back();
+        concurrency::Task& curr = tasks.back();
+
+        auto sort_func = std::bind( &records_details::sort_chunk, std::move( chunk ), records, file_name, out_size, std::ref( pool ) );
+        curr.task = std::packaged_task< void() >{ std::move( sort_func ) };
+        curr.result = async.run( curr.task );
+    }
+
+    clear_finished( true );
+
+    return total_started;
+}
+
+void merge_runs( const std::vector< sorted_run >& inputs, const std::string& out_file, size_t block_size, size_t write_buffers,
+                 memory::buffer_pool< char >& pool )
+{
+    std::vector< record_reader > readers( inputs.size() );
+    memory::buffer< char > out;
+
+    try
+    {
+        for( size_t file = 0; file < inputs.size(); ++file ){
+            readers[ file ].open( inputs[ file ].path, block_size, pool );
+        }
+
+        file::file_writer< char > writer( &pool );
+        writer.open( out_file, write_buffers );
+
+        out = pool.acquire( block_size );
+
+        merge::loser_tree< std::vector< record_reader > > tree( readers, readers.size() );
+        while( !tree.empty() )
+        {
+            record_reader& min_reader = readers[ tree.top() ];
+            write_record( writer, out, block_size, min_reader.current().data, min_reader.current().length );
+
+            // the record is copied out before the block may be refilled
+            min_reader.next();
+            tree.replay();
+        }
+
+        writer.write( out );
+        writer.close();
+    }
+    catch( ... )
+    {
+        for( auto& r : readers ){
+            r.close();
+        }
+
+        pool.release( std::move( out ) );
+        throw;
+    }
+
+    for( auto& r : readers ){
+        r.close();
+    }
+
+    pool.release( std::move( out ) );
+
+    for( auto& input : inputs ){
+        std::remove( input.path.c_str() );
+    }
+}
+
+} //records_details
+
+} //external_sort
+
+#endif
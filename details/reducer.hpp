@@ -0,0 +1,155 @@
+#ifndef REDUCER_HPP
+#define REDUCER_HPP
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <utility>
+
+#include "buffer_pool.hpp"
+#include "file_writer.hpp"
+#include "noexcept_support.hpp"
+
+namespace external_sort
+{
+
+namespace merge
+{
+
+// Combines an item into an equal one kept in the output
+template< typename T >
+using combine_function = std::function< void( T& into, const T& item ) >;
+
+// What's kept of sorted data. By default all of it, otherwise either only
+// the first of a group of equal items, the others being combined into it
+// or dropped, or only the first limit items.
+// Equal items are the ones neither less than the other
+template< typename T >
+class reducer
+{
+public:
+    // Keeps everything
+    reducer() = default;
+
+    // Combines equal items into the first one, drops them if combine is empty
+    explicit reducer( combine_function< T > combine );
+
+    // Keeps the smallest limit items
+    static reducer top( size_t limit );
+
+    // false if everything is kept
+    inline bool enabled() const NOEXCEPT;
+    inline size_t limit() const NOEXCEPT;
+
+    // Moves the items to keep of unsorted [ first, last ) to its front ahead
+    // of sorting, returns their end. Only the limit cuts anything off here
+    T* select( T* first, T* last ) const;
+
+    // Reduces sorted [ first, last ) in place, returns the end of what's left
+    T* reduce( T* first, T* last ) const;
+
+    // Appends an item to a sorted buffer of up to capacity items, false if
+    // it went into the last one instead. A full buffer is written only when
+    // an item that doesn't go into its last one comes, so a group of equal
+    // items never spans two writes. Keeping to the limit is up to the caller
+    bool push( memory::buffer< T >& out, size_t capacity, const T& item, file::file_writer< T >& writer ) const;
+
+private:
+    combine_function< T > m_combine;
+    bool m_unique{ false };
+    size_t m_limit{ std::numeric_limits< size_t >::max() };
+};
+
+///// implementation
+
+template< typename T >
+reducer< T >::reducer( combine_function< T > combine ) :
+    m_combine( std::move( combine ) ),
+    m_unique( true )
+{
+
+}
+
+template< typename T >
+reducer< T > reducer< T >::top( size_t limit )
+{
+    reducer< T > result;
+    result.m_limit = limit;
+    return result;
+}
+
+template< typename T >
+inline bool reducer< T >::enabled() const NOEXCEPT
+{
+    return m_unique || m_limit != std::numeric_limits< size_t >::max();
+}
+
+template< typename T >
+inline size_t reducer< T >::limit() const NOEXCEPT
+{
+    return m_limit;
+}
+
+template< typename T >
+T* reducer< T >::select( T* first, T* last ) const
+{
+    // fewer items would be left after combining equal ones, so they all have to be sorted
+    if( m_unique || static_cast< size_t >( last - first ) <= m_limit ){
+        return last;
+    }
+
+    std::nth_element( first, first + m_limit, last );
+    return first + m_limit;
+}
+
+template< typename T >
+T* reducer< T >::reduce( T* first, T* last ) const
+{
+    if( m_unique && first != last )
+    {
+        T* result = first;
+        for( T* item = first + 1; item != last; ++item )
+        {
+            // sorted, so it's either equal or greater
+            if( !( *result < *item ) )
+            {
+                if( m_combine ){
+                    m_combine( *result, *item );
+                }
+            }
+            else if( ++result != item ){
+                *result = std::move( *item );
+            }
+        }
+
+        last = result + 1;
+    }
+
+    return static_cast< size_t >( last - first ) > m_limit ? first + m_limit : last;
+}
+
+template< typename T >
+bool reducer< T >::push( memory::buffer< T >& out, size_t capacity, const T& item, file::file_writer< T >& writer ) const
+{
+    if( m_unique && !out.empty() && !( out.back() < item ) )
+    {
+        if( m_combine ){
+            m_combine( out.back(), item );
+        }
+
+        return false;
+    }
+
+    if( out.size() >= capacity ){
+        writer.write( out );
+    }
+
+    out.push_back( item );
+    return true;
+}
+
+}// merge
+
+}// external_sort
+
+#endif
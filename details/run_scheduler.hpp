@@ -0,0 +1,198 @@
+#ifndef RUN_SCHEDULER_HPP
+#define RUN_SCHEDULER_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+
+namespace external_sort
+{
+
+namespace merge
+{
+
+// A sorted run waiting to be merged
+struct sorted_run
+{
+    std::string path;
+    size_t size; // number of items
+};
+
+// Runs to merge into a new one
+struct merge_job
+{
+    std::vector< sorted_run > inputs;
+    sorted_run output;
+};
+
+// Catalog of the runs left to merge handing out merge jobs to threads.
+// Smallest runs are merged first, as in building a Huffman tree, which
+// minimizes the number of items rewritten. No more jobs are given once
+// the runs left fit into a single merge, the last one is up to the caller.
+// An open catalog takes new runs while jobs are being done, it only gives
+// full jobs of simul_merge runs until it's closed
+class run_scheduler
+{
+public:
+    run_scheduler( std::vector< sorted_run > runs, size_t simul_merge, const std::string& work_folder, bool open = false );
+    run_scheduler( const run_scheduler& ) = delete;
+    run_scheduler& operator=( const run_scheduler& ) = delete;
+
+    // Waits until there is a job, false if no more jobs are coming
+    bool next_job( merge_job& job );
+
+    // Puts the output of a finished job back into the catalog
+    void complete( const merge_job& job );
+
+    // Adds a run to an open catalog
+    void add( sorted_run r );
+
+    // No more runs are coming
+    void close();
+
+    // Stops giving jobs after one of them failed
+    void cancel();
+
+    // Runs in the catalog, smallest first
+    std::vector< sorted_run > runs() const;
+
+private:
+    // Number of runs the next job should merge
+    size_t next_job_size() const;
+    static bool larger( const sorted_run& l, const sorted_run& r );
+
+private:
+    std::vector< sorted_run > m_runs; // min-heap by size
+    size_t m_merging{ 0 }; // jobs being done, each gives a run back
+    size_t m_simul_merge;
+    std::string m_work_folder;
+    size_t m_next_index{ 1 };
+    bool m_open;
+    bool m_cancelled{ false };
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+///// implementation
+
+run_scheduler::run_scheduler( std::vector< sorted_run > runs, size_t simul_merge, const std::string& work_folder, bool open ) :
+    m_runs( std::move( runs ) ),
+    m_simul_merge( simul_merge ),
+    m_work_folder( work_folder ),
+    m_open( open )
+{
+    std::make_heap( m_runs.begin(), m_runs.end(), &run_scheduler::larger );
+}
+
+bool run_scheduler::next_job( merge_job& job )
+{
+    std::unique_lock< std::mutex > l{ m_mutex };
+
+    // everything left, including the runs being merged, fits into the last merge
+    auto done = [ this ](){ return m_cancelled || ( !m_open && m_runs.size() + m_merging <= m_simul_merge ); };
+    m_cv.wait( l, [ & ](){ return done() || m_runs.size() >= next_job_size(); } );
+
+    if( done() )
+    {
+        m_cv.notify_all();
+        return false;
+    }
+
+    job.inputs.clear();
+    job.output.size = 0;
+
+    for( size_t input = next_job_size(); input > 0; --input )
+    {
+        std::pop_heap( m_runs.begin(), m_runs.end(), &run_scheduler::larger );
+        job.output.size += m_runs.back().size;
+        job.inputs.emplace_back( std::move( m_runs.back() ) );
+        m_runs.pop_back();
+    }
+
+    job.output.path = common::merged_file_path( m_work_folder, m_next_index++ );
+    ++m_merging;
+
+    return true;
+}
+
+void run_scheduler::complete( const merge_job& job )
+{
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_runs.push_back( job.output );
+        std::push_heap( m_runs.begin(), m_runs.end(), &run_scheduler::larger );
+        --m_merging;
+    }
+
+    m_cv.notify_all();
+}
+
+void run_scheduler::add( sorted_run r )
+{
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_runs.emplace_back( std::move( r ) );
+        std::push_heap( m_runs.begin(), m_runs.end(), &run_scheduler::larger );
+    }
+
+    m_cv.notify_all();
+}
+
+void run_scheduler::close()
+{
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_open = false;
+    }
+
+    m_cv.notify_all();
+}
+
+void run_scheduler::cancel()
+{
+    {
+        std::lock_guard< std::mutex > l{ m_mutex };
+        m_cancelled = true;
+    }
+
+    m_cv.notify_all();
+}
+
+std::vector< sorted_run > run_scheduler::runs() const
+{
+    std::lock_guard< std::mutex > l{ m_mutex };
+
+    std::vector< sorted_run > result( m_runs );
+    std::sort( result.begin(), result.end(), []( const sorted_run& l, const sorted_run& r ){ return larger( r, l ); } );
+
+    return result;
+}
+
+size_t run_scheduler::next_job_size() const
+{
+    // more runs are coming, so there's no knowing how many the first merge should take
+    if( m_open ){
+        return m_simul_merge;
+    }
+
+    // as in a k-ary Huffman tree only the first merge may take fewer runs,
+    // just enough for every merge after it to take simul_merge of them.
+    // Runs being merged count as the single run each of them will become
+    size_t total = m_runs.size() + m_merging;
+    return ( total - 2 ) % ( m_simul_merge - 1 ) + 2;
+}
+
+bool run_scheduler::larger( const sorted_run& l, const sorted_run& r )
+{
+    return l.size > r.size;
+}
+
+}// merge
+
+}// external_sort
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef SIMD_SORT_HPP
+#define SIMD_SORT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+// The vectorized kernel needs per function target attributes and
+// __builtin_cpu_supports, other compilers and architectures get the scalar path
+#if ( defined( __GNUC__ ) || defined( __clang__ ) ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define EXTERNAL_SORT_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace external_sort
+{
+
+namespace sorting_details
+{
+
+// 32 and 64 bit integers and floats are sorted by the vectorized kernel
+template< typename T >
+struct simd_sortable : std::integral_constant< bool,
+    std::is_arithmetic< T >::value && !std::is_same< T, bool >::value &&
+    ( sizeof( T ) == 4 || sizeof( T ) == 8 ) &&
+    ( std::is_integral< T >::value || std::numeric_limits< T >::is_iec559 ) >
+{
+};
+
+#ifdef EXTERNAL_SORT_SIMD
+
+namespace simd
+{
+
+// the kernel only compares signed integers, other types are mapped onto them
+// in place and back. Storage of T is accessed through these
+typedef int32_t int32_alias __attribute__( ( __may_alias__ ) );
+typedef int64_t int64_alias __attribute__( ( __may_alias__ ) );
+
+template< size_t Size >
+struct alias_of;
+
+template<>
+struct alias_of< 4 >
+{
+    typedef int32_alias type;
+};
+
+template<>
+struct alias_of< 8 >
+{
+    typedef int64_alias type;
+};
+
+// tag of the lanes distance for swapping lanes i and i ^ D
+template< int D >
+struct lanes_distance
+{
+};
+
+#if defined( __clang__ )
+#pragma clang attribute push( __attribute__( ( target( "avx2" ) ) ), apply_to = function )
+#else
+#pragma GCC push_options
+#pragma GCC target( "avx2" )
+#endif
+
+namespace avx2
+{
+
+struct int32_traits
+{
+    typedef __m256i vec;
+    typedef int32_alias scalar;
+    static const int lanes = 8;
+
+    static inline vec load( const scalar* p ){ return _mm256_loadu_si256( ( const __m256i* )p ); }
+    static inline void store( scalar* p, vec v ){ _mm256_storeu_si256( ( __m256i* )p, v ); }
+    static inline vec min( vec a, vec b ){ return _mm256_min_epi32( a, b ); }
+    static inline vec max( vec a, vec b ){ return _mm256_max_epi32( a, b ); }
+    static inline vec select( vec mask, vec a, vec b ){ return _mm256_blendv_epi8( b, a, mask ); }
+    static inline vec reverse( vec v ){ return _mm256_permutevar8x32_epi32( v, _mm256_setr_epi32( 7, 6, 5, 4, 3, 2, 1, 0 ) ); }
+
+    static inline vec swap( vec v, lanes_distance< 1 > ){ return _mm256_shuffle_epi32( v, _MM_SHUFFLE( 2, 3, 0, 1 ) ); }
+    static inline vec swap( vec v, lanes_distance< 2 > ){ return _mm256_shuffle_epi32( v, _MM_SHUFFLE( 1, 0, 3, 2 ) ); }
+    static inline vec swap( vec v, lanes_distance< 4 > ){ return _mm256_permute2x128_si256( v, v, 1 ); }
+};
+
+struct int64_traits
+{
+    typedef __m256i vec;
+    typedef int64_alias scalar;
+    static const int lanes = 4;
+
+    static inline vec load( const scalar* p ){ return _mm256_loadu_si256( ( const __m256i* )p ); }
+    static inline void store( scalar* p, vec v ){ _mm256_storeu_si256( ( __m256i* )p, v ); }
+    static inline vec min( vec a, vec b ){ return _mm256_blendv_epi8( a, b, _mm256_cmpgt_epi64( a, b ) ); }
+    static inline vec max( vec a, vec b ){ return _mm256_blendv_epi8( b, a, _mm256_cmpgt_epi64( a, b ) ); }
+    static inline vec select( vec mask, vec a, vec b ){ return _mm256_blendv_epi8( b, a, mask ); }
+    static inline vec reverse( vec v ){ return _mm256_permute4x64_epi64( v, _MM_SHUFFLE( 0, 1, 2, 3 ) ); }
+
+    static inline vec swap( vec v, lanes_distance< 1 > ){ return _mm256_shuffle_epi32( v, _MM_SHUFFLE( 1, 0, 3, 2 ) ); }
+    static inline vec swap( vec v, lanes_distance< 2 > ){ return _mm256_permute4x64_epi64( v, _MM_SHUFFLE( 1, 0, 3, 2 ) ); }
+};
+
+#include "simd_sort_kernel.inl"
+
+} // avx2
+
+#if defined( __clang__ )
+#pragma clang attribute pop
+#pragma clang attribute push( __attribute__( ( target( "sse4.2" ) ) ), apply_to = function )
+#else
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target( "sse4.2" )
+#endif
+
+namespace sse42
+{
+
+struct int32_traits
+{
+    typedef __m128i vec;
+    typedef int32_alias scalar;
+    static const int lanes = 4;
+
+    static inline vec load( const scalar* p ){ return _mm_loadu_si128( ( const __m128i* )p ); }
+    static inline void store( scalar* p, vec v ){ _mm_storeu_si128( ( __m128i* )p, v ); }
+    static inline vec min( vec a, vec b ){ return _mm_min_epi32( a, b ); }
+    static inline vec max( vec a, vec b ){ return _mm_max_epi32( a, b ); }
+    static inline vec select( vec mask, vec a, vec b ){ return _mm_blendv_epi8( b, a, mask ); }
+    static inline vec reverse( vec v ){ return _mm_shuffle_epi32( v, _MM_SHUFFLE( 0, 1, 2, 3 ) ); }
+
+    static inline vec swap( vec v, lanes_distance< 1 > ){ return _mm_shuffle_epi32( v, _MM_SHUFFLE( 2, 3, 0, 1 ) ); }
+    static inline vec swap( vec v, lanes_distance< 2 > ){ return _mm_shuffle_epi32( v, _MM_SHUFFLE( 1, 0, 3, 2 ) ); }
+};
+
+struct int64_traits
+{
+    typedef __m128i vec;
+    typedef int64_alias scalar;
+    static const int lanes = 2;
+
+    static inline vec load( const scalar* p ){ return _mm_loadu_si128( ( const __m128i* )p ); }
+    static inline void store( scalar* p, vec v ){ _mm_storeu_si128( ( __m128i* )p, v ); }
+    static inline vec min( vec a, vec b ){ return _mm_blendv_epi8( a, b, _mm_cmpgt_epi64( a, b ) ); }
+    static inline vec max( vec a, vec b ){ return _mm_blendv_epi8( b, a, _mm_cmpgt_epi64( a, b ) ); }
+    static inline vec select( vec mask, vec a, vec b ){ return _mm_blendv_epi8( b, a, mask ); }
+    static inline vec reverse( vec v ){ return _mm_shuffle_epi32( v, _MM_SHUFFLE( 1, 0, 3, 2 ) ); }
+
+    static inline vec swap( vec v, lanes_distance< 1 > ){ return reverse( v ); }
+};
+
+#include "simd_sort_kernel.inl"
+
+} // sse42
+
+#if defined( __clang__ )
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+enum class level
+{
+    none,
+    sse42,
+    avx2
+};
+
+// Best instruction set the kernel can use on this cpu
+inline level supported_level()
+{
+    static const level result = __builtin_cpu_supports( "avx2" ) ? level::avx2 :
+                                __builtin_cpu_supports( "sse4.2" ) ? level::sse42 : level::none;
+    return result;
+}
+
+// Maps T onto signed integers of its size keeping the order and back again:
+// unsigned ones get the sign bit flipped, negative floats get the other bits
+// flipped. Both mappings are their own inverses
+template< typename S, typename T >
+void to_signed_order( T* first, T* last, std::true_type /*integral*/ )
+{
+    if( std::is_signed< T >::value ){
+        return;
+    }
+
+    const S sign = std::numeric_limits< S >::min();
+    for( S* v = ( S* )first; v != ( S* )last; ++v ){
+        *v ^= sign;
+    }
+}
+
+template< typename S, typename T >
+void to_signed_order( T* first, T* last, std::false_type /*integral*/ )
+{
+    const int bits = sizeof( S ) * 8;
+    for( S* v = ( S* )first; v != ( S* )last; ++v ){
+        *v ^= ( *v >> ( bits - 1 ) ) & std::numeric_limits< S >::max();
+    }
+}
+
+inline void run( int32_alias* data, size_t size, int32_alias* scratch, level l )
+{
+    if( l == level::avx2 ){
+        avx2::sort< avx2::int32_traits >( data, size, scratch );
+    }
+    else{
+        sse42::sort< sse42::int32_traits >( data, size, scratch );
+    }
+}
+
+inline void run( int64_alias* data, size_t size, int64_alias* scratch, level l )
+{
+    if( l == level::avx2 ){
+        avx2::sort< avx2::int64_traits >( data, size, scratch );
+    }
+    else{
+        sse42::sort< sse42::int64_traits >( data, size, scratch );
+    }
+}
+
+template< typename T >
+void sort( T* first, T* last, T* scratch, level l )
+{
+    typedef typename alias_of< sizeof( T ) >::type scalar;
+
+    std::vector< T > own_scratch;
+    if( !scratch )
+    {
+        own_scratch.resize( last - first );
+        scratch = own_scratch.data();
+    }
+
+    to_signed_order< scalar >( first, last, std::is_integral< T >() );
+
+    run( ( scalar* )first, last - first, ( scalar* )scratch, l );
+
+    to_signed_order< scalar >( first, last, std::is_integral< T >() );
+}
+
+} // simd
+
+#endif // EXTERNAL_SORT_SIMD
+
+template< typename T >
+void simd_sort( T* first, T* last, T* scratch, std::true_type /*sortable*/ )
+{
+#ifdef EXTERNAL_SORT_SIMD
+    simd::level l = simd::supported_level();
+    if( l != simd::level::none )
+    {
+        simd::sort( first, last, scratch, l );
+        return;
+    }
+#else
+    ( void )scratch;
+#endif
+
+    std::sort( first, last );
+}
+
+template< typename T >
+void simd_sort( T* first, T* last, T* /*scratch*/, std::false_type /*sortable*/ )
+{
+    std::sort( first, last );
+}
+
+} // sorting_details
+
+namespace sorting
+{
+
+// Vectorized merge sort for 32 and 64 bit integers and floats: every vector
+// is sorted by a bitonic network, then sorted runs are merged a vector at a
+// time by a bitonic merge network. Uses AVX2 or SSE4.2, whichever the cpu has,
+// falls back to std::sort for other types and cpus.
+// scratch, when given, should be able to hold last - first items
+template< typename T >
+void simd_sort( T* first, T* last, T* scratch = nullptr )
+{
+    sorting_details::simd_sort( first, last, scratch, sorting_details::simd_sortable< T >() );
+}
+
+} // sorting
+
+} // external_sort
+
+#endif
@@ -0,0 +1,164 @@
+// Vectorized merge sort built on sorting networks, written in terms of
+// a vector traits class V:
+//
+//   vec, scalar, lanes
+//   load( const scalar* ), store( scalar*, vec )
+//   min( vec, vec ), max( vec, vec )
+//   swap( vec, lanes_distance< D > ) - exchanges lanes i and i ^ D
+//   reverse( vec )
+//   select( mask, a, b ) - a in lanes where mask is set, b elsewhere
+//
+// No include guards on purpose: simd_sort.hpp includes this file once per
+// instruction set, inside a namespace and a target pragma of its own
+
+// One compare-exchange step of a bitonic network: lanes D apart are compared,
+// blocks of K lanes are sorted ascending or descending in turns
+template< class V, int D, int K >
+inline typename V::vec bitonic_step( typename V::vec v )
+{
+    typename V::scalar mask[ V::lanes ];
+    for( int lane = 0; lane < V::lanes; ++lane ){
+        mask[ lane ] = ( ( lane & D ) != 0 ) != ( ( lane & K ) != 0 ) ? -1 : 0;
+    }
+
+    typename V::vec partner = V::swap( v, lanes_distance< D >() );
+    return V::select( V::load( mask ), V::max( v, partner ), V::min( v, partner ) );
+}
+
+// Steps D, D / 2 ... 1 of a bitonic network with blocks of K lanes
+template< class V, int D, int K >
+struct bitonic_steps
+{
+    static typename V::vec apply( typename V::vec v ){
+        return bitonic_steps< V, D / 2, K >::apply( bitonic_step< V, D, K >( v ) );
+    }
+};
+
+template< class V, int K >
+struct bitonic_steps< V, 0, K >
+{
+    static typename V::vec apply( typename V::vec v ){
+        return v;
+    }
+};
+
+// Bitonic sort of the lanes of a vector, stages for blocks of K, 2K ... lanes
+template< class V, int K, bool Done = ( K > V::lanes ) >
+struct bitonic_sort
+{
+    static typename V::vec apply( typename V::vec v ){
+        return bitonic_sort< V, K * 2 >::apply( bitonic_steps< V, K / 2, K >::apply( v ) );
+    }
+};
+
+template< class V, int K >
+struct bitonic_sort< V, K, true >
+{
+    static typename V::vec apply( typename V::vec v ){
+        return v;
+    }
+};
+
+// Merges two sorted vectors: lo gets the smallest lanes, hi the largest ones
+template< class V >
+inline void bitonic_merge( typename V::vec a, typename V::vec b, typename V::vec& lo, typename V::vec& hi )
+{
+    b = V::reverse( b );
+    lo = bitonic_steps< V, V::lanes / 2, V::lanes >::apply( V::min( a, b ) );
+    hi = bitonic_steps< V, V::lanes / 2, V::lanes >::apply( V::max( a, b ) );
+}
+
+// Merges sorted [ a, a + a_size ) and [ b, b + b_size ) into out,
+// sizes should be multiples of V::lanes
+template< class V >
+void merge_runs( const typename V::scalar* a,
+                 size_t a_size,
+                 const typename V::scalar* b,
+                 size_t b_size,
+                 typename V::scalar* out )
+{
+    if( !a_size || !b_size )
+    {
+        std::copy( a, a + a_size, out );
+        std::copy( b, b + b_size, out + a_size );
+        return;
+    }
+
+    const typename V::scalar* a_end = a + a_size;
+    const typename V::scalar* b_end = b + b_size;
+
+    typename V::vec hi = V::load( a );
+    typename V::vec next = V::load( b );
+    a += V::lanes;
+    b += V::lanes;
+
+    while( true )
+    {
+        typename V::vec lo;
+        bitonic_merge< V >( hi, next, lo, hi );
+        V::store( out, lo );
+        out += V::lanes;
+
+        // the run with the smaller head goes next
+        if( a != a_end && ( b == b_end || *a <= *b ) )
+        {
+            next = V::load( a );
+            a += V::lanes;
+        }
+        else if( b != b_end )
+        {
+            next = V::load( b );
+            b += V::lanes;
+        }
+        else{
+            break;
+        }
+    }
+
+    V::store( out, hi );
+}
+
+// Sorts [ data, data + size ), scratch should be able to hold size items
+template< class V >
+void sort( typename V::scalar* data, size_t size, typename V::scalar* scratch )
+{
+    typedef typename V::scalar scalar;
+    size_t vectors_size = size - size % V::lanes;
+
+    // runs of a vector each
+    for( size_t pos = 0; pos < vectors_size; pos += V::lanes ){
+        V::store( data + pos, bitonic_sort< V, 2 >::apply( V::load( data + pos ) ) );
+    }
+
+    scalar* src = data;
+    scalar* dst = scratch;
+
+    for( size_t width = V::lanes; width < vectors_size; width *= 2 )
+    {
+        for( size_t pos = 0; pos < vectors_size; pos += 2 * width )
+        {
+            size_t a_size = std::min( width, vectors_size - pos );
+            size_t b_size = std::min( width, vectors_size - pos - a_size );
+            merge_runs< V >( src + pos, a_size, src + pos + a_size, b_size, dst + pos );
+        }
+
+        std::swap( src, dst );
+    }
+
+    // the few items that don't fill a vector are merged in the scalar way,
+    // from next to the vector ones, so the output never overlaps the input
+    if( vectors_size != size )
+    {
+        std::sort( data + vectors_size, data + size );
+        if( src != data ){
+            std::copy( data + vectors_size, data + size, src + vectors_size );
+        }
+
+        std::merge( src, src + vectors_size, src + vectors_size, src + size, dst );
+        std::swap( src, dst );
+    }
+
+    if( src != data ){
+        std::copy( src, src + size, data );
+    }
+}
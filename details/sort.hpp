@@ -0,0 +1,190 @@
+#ifndef SORT_HPP
+#define SORT_HPP
+
+#include <algorithm>
+#include <type_traits>
+
+#include "key_traits.hpp"
+#include "radix_sort.hpp"
+#include "indirect_sort.hpp"
+
+namespace external_sort
+{
+
+namespace sorting_details
+{
+
+// Chunks of up to that many ascending runs are merged instead of sorted
+const size_t max_natural_runs = 16;
+
+// Sorts a chunk that is sorted already, reversed or a few ascending runs
+// in linear time or close to it, false if it's none of those. Gives up
+// as soon as it's clear, so random chunks cost just a few comparisons.
+// Runs are merged in place, it takes no memory beyond the chunk
+template< typename T >
+bool sort_presorted( T* first, T* last );
+
+// Merges the sorted [ first, middle ) and [ middle, last ) in place, stable,
+// by rotations around binary searched cuts rather than through a buffer
+template< typename T >
+void merge_in_place( T* first, T* middle, T* last );
+
+template< typename T >
+void sort( T* first, T* last, std::true_type /*has keys*/ )
+{
+    sorting::radix_sort( first, last );
+}
+
+template< typename T >
+void sort( T* first, T* last, std::false_type /*has keys*/ )
+{
+    std::sort( first, last );
+}
+
+template< typename T >
+void sort_by_prefix( T* first, T* last, std::true_type /*has key prefixes*/ )
+{
+    sorting::indirect_sort( first, last );
+}
+
+template< typename T >
+void sort_by_prefix( T* first, T* last, std::false_type /*has key prefixes*/ )
+{
+    sort( first, last, std::integral_constant< bool, has_key_traits< T >::value >() );
+}
+
+template< typename T >
+bool sort_presorted( T* first, T* last )
+{
+    size_t size = static_cast< size_t >( last - first );
+    if( size < 2 ){
+        return true;
+    }
+
+    // descending all the way, equal items may swap places as they would when sorted
+    if( first[ 1 ] < first[ 0 ] )
+    {
+        size_t i = 2;
+        while( i < size && !( first[ i - 1 ] < first[ i ] ) ){
+            ++i;
+        }
+
+        if( i == size )
+        {
+            std::reverse( first, last );
+            return true;
+        }
+    }
+
+    // ends of the ascending runs
+    size_t ends[ max_natural_runs ];
+    size_t runs = 0;
+
+    for( size_t i = 1; i < size; ++i )
+    {
+        if( first[ i ] < first[ i - 1 ] )
+        {
+            if( runs == max_natural_runs - 1 ){
+                return false;
+            }
+
+            ends[ runs++ ] = i;
+        }
+    }
+
+    ends[ runs++ ] = size;
+
+    // neighbouring runs are merged pairwise until one is left
+    while( runs > 1 )
+    {
+        size_t merged = 0;
+        for( size_t run = 0; run < runs; run += 2 )
+        {
+            if( run + 1 < runs )
+            {
+                size_t begin = run ? ends[ run - 1 ] : 0;
+                merge_in_place( first + begin, first + ends[ run ], first + ends[ run + 1 ] );
+                ends[ merged++ ] = ends[ run + 1 ];
+            }
+            else{
+                ends[ merged++ ] = ends[ run ];
+            }
+        }
+
+        runs = merged;
+    }
+
+    return true;
+}
+
+template< typename T >
+void merge_in_place( T* first, T* middle, T* last )
+{
+    // nothing to do once the halves don't overlap
+    while( first != middle && middle != last && *middle < *( middle - 1 ) )
+    {
+        size_t left = static_cast< size_t >( middle - first );
+        size_t right = static_cast< size_t >( last - middle );
+        if( left + right == 2 )
+        {
+            std::iter_swap( first, middle );
+            return;
+        }
+
+        // the longer half is cut in the middle, the other one where its items go
+        T* left_cut;
+        T* right_cut;
+        if( left > right )
+        {
+            left_cut = first + left / 2;
+            right_cut = std::lower_bound( middle, last, *left_cut );
+        }
+        else
+        {
+            right_cut = middle + right / 2;
+            left_cut = std::upper_bound( first, middle, *right_cut );
+        }
+
+        T* cut = std::rotate( left_cut, middle, right_cut );
+
+        // the smaller side is merged by recursion, the larger one by the loop,
+        // so the stack stays logarithmic
+        if( cut - first < last - cut )
+        {
+            merge_in_place( first, left_cut, cut );
+            first = cut;
+            middle = right_cut;
+        }
+        else
+        {
+            merge_in_place( cut, right_cut, last );
+            middle = left_cut;
+            last = cut;
+        }
+    }
+}
+
+} // sorting_details
+
+namespace sorting
+{
+
+// The in-memory sort chunks go through. Presorted chunks are only checked,
+// reversed or have their runs merged, the rest are sorted by the sort
+// picked at compile time: indirect sort for types with key_prefix_traits,
+// radix sort for types with key_traits, std::sort for the rest
+template< typename T >
+void sort( T* first, T* last )
+{
+    if( sorting_details::sort_presorted( first, last ) ){
+        return;
+    }
+
+    sorting_details::sort_by_prefix( first, last, std::integral_constant< bool, has_key_prefix_traits< T >::value >() );
+}
+
+} // sorting
+
+} // external_sort
+
+#endif
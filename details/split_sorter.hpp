@@ -2,27 +2,106 @@
 #define PARTIAL_SORTER_HPP
 
 #include <algorithm>
+#include <functional>
 #include <iostream>
 #include <list>
 
 #include "file_chunk_reader.hpp"
+#include "file_writer.hpp"
+#include "parallel_sort.hpp"
+#include "sort.hpp"
+#include "reducer.hpp"
+#include "stream.hpp"
 #include "async.hpp"
 #include "common.hpp"
+#include "options.hpp"
 
 namespace external_sort
 {
 
+namespace split
+{
+
+// Called with the path of every run once it's on disk
+using run_callback = std::function< void( const std::string& ) >;
+
+} //split
+
 namespace split_details
 {
 
-// A single task run concurrently.
-// Just read a chunk of input file, sorts it and writes back to disc
+using split::run_callback;
+
+// A split task along with the writer its sorted chunk is handed to
+template< class T >
+struct split_task
+{
+    explicit split_task( memory::buffer_pool< T >& pool ) : writer( &pool ){}
 
+    concurrency::Task task;
+    file::file_writer< T > writer;
+    std::string file_name;
+};
+
+template< class T >
+using split_tasks = std::list< split_task< T > >;
+
+// A single task run concurrently.
+// Just read a chunk of input file, sorts and reduces it and writes back to disc.
+// Every task reads its own range of the input, so the reads of all threads
+// are in flight at once. In write-behind mode the chunk is written by
+// the writer's own thread so the task is done as soon as the chunk is sorted
+template< class T >
+void run( const std::string& file_path,
+          const file::item_range& range,
+          file::io_mode read_mode,
+          const merge::reducer< T >& reduce,
+          memory::buffer_pool< T >& pool,
+          const std::string& file_name,
+          file::file_writer< T >& writer,
+          bool write_behind,
+          file::io_mode mode,
+          bool compressed );
+
+// The part of a task after the chunk is read, it's given up to the writer
 template< class T >
-void run( std::vector< T > data, const std::string& file_name );
+void sort_and_write( memory::buffer< T >& data,
+                     const merge::reducer< T >& reduce,
+                     const std::string& file_name,
+                     file::file_writer< T >& writer,
+                     bool write_behind,
+                     file::io_mode mode,
+                     bool compressed );
+
+// Remove finished tasks to free memory. Chunks that are still being
+// written are only waited for if there are more than max_writing of them
+template< class T >
+void clearFinishedTasks( split_tasks< T >& tasks, size_t max_writing, const run_callback& on_run, bool waitForRunning = false );
 
-// Remove finished tasks to free memory
-void clearFinishedTasks( std::list< concurrency::Task >& tasks, bool waitForRunning = false );
+// Split mode where chunks are read one by one and each of them is sorted by all threads
+template< class T >
+size_t split_parallel_sort( const std::string& file_path,
+                            const std::string& work_folder,
+                            size_t avail_mem,
+                            size_t threads_num,
+                            const options& opts,
+                            const merge::reducer< T >& reduce,
+                            memory::buffer_pool< T >& pool,
+                            const run_callback& on_run );
+
+// Split mode where runs are generated by replacement selection
+template< class T >
+size_t split_replacement_selection( const std::string& file_path,
+                                    const std::string& work_folder,
+                                    size_t avail_mem,
+                                    const options& opts,
+                                    const merge::reducer< T >& reduce,
+                                    memory::buffer_pool< T >& pool,
+                                    const run_callback& on_run );
+
+// Restores the min-heap [ heap, heap + size ) after heap[ hole ] was replaced
+template< class T >
+void sift_down( T* heap, size_t size, size_t hole );
 
 } //split_details
 
@@ -31,10 +110,28 @@ namespace split
 {
 
 template< typename T >
-size_t split( const std::string& file_path, const std::string& work_folder, size_t avail_mem, size_t threads_num )
+size_t split( const std::string& file_path,
+              const std::string& work_folder,
+              size_t avail_mem,
+              size_t threads_num,
+              const options& opts,
+              const merge::reducer< T >& reduce,
+              memory::buffer_pool< T >& pool,
+              const run_callback& on_run = run_callback() )
 {
-    // calc block size( number of items to read at once )
-    size_t block_size = avail_mem / ( threads_num * sizeof( T ) );
+    if( opts.replacement_selection ){
+        return split_details::split_replacement_selection( file_path, work_folder, avail_mem, opts, reduce, pool, on_run );
+    }
+
+    if( opts.parallel_chunk_sort ){
+        return split_details::split_parallel_sort( file_path, work_folder, avail_mem, threads_num, opts, reduce, pool, on_run );
+    }
+
+    // calc block size( number of items to read at once ),
+    // chunks being written in the background take memory too
+    bool write_behind = opts.write_buffers > 1;
+    size_t chunks_in_memory = write_behind ? 2 * threads_num : threads_num;
+    size_t block_size = avail_mem / ( chunks_in_memory * sizeof( T ) );
 
     if( block_size < sizeof( T ) ){
         throw std::runtime_error( "Not enough memory to process the specified type with current settings" );
@@ -42,38 +139,137 @@ size_t split( const std::string& file_path, const std::string& work_folder, size
 
     block_size -= block_size % sizeof( T );
 
+    // the input is only checked and measured here, tasks read their chunks themselves
+    file::io_mode read_mode = opts.mmap ? file::io_mode::mapped : file::io_mode::buffered;
     file::file_chunk_reader< T > reader;
-    reader.open( file_path, block_size);
+    reader.open( file_path, block_size );
+    size_t items = reader.left();
+    reader.close();
 
     concurrency::async async( threads_num );
-    std::list< concurrency::Task > tasks;
+    split_details::split_tasks< T > tasks;
 
     size_t total_started = 0;
 
     // loop starting the workers
-    while( !reader.completed() )
+    for( size_t first = 0; first < items; first += block_size )
     {
         // don't get new chunks until the prev ones are processed!
-        async.wait_for_first_vacant();
+        {
+            statistics_details::stall_timer stall( &pool.counters(), statistics_details::stall::vacancy );
+            async.wait_for_first_vacant();
+        }
 
         // remove the finished tasks to provide memory for new chunks
-        split_details::clearFinishedTasks( tasks );
+        split_details::clearFinishedTasks( tasks, threads_num, on_run );
 
-        auto data = reader.get_next_chunk();
-        if( data.empty() ){
-            break;
+        file::item_range range{ first, std::min( first + block_size, items ) };
+        std::string file_name = common::temp_file_path( work_folder, ++total_started );
+
+        tasks.emplace_back( pool );
+        split_details::split_task< T >& curr = tasks.back();
+        curr.file_name = file_name;
+
+        auto sort_func = std::bind( &split_details::run< T >,
+                                    file_path,
+                                    range,
+                                    read_mode,
+                                    std::cref( reduce ),
+                                    std::ref( pool ),
+                                    file_name,
+                                    std::ref( curr.writer ),
+                                    write_behind,
+                                    file::temp_io( opts.direct_io ),
+                                    opts.compress_runs );
+
+        curr.task.task = std::move( std::packaged_task< void() >{ sort_func } );
+        curr.task.result = std::move( async.run( curr.task.task ) );
+    }
+
+    split_details::clearFinishedTasks( tasks, threads_num, on_run, true );
+
+    return total_started;
+}
+
+// Split of items pulled from a producer rather than read from a file.
+// Chunks are filled by the calling thread and sorted by tasks as usual,
+// the one being filled takes memory on top of theirs
+template< typename T >
+size_t split_stream( const stream::producer< T >& producer,
+                     const std::string& work_folder,
+                     size_t avail_mem,
+                     size_t threads_num,
+                     const options& opts,
+                     const merge::reducer< T >& reduce,
+                     memory::buffer_pool< T >& pool,
+                     const run_callback& on_run = run_callback() )
+{
+    bool write_behind = opts.write_buffers > 1;
+    size_t chunks_in_memory = ( write_behind ? 2 * threads_num : threads_num ) + 1;
+    size_t block_size = avail_mem / ( chunks_in_memory * sizeof( T ) );
+
+    if( block_size < sizeof( T ) ){
+        throw std::runtime_error( "Not enough memory to process the specified type with current settings" );
+    }
+
+    block_size -= block_size % sizeof( T );
+
+    concurrency::async async( threads_num );
+    split_details::split_tasks< T > tasks;
+
+    size_t total_started = 0;
+    bool input_over = false;
+
+    while( !input_over )
+    {
+        memory::buffer< T > data = pool.acquire( block_size );
+        data.resize( block_size );
+
+        size_t filled = 0;
+        while( filled < block_size )
+        {
+            size_t produced = producer( data.data() + filled, block_size - filled );
+            if( !produced )
+            {
+                input_over = true;
+                break;
+            }
+
+            filled += std::min( produced, block_size - filled );
         }
 
-        std::string file_name = common::temp_file_path( work_folder, ++total_started );
-        auto sort_func = std::bind( &split_details::run< T >, std::move( data ), file_name );
+        data.resize( filled );
+        if( data.empty() )
+        {
+            pool.release( std::move( data ) );
+            break;
+        }
 
-		tasks.emplace_back();
-        concurrency::Task& curr = tasks.back();
-        curr.task = std::move( std::packaged_task< void() >{ sort_func } );
-        curr.result = std::move( async.run( curr.task ) );
+        // don't start new chunks until the prev ones are processed!
+        {
+            statistics_details::stall_timer stall( &pool.counters(), statistics_details::stall::vacancy );
+            async.wait_for_first_vacant();
+        }
+        split_details::clearFinishedTasks( tasks, threads_num, on_run );
+
+        tasks.emplace_back( pool );
+        split_details::split_task< T >& curr = tasks.back();
+        curr.file_name = common::temp_file_path( work_folder, ++total_started );
+
+        auto sort_func = std::bind( &split_details::sort_and_write< T >,
+                                    std::move( data ),
+                                    std::cref( reduce ),
+                                    curr.file_name,
+                                    std::ref( curr.writer ),
+                                    write_behind,
+                                    file::temp_io( opts.direct_io ),
+                                    opts.compress_runs );
+
+        curr.task.task = std::move( std::packaged_task< void() >{ std::move( sort_func ) } );
+        curr.task.result = std::move( async.run( curr.task.task ) );
     }
 
-    split_details::clearFinishedTasks( tasks, true );
+    split_details::clearFinishedTasks( tasks, threads_num, on_run, true );
 
     return total_started;
 }
@@ -84,31 +280,316 @@ namespace split_details
 {
 
 template< class T >
-void run( std::vector< T > data, const std::string& file_name )
+void run( const std::string& file_path,
+          const file::item_range& range,
+          file::io_mode read_mode,
+          const merge::reducer< T >& reduce,
+          memory::buffer_pool< T >& pool,
+          const std::string& file_name,
+          file::file_writer< T >& writer,
+          bool write_behind,
+          file::io_mode mode,
+          bool compressed )
 {
-    std::sort( data.begin(), data.end() );
+    file::file_chunk_reader< T > reader( &pool, read_mode );
+    reader.open( file_path, range.second - range.first, false, range );
+    auto data = reader.get_next_chunk();
+    reader.close();
 
-    std::ofstream out( file_name, std::ios::out | std::ofstream::binary );
-    if( !out.good() ){
-        throw std::runtime_error( "Coundn't write to file: " + file_name );
-    }
+    sort_and_write( data, reduce, file_name, writer, write_behind, mode, compressed );
+}
 
-    out.write((char*)&data[0], data.size() * sizeof( T ));
-    out.close();
+template< class T >
+void sort_and_write( memory::buffer< T >& data,
+                     const merge::reducer< T >& reduce,
+                     const std::string& file_name,
+                     file::file_writer< T >& writer,
+                     bool write_behind,
+                     file::io_mode mode,
+                     bool compressed )
+{
+    // items past the limit don't need sorting
+    data.resize( reduce.select( data.data(), data.data() + data.size() ) - data.data() );
+    sorting::sort( data.data(), data.data() + data.size() );
+    data.resize( reduce.reduce( data.data(), data.data() + data.size() ) - data.data() );
+
+    writer.open( file_name, write_behind ? 2 : 1, mode, compressed );
+    writer.write( std::move( data ) );
 }
 
-void clearFinishedTasks( std::list< concurrency::Task >& tasks, bool waitForRunning )
+template< class T >
+void clearFinishedTasks( split_tasks< T >& tasks, size_t max_writing, const run_callback& on_run, bool waitForRunning )
 {
-    tasks.remove_if([ waitForRunning ]( concurrency::Task& t )
+    auto close = [ &on_run ]( split_task< T >& t )
+    {
+        t.writer.close();
+        if( on_run ){
+            on_run( t.file_name );
+        }
+    };
+
+    // a task with an already consumed future has sorted its chunk but is still writing it
+    tasks.remove_if([ waitForRunning, &close ]( split_task< T >& t )
     {
-        if( t.result.wait_for(std::chrono::seconds(0)) == std::future_status::ready || waitForRunning )
+        if( t.task.result.valid() )
         {
-            t.result.get(); // rethrow
-            return true;
+            if( t.task.result.wait_for(std::chrono::seconds(0)) != std::future_status::ready && !waitForRunning ){
+                return false;
+            }
+
+            t.task.result.get(); // rethrow
+        }
+
+        if( !waitForRunning && !t.writer.flushed() ){
+            return false;
         }
 
-        return false;
+        close( t );
+        return true;
     });
+
+    size_t writing = std::count_if( tasks.begin(), tasks.end(),
+                                    []( split_task< T >& t ){ return !t.task.result.valid(); } );
+
+    // too many chunks are waiting for the disk, block on the oldest ones
+    for( auto t = tasks.begin(); t != tasks.end() && writing > max_writing; )
+    {
+        if( !t->task.result.valid() )
+        {
+            close( *t );
+            t = tasks.erase( t );
+            --writing;
+        }
+        else{
+            ++t;
+        }
+    }
+}
+
+template< class T >
+size_t split_parallel_sort( const std::string& file_path,
+                            const std::string& work_folder,
+                            size_t avail_mem,
+                            size_t threads_num,
+                            const options& opts,
+                            const merge::reducer< T >& reduce,
+                            memory::buffer_pool< T >& pool,
+                            const run_callback& on_run )
+{
+    // the chunk being sorted and its scratch buffer, plus possibly
+    // the next chunk being prefetched and the previous one being written
+    bool write_behind = opts.write_buffers > 1;
+    size_t chunks_in_memory = 2 + ( opts.prefetch ? 1 : 0 ) + ( write_behind ? 1 : 0 );
+    size_t block_size = avail_mem / ( chunks_in_memory * sizeof( T ) );
+
+    if( block_size < sizeof( T ) ){
+        throw std::runtime_error( "Not enough memory to process the specified type with current settings" );
+    }
+
+    block_size -= block_size % sizeof( T );
+
+    file::file_chunk_reader< T > reader( &pool, opts.mmap ? file::io_mode::mapped : file::io_mode::buffered );
+    reader.open( file_path, block_size, opts.prefetch );
+
+    concurrency::async async( threads_num );
+
+    // writers take turns so a chunk is written while the next one is sorted
+    std::vector< file::file_writer< T > > writers;
+    writers.emplace_back( &pool );
+    writers.emplace_back( &pool );
+    std::vector< std::string > written( 2 );
+
+    auto close = [ & ]( size_t writer )
+    {
+        writers[ writer ].close();
+        if( on_run && !written[ writer ].empty() ){
+            on_run( written[ writer ] );
+        }
+
+        written[ writer ].clear();
+    };
+
+    size_t total_started = 0;
+
+    while( !reader.completed() )
+    {
+        auto data = reader.get_next_chunk();
+        if( data.empty() )
+        {
+            pool.release( std::move( data ) );
+            break;
+        }
+
+        // the chunk before the previous one has to be on disk to free its memory
+        size_t writer = total_started % 2;
+        close( writer );
+
+        data.resize( reduce.select( data.data(), data.data() + data.size() ) - data.data() );
+        sorting::parallel_sort( data, async, threads_num, pool );
+        data.resize( reduce.reduce( data.data(), data.data() + data.size() ) - data.data() );
+
+        written[ writer ] = common::temp_file_path( work_folder, ++total_started );
+        writers[ writer ].open( written[ writer ], write_behind ? 2 : 1, file::temp_io( opts.direct_io ), opts.compress_runs );
+        writers[ writer ].write( std::move( data ) );
+    }
+
+    // the older chunk first
+    close( total_started % 2 );
+    close( ( total_started + 1 ) % 2 );
+
+    return total_started;
+}
+
+template< class T >
+size_t split_replacement_selection( const std::string& file_path,
+                                    const std::string& work_folder,
+                                    size_t avail_mem,
+                                    const options& opts,
+                                    const merge::reducer< T >& reduce,
+                                    memory::buffer_pool< T >& pool,
+                                    const run_callback& on_run )
+{
+    // the heap takes most of the memory, the rest is split between
+    // input blocks ( two if prefetched ) and output buffers
+    size_t io_buffers = ( opts.prefetch ? 2 : 1 ) + std::max< size_t >( opts.write_buffers, 1 );
+    size_t block_size = avail_mem / ( ( 8 + io_buffers ) * sizeof( T ) );
+
+    if( block_size < sizeof( T ) ){
+        throw std::runtime_error( "Not enough memory to process the specified type with current settings" );
+    }
+
+    block_size -= block_size % sizeof( T );
+    size_t heap_capacity = avail_mem / sizeof( T ) - io_buffers * block_size;
+
+    file::file_chunk_reader< T > reader( &pool, opts.mmap ? file::io_mode::mapped : file::io_mode::buffered );
+    reader.open( file_path, block_size, opts.prefetch );
+
+    memory::buffer< T > in;
+    size_t in_pos = 0;
+
+    auto next_input = [ & ]( T& v )
+    {
+        while( in_pos == in.size() )
+        {
+            if( reader.completed() ){
+                return false;
+            }
+
+            pool.release( std::move( in ) );
+            in = reader.get_next_chunk();
+            in_pos = 0;
+        }
+
+        v = std::move( in[ in_pos++ ] );
+        return true;
+    };
+
+    memory::buffer< T > heap = pool.acquire( heap_capacity );
+    T v;
+    while( heap.size() < heap_capacity && next_input( v ) ){
+        heap.push_back( std::move( v ) );
+    }
+
+    auto greater = []( const T& l, const T& r ){ return r < l; };
+
+    // items of the current run are the heap [ 0, live ),
+    // the ones that have to wait for the next run follow it up to size
+    size_t size = heap.size();
+    size_t live = size;
+    std::make_heap( heap.data(), heap.data() + size, greater );
+
+    file::file_writer< T > writer( &pool );
+    memory::buffer< T > out = pool.acquire( block_size );
+    size_t runs = 0;
+
+    while( size )
+    {
+        std::string file_name = common::temp_file_path( work_folder, ++runs );
+        writer.open( file_name, opts.write_buffers, file::temp_io( opts.direct_io ), opts.compress_runs );
+        size_t run_size = 0;
+
+        while( live )
+        {
+            // past the limit the run goes on without being written, its last item written
+            // still tells the items of the run from the ones waiting for the next one
+            if( run_size < reduce.limit() && reduce.push( out, block_size, heap[ 0 ], writer ) ){
+                ++run_size;
+            }
+
+            const T& last = out.back();
+
+            if( next_input( v ) )
+            {
+                if( !( v < last ) ){
+                    heap[ 0 ] = std::move( v );
+                }
+                else
+                {
+                    // too small for this run, it takes the place the heap gives up
+                    if( --live ){
+                        heap[ 0 ] = std::move( heap[ live ] );
+                    }
+
+                    heap[ live ] = std::move( v );
+                }
+            }
+            else
+            {
+                // input is over, the heap shrinks along with the items waiting
+                --size;
+                if( --live ){
+                    heap[ 0 ] = std::move( heap[ live ] );
+                }
+
+                if( live != size ){
+                    heap[ live ] = std::move( heap[ size ] );
+                }
+            }
+
+            sift_down( heap.data(), live, 0 );
+        }
+
+        writer.write( out );
+        writer.close();
+
+        if( on_run ){
+            on_run( file_name );
+        }
+
+        live = size;
+        std::make_heap( heap.data(), heap.data() + size, greater );
+    }
+
+    pool.release( std::move( in ) );
+    pool.release( std::move( heap ) );
+    pool.release( std::move( out ) );
+
+    return runs;
+}
+
+template< class T >
+void sift_down( T* heap, size_t size, size_t hole )
+{
+    if( hole >= size ){
+        return;
+    }
+
+    T v = std::move( heap[ hole ] );
+    for( size_t child = 2 * hole + 1; child < size; child = 2 * hole + 1 )
+    {
+        if( child + 1 < size && heap[ child + 1 ] < heap[ child ] ){
+            ++child;
+        }
+
+        if( !( heap[ child ] < v ) ){
+            break;
+        }
+
+        heap[ hole ] = std::move( heap[ child ] );
+        hole = child;
+    }
+
+    heap[ hole ] = std::move( v );
 }
 
 } //split_details
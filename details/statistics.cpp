@@ -0,0 +1,60 @@
+#include "statistics.hpp"
+
+#if defined( _WIN32 )
+#define EXTERNAL_SORT_PROCESS_TIMES 1
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined( __unix__ ) || defined( __APPLE__ )
+#define EXTERNAL_SORT_CPU_CLOCK 1
+#include <time.h>
+#endif
+
+namespace external_sort
+{
+
+namespace statistics_details
+{
+
+#if defined( EXTERNAL_SORT_PROCESS_TIMES )
+
+double process_cpu_seconds()
+{
+    FILETIME creation, exit, kernel, user;
+    if( !GetProcessTimes( GetCurrentProcess(), &creation, &exit, &kernel, &user ) ){
+        return 0;
+    }
+
+    // in 100 ns ticks
+    auto ticks = []( const FILETIME& t ){
+        return ( static_cast< uint64_t >( t.dwHighDateTime ) << 32 ) | t.dwLowDateTime;
+    };
+
+    return ( ticks( kernel ) + ticks( user ) ) * 1e-7;
+}
+
+#elif defined( EXTERNAL_SORT_CPU_CLOCK )
+
+double process_cpu_seconds()
+{
+    timespec t;
+    if( clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &t ) ){
+        return 0;
+    }
+
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+#else
+
+double process_cpu_seconds()
+{
+    return 0;
+}
+
+#endif
+
+}// statistics_details
+
+}// external_sort
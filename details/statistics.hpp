@@ -0,0 +1,226 @@
+#ifndef STATISTICS_HPP
+#define STATISTICS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace external_sort
+{
+
+// Time a thread was stalled: waiting for chunks to be read, for buffers
+// to be written and, in split only, for a worker to take the next chunk
+struct thread_statistics
+{
+    std::thread::id thread;
+    double read_wait_seconds{ 0 };
+    double write_wait_seconds{ 0 };
+    double vacancy_wait_seconds{ 0 };
+};
+
+// What a phase of a sort took
+struct phase_statistics
+{
+    // wall clock time, and CPU time of the whole process summed over its threads,
+    // the one the OS reports: CLOCK_PROCESS_CPUTIME_ID or GetProcessTimes
+    double seconds{ 0 };
+    double cpu_seconds{ 0 };
+
+    // disk traffic of the items, compressed runs count as they're stored
+    size_t bytes_read{ 0 };
+    size_t bytes_written{ 0 };
+
+    // time threads were stalled, summed over them
+    double read_wait_seconds{ 0 };
+    double write_wait_seconds{ 0 };
+    double vacancy_wait_seconds{ 0 };
+
+    // the same by thread, for the threads that were stalled, in the order
+    // they first were. A thread id the OS reuses counts as the same thread
+    std::vector< thread_statistics > threads;
+};
+
+// What happened during a sort
+struct statistics
+{
+    // buffer_pool requests served by a recycled buffer / by a new allocation
+    size_t pool_hits{ 0 };
+    size_t pool_misses{ 0 };
+
+    // the most memory the pool held in buffers at once
+    size_t peak_memory{ 0 };
+
+    // sorted runs the split phase produced
+    size_t runs{ 0 };
+
+    // merges done, the final one included, and the items they wrote per item
+    // sorted. Every item going through every merge is one pass
+    size_t merges{ 0 };
+    double merge_passes{ 0 };
+
+    // with pipelined_merge split ends once its last run is written,
+    // merges running alongside it count toward split
+    phase_statistics split;
+    phase_statistics merge;
+};
+
+namespace statistics_details
+{
+
+enum class stall { read, write, vacancy };
+const size_t stall_kinds = 3;
+
+// Nanoseconds a thread was stalled, by the kind of stall
+struct thread_stalls
+{
+    std::thread::id thread;
+    uint64_t wait[ stall_kinds ];
+};
+
+// What the parts of a sort add up as they go. Updated a chunk at a time,
+// never per item
+struct counters
+{
+    std::atomic< uint64_t > bytes_read{ 0 };
+    std::atomic< uint64_t > bytes_written{ 0 };
+    std::atomic< uint64_t > merges{ 0 };
+    std::atomic< uint64_t > items_merged{ 0 };
+
+    // stalls are counted when they end, only by threads that have them
+    mutable std::mutex stalls_mutex;
+    std::vector< thread_stalls > stalls; // in the order threads were first stalled
+
+    void add_stall( stall kind, uint64_t nanoseconds );
+};
+
+// The counters at a point of a sort
+struct snapshot
+{
+    std::chrono::steady_clock::time_point wall;
+    double cpu;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t merges;
+    uint64_t items_merged;
+    std::vector< thread_stalls > stalls;
+};
+
+// CPU time of the process so far, in seconds, 0 if the OS doesn't tell
+double process_cpu_seconds();
+
+inline snapshot take( const counters& c );
+
+// What happened between two snapshots
+inline phase_statistics difference( const snapshot& from, const snapshot& to );
+
+// Adds the time from its construction to its destruction
+// to the stalls of the calling thread, if there are counters
+class stall_timer
+{
+public:
+    stall_timer( counters* c, stall kind );
+    stall_timer( const stall_timer& ) = delete;
+    stall_timer& operator=( const stall_timer& ) = delete;
+    ~stall_timer();
+
+private:
+    counters* m_counters;
+    stall m_kind;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+///// implementation
+
+inline void counters::add_stall( stall kind, uint64_t nanoseconds )
+{
+    std::thread::id id = std::this_thread::get_id();
+    std::lock_guard< std::mutex > l{ stalls_mutex };
+
+    auto t = std::find_if( stalls.begin(), stalls.end(), [ id ]( const thread_stalls& s ){ return s.thread == id; } );
+    if( t == stalls.end() )
+    {
+        stalls.push_back( thread_stalls{ id, { 0, 0, 0 } } );
+        t = stalls.end() - 1;
+    }
+
+    t->wait[ static_cast< size_t >( kind ) ] += nanoseconds;
+}
+
+inline snapshot take( const counters& c )
+{
+    snapshot s;
+    s.wall = std::chrono::steady_clock::now();
+    s.cpu = process_cpu_seconds();
+    s.bytes_read = c.bytes_read.load( std::memory_order_relaxed );
+    s.bytes_written = c.bytes_written.load( std::memory_order_relaxed );
+    s.merges = c.merges.load( std::memory_order_relaxed );
+    s.items_merged = c.items_merged.load( std::memory_order_relaxed );
+
+    std::lock_guard< std::mutex > l{ c.stalls_mutex };
+    s.stalls = c.stalls;
+    return s;
+}
+
+inline phase_statistics difference( const snapshot& from, const snapshot& to )
+{
+    const double ns = 1e-9;
+
+    phase_statistics result;
+    result.seconds = std::chrono::duration< double >( to.wall - from.wall ).count();
+    result.cpu_seconds = to.cpu - from.cpu;
+    result.bytes_read = static_cast< size_t >( to.bytes_read - from.bytes_read );
+    result.bytes_written = static_cast< size_t >( to.bytes_written - from.bytes_written );
+
+    // threads only ever get added, the ones of from are the first ones of to
+    for( size_t i = 0; i < to.stalls.size(); ++i )
+    {
+        uint64_t wait[ stall_kinds ];
+        for( size_t kind = 0; kind < stall_kinds; ++kind ){
+            wait[ kind ] = to.stalls[ i ].wait[ kind ] - ( i < from.stalls.size() ? from.stalls[ i ].wait[ kind ] : 0 );
+        }
+
+        if( !wait[ 0 ] && !wait[ 1 ] && !wait[ 2 ] ){
+            continue;
+        }
+
+        thread_statistics t;
+        t.thread = to.stalls[ i ].thread;
+        t.read_wait_seconds = wait[ static_cast< size_t >( stall::read ) ] * ns;
+        t.write_wait_seconds = wait[ static_cast< size_t >( stall::write ) ] * ns;
+        t.vacancy_wait_seconds = wait[ static_cast< size_t >( stall::vacancy ) ] * ns;
+        result.threads.push_back( t );
+
+        result.read_wait_seconds += t.read_wait_seconds;
+        result.write_wait_seconds += t.write_wait_seconds;
+        result.vacancy_wait_seconds += t.vacancy_wait_seconds;
+    }
+
+    return result;
+}
+
+inline stall_timer::stall_timer( counters* c, stall kind ) : m_counters( c ), m_kind( kind )
+{
+    if( m_counters ){
+        m_start = std::chrono::steady_clock::now();
+    }
+}
+
+inline stall_timer::~stall_timer()
+{
+    if( m_counters )
+    {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        m_counters->add_stall( m_kind, static_cast< uint64_t >( std::chrono::duration_cast< std::chrono::nanoseconds >( elapsed ).count() ) );
+    }
+}
+
+}// statistics_details
+
+}// external_sort
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef STREAM_HPP
+#define STREAM_HPP
+
+#include <cstddef>
+#include <functional>
+
+namespace external_sort
+{
+
+namespace stream
+{
+
+// Fills data with up to max_items next items of the input, returns
+// how many it has filled, 0 once the input is over
+template< typename T >
+using producer = std::function< size_t( T* data, size_t max_items ) >;
+
+// Takes the next items of the sorted output. Called by one thread at a time,
+// not necessarily the caller's, in the order of the items
+template< typename T >
+using consumer = std::function< void( const T* data, size_t items ) >;
+
+}// stream
+
+}// external_sort
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "noexcept_support.hpp"
+
+namespace external_sort
+{
+
+namespace concurrency
+{
+
+// A move-only callable run by the thread pool. Unlike std::function
+// it accepts move-only callables (e.g. a packaged_task) and keeps
+// the ones of up to four pointers inline, without allocating
+class task
+{
+public:
+    task() NOEXCEPT{}
+
+    template< typename F,
+              typename = typename std::enable_if< !std::is_same< typename std::decay< F >::type, task >::value >::type >
+    task( F&& f );
+
+    task( const task& ) = delete;
+    task& operator=( const task& ) = delete;
+
+    task( task&& other ) NOEXCEPT;
+    task& operator=( task&& other ) NOEXCEPT;
+
+    ~task();
+
+    void operator()();
+    explicit operator bool() const NOEXCEPT;
+
+private:
+    using storage = std::aligned_storage< 4 * sizeof( void* ), alignof( std::max_align_t ) >::type;
+
+    // the callable lives in the storage itself
+    template< typename F >
+    struct inline_ops
+    {
+        static void invoke( void* s ){
+            ( *static_cast< F* >( s ) )();
+        }
+
+        // moves the callable to another storage if there is one, then destroys it
+        static void manage( void* from, void* to )
+        {
+            F* f = static_cast< F* >( from );
+            if( to ){
+                ::new( to ) F( std::move( *f ) );
+            }
+
+            f->~F();
+        }
+    };
+
+    // the storage keeps a pointer to the callable on the heap
+    template< typename F >
+    struct heap_ops
+    {
+        static void invoke( void* s ){
+            ( **static_cast< F** >( s ) )();
+        }
+
+        static void manage( void* from, void* to )
+        {
+            F* f = *static_cast< F** >( from );
+            if( to ){
+                ::new( to ) F*( f );
+            }
+            else{
+                delete f;
+            }
+        }
+    };
+
+    template< typename F >
+    struct fits_inline : std::integral_constant< bool,
+                                                 sizeof( F ) <= sizeof( storage ) &&
+                                                 alignof( F ) <= alignof( storage ) &&
+                                                 std::is_nothrow_move_constructible< F >::value >{};
+
+    template< typename F, typename Arg >
+    void construct( Arg&& f, std::true_type );
+
+    template< typename F, typename Arg >
+    void construct( Arg&& f, std::false_type );
+
+    void move_to( task& other ) NOEXCEPT;
+    void reset() NOEXCEPT;
+
+private:
+    storage m_storage;
+    void ( *m_invoke )( void* ){ nullptr };
+    void ( *m_manage )( void*, void* ){ nullptr };
+};
+
+///// implementation
+
+template< typename F, typename >
+task::task( F&& f )
+{
+    using callable = typename std::decay< F >::type;
+    construct< callable >( std::forward< F >( f ), fits_inline< callable >{} );
+}
+
+template< typename F, typename Arg >
+void task::construct( Arg&& f, std::true_type )
+{
+    ::new( &m_storage ) F( std::forward< Arg >( f ) );
+    m_invoke = &inline_ops< F >::invoke;
+    m_manage = &inline_ops< F >::manage;
+}
+
+template< typename F, typename Arg >
+void task::construct( Arg&& f, std::false_type )
+{
+    ::new( &m_storage ) F*( new F( std::forward< Arg >( f ) ) );
+    m_invoke = &heap_ops< F >::invoke;
+    m_manage = &heap_ops< F >::manage;
+}
+
+inline task::task( task&& other ) NOEXCEPT
+{
+    other.move_to( *this );
+}
+
+inline task& task::operator=( task&& other ) NOEXCEPT
+{
+    if( this != &other )
+    {
+        reset();
+        other.move_to( *this );
+    }
+
+    return *this;
+}
+
+inline task::~task()
+{
+    reset();
+}
+
+inline void task::operator()()
+{
+    m_invoke( &m_storage );
+}
+
+inline task::operator bool() const NOEXCEPT
+{
+    return m_invoke != nullptr;
+}
+
+inline void task::move_to( task& other ) NOEXCEPT
+{
+    if( m_manage )
+    {
+        m_manage( &m_storage, &other.m_storage );
+        other.m_invoke = m_invoke;
+        other.m_manage = m_manage;
+        m_invoke = nullptr;
+        m_manage = nullptr;
+    }
+}
+
+inline void task::reset() NOEXCEPT
+{
+    if( m_manage )
+    {
+        m_manage( &m_storage, nullptr );
+        m_invoke = nullptr;
+        m_manage = nullptr;
+    }
+}
+
+}// concurrency
+
+}// external_sort
+
+#endif
@@ -0,0 +1,83 @@
+#include "task_queue.hpp"
+
+namespace external_sort
+{
+
+namespace concurrency
+{
+
+task_queue::task_queue( size_t capacity ) :
+    m_cells( new cell[ capacity ] ),
+    m_mask( capacity - 1 )
+{
+    // a cell is free for the push at position == sequence
+    for( size_t c = 0; c < capacity; ++c ){
+        m_cells[ c ].sequence.store( c, std::memory_order_relaxed );
+    }
+}
+
+bool task_queue::push( task& t )
+{
+    cell* c;
+    size_t pos = m_push_pos.load( std::memory_order_relaxed );
+
+    while( true )
+    {
+        c = &m_cells[ pos & m_mask ];
+        size_t sequence = c->sequence.load( std::memory_order_acquire );
+        auto diff = static_cast< std::ptrdiff_t >( sequence ) - static_cast< std::ptrdiff_t >( pos );
+
+        if( diff == 0 )
+        {
+            if( m_push_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ){
+                break;
+            }
+        }
+        else if( diff < 0 ){
+            return false; // the cell still holds a task of the previous lap
+        }
+        else{
+            pos = m_push_pos.load( std::memory_order_relaxed );
+        }
+    }
+
+    c->data = std::move( t );
+    c->sequence.store( pos + 1, std::memory_order_release );
+
+    return true;
+}
+
+bool task_queue::pop( task& t )
+{
+    cell* c;
+    size_t pos = m_pop_pos.load( std::memory_order_relaxed );
+
+    while( true )
+    {
+        c = &m_cells[ pos & m_mask ];
+        size_t sequence = c->sequence.load( std::memory_order_acquire );
+        auto diff = static_cast< std::ptrdiff_t >( sequence ) - static_cast< std::ptrdiff_t >( pos + 1 );
+
+        if( diff == 0 )
+        {
+            if( m_pop_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ){
+                break;
+            }
+        }
+        else if( diff < 0 ){
+            return false; // nothing has been pushed there yet
+        }
+        else{
+            pos = m_pop_pos.load( std::memory_order_relaxed );
+        }
+    }
+
+    t = std::move( c->data );
+    c->sequence.store( pos + m_mask + 1, std::memory_order_release );
+
+    return true;
+}
+
+}// concurrency
+
+}// external_sort
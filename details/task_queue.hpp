@@ -0,0 +1,58 @@
+#ifndef TASK_QUEUE_HPP
+#define TASK_QUEUE_HPP
+
+#include <atomic>
+#include <memory>
+#include "task.hpp"
+
+namespace external_sort
+{
+
+namespace concurrency
+{
+
+// Bounded lock-free queue of tasks, any thread may push and pop.
+// Every cell has a sequence number telling whether it's free or holds
+// a task for the current lap, so a task is handed over with no locks
+class task_queue
+{
+public:
+    // capacity has to be a power of two
+    explicit task_queue( size_t capacity );
+    task_queue( const task_queue& ) = delete;
+    task_queue& operator=( const task_queue& ) = delete;
+
+    // Moves the task into the queue, false if the queue is full
+    bool push( task& t );
+
+    // false if the queue is empty
+    bool pop( task& t );
+
+private:
+    struct cell
+    {
+        std::atomic< size_t > sequence;
+        task data;
+    };
+
+    // keeps the positions pushers and poppers fight for on different cache lines
+    struct padding
+    {
+        char bytes[ 64 ];
+    };
+
+private:
+    std::unique_ptr< cell[] > m_cells;
+    size_t m_mask;
+    padding m_pad0;
+    std::atomic< size_t > m_push_pos{ 0 };
+    padding m_pad1;
+    std::atomic< size_t > m_pop_pos{ 0 };
+    padding m_pad2;
+};
+
+}// concurrency
+
+}// external_sort
+
+#endif
@@ -0,0 +1,247 @@
+#include "uring.hpp"
+
+#ifdef EXTERNAL_SORT_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace external_sort
+{
+
+namespace file
+{
+
+namespace
+{
+
+int io_uring_setup( unsigned entries, io_uring_params* params )
+{
+    return static_cast< int >( syscall( __NR_io_uring_setup, entries, params ) );
+}
+
+int io_uring_enter( int fd, unsigned to_submit, unsigned min_complete, unsigned flags )
+{
+    return static_cast< int >( syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0 ) );
+}
+
+int io_uring_register( int fd, unsigned opcode, const void* arg, unsigned nr_args )
+{
+    return static_cast< int >( syscall( __NR_io_uring_register, fd, opcode, arg, nr_args ) );
+}
+
+// ring indices are shared with the kernel
+unsigned load_acquire( const unsigned* p )
+{
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+void store_release( unsigned* p, unsigned v )
+{
+    __atomic_store_n( p, v, __ATOMIC_RELEASE );
+}
+
+template< typename P >
+P* at( void* base, unsigned offset )
+{
+    return reinterpret_cast< P* >( static_cast< char* >( base ) + offset );
+}
+
+}
+
+uring::~uring()
+{
+    if( m_sqes ){
+        munmap( m_sqes, m_sqes_size );
+    }
+
+    if( m_cq_ring && m_cq_ring != m_sq_ring ){
+        munmap( m_cq_ring, m_cq_ring_size );
+    }
+
+    if( m_sq_ring ){
+        munmap( m_sq_ring, m_sq_ring_size );
+    }
+
+    if( m_fd >= 0 ){
+        close( m_fd );
+    }
+}
+
+bool uring::init( unsigned entries )
+{
+    io_uring_params params;
+    std::memset( &params, 0, sizeof( params ) );
+
+    m_fd = io_uring_setup( entries, &params );
+    if( m_fd < 0 ){
+        return false;
+    }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+
+    // newer kernels map both rings at once
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if( single_mmap ){
+        m_sq_ring_size = m_cq_ring_size = std::max( m_sq_ring_size, m_cq_ring_size );
+    }
+
+    m_sq_ring = mmap( nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING );
+    if( m_sq_ring == MAP_FAILED )
+    {
+        m_sq_ring = nullptr;
+        return false;
+    }
+
+    if( single_mmap ){
+        m_cq_ring = m_sq_ring;
+    }
+    else
+    {
+        m_cq_ring = mmap( nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING );
+        if( m_cq_ring == MAP_FAILED )
+        {
+            m_cq_ring = nullptr;
+            return false;
+        }
+    }
+
+    m_sqes_size = params.sq_entries * sizeof( io_uring_sqe );
+    void* sqes = mmap( nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES );
+    if( sqes == MAP_FAILED ){
+        return false;
+    }
+
+    m_sqes = static_cast< io_uring_sqe* >( sqes );
+
+    m_sq_head = at< unsigned >( m_sq_ring, params.sq_off.head );
+    m_sq_tail = at< unsigned >( m_sq_ring, params.sq_off.tail );
+    m_sq_mask = at< unsigned >( m_sq_ring, params.sq_off.ring_mask );
+    m_sq_entries = at< unsigned >( m_sq_ring, params.sq_off.ring_entries );
+    m_sq_array = at< unsigned >( m_sq_ring, params.sq_off.array );
+
+    m_cq_head = at< unsigned >( m_cq_ring, params.cq_off.head );
+    m_cq_tail = at< unsigned >( m_cq_ring, params.cq_off.tail );
+    m_cq_mask = at< unsigned >( m_cq_ring, params.cq_off.ring_mask );
+    m_cqes = at< io_uring_cqe >( m_cq_ring, params.cq_off.cqes );
+
+    return true;
+}
+
+bool uring::register_files( const std::vector< int >& fds )
+{
+    unregister_files();
+
+    m_files_registered = !fds.empty() &&
+        io_uring_register( m_fd, IORING_REGISTER_FILES, fds.data(), static_cast< unsigned >( fds.size() ) ) == 0;
+
+    return m_files_registered;
+}
+
+void uring::unregister_files()
+{
+    if( m_files_registered )
+    {
+        io_uring_register( m_fd, IORING_UNREGISTER_FILES, nullptr, 0 );
+        m_files_registered = false;
+    }
+}
+
+bool uring::register_buffers( const std::vector< iovec >& buffers )
+{
+    unregister_buffers();
+
+    // may fail for the locked memory limit, reads then go to plain buffers
+    m_buffers_registered = !buffers.empty() &&
+        io_uring_register( m_fd, IORING_REGISTER_BUFFERS, buffers.data(), static_cast< unsigned >( buffers.size() ) ) == 0;
+
+    return m_buffers_registered;
+}
+
+void uring::unregister_buffers()
+{
+    if( m_buffers_registered )
+    {
+        io_uring_register( m_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0 );
+        m_buffers_registered = false;
+    }
+}
+
+bool uring::read( unsigned file, void* data, unsigned size, uint64_t offset, uint64_t user_data, int fixed_buffer )
+{
+    // the kernel is the only consumer of the submission ring
+    unsigned tail = *m_sq_tail;
+    if( tail - load_acquire( m_sq_head ) == *m_sq_entries ){
+        return false;
+    }
+
+    unsigned index = tail & *m_sq_mask;
+    io_uring_sqe* sqe = &m_sqes[ index ];
+    std::memset( sqe, 0, sizeof( io_uring_sqe ) );
+
+    sqe->opcode = fixed_buffer < 0 ? IORING_OP_READ : IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = static_cast< int >( file );
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast< uint64_t >( data );
+    sqe->len = size;
+    sqe->user_data = user_data;
+
+    if( fixed_buffer >= 0 ){
+        sqe->buf_index = static_cast< uint16_t >( fixed_buffer );
+    }
+
+    m_sq_array[ index ] = index;
+    store_release( m_sq_tail, tail + 1 );
+    ++m_queued;
+
+    return true;
+}
+
+void uring::submit( unsigned min_complete )
+{
+    while( m_queued || min_complete )
+    {
+        int result = io_uring_enter( m_fd, m_queued, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0 );
+        if( result < 0 )
+        {
+            if( errno == EINTR || errno == EAGAIN || errno == EBUSY ){
+                continue;
+            }
+
+            throw std::runtime_error( std::string( "io_uring_enter failed: " ) + std::strerror( errno ) );
+        }
+
+        m_queued -= std::min( m_queued, static_cast< unsigned >( result ) );
+        break;
+    }
+}
+
+bool uring::pop_completion( uint64_t& user_data, int& result )
+{
+    // this is the only consumer of the completion ring
+    unsigned head = *m_cq_head;
+    if( head == load_acquire( m_cq_tail ) ){
+        return false;
+    }
+
+    const io_uring_cqe& cqe = m_cqes[ head & *m_cq_mask ];
+    user_data = cqe.user_data;
+    result = cqe.res;
+
+    store_release( m_cq_head, head + 1 );
+    return true;
+}
+
+}// file
+
+}// external_sort
+
+#endif
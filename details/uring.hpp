@@ -0,0 +1,94 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+// io_uring is used through the raw syscalls, only the kernel header is needed
+#if defined( __linux__ ) && defined( __has_include )
+#if __has_include( <linux/io_uring.h> )
+#define EXTERNAL_SORT_IO_URING 1
+#endif
+#endif
+
+#ifdef EXTERNAL_SORT_IO_URING
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace external_sort
+{
+
+namespace file
+{
+
+// A minimal io_uring instance for reads: a submission and a completion ring
+// shared with the kernel, plus the files and buffers registered with it
+class uring
+{
+public:
+    uring() = default;
+    uring( const uring& ) = delete;
+    uring& operator=( const uring& ) = delete;
+    ~uring();
+
+    // false if the kernel doesn't support io_uring or it isn't allowed
+    bool init( unsigned entries );
+
+    // Registered files are then referred to by their index
+    bool register_files( const std::vector< int >& fds );
+    void unregister_files();
+
+    // Registered buffers are pinned once instead of on every read
+    bool register_buffers( const std::vector< iovec >& buffers );
+    void unregister_buffers();
+
+    // Queues a read of a registered file, into a registered buffer unless fixed_buffer < 0.
+    // false if the submission ring is full
+    bool read( unsigned file, void* data, unsigned size, uint64_t offset, uint64_t user_data, int fixed_buffer );
+
+    // Submits the queued reads and waits for at least min_complete completions
+    void submit( unsigned min_complete = 0 );
+
+    // Takes the next completion if there is one, result is what read(2) would return or -errno
+    bool pop_completion( uint64_t& user_data, int& result );
+
+    inline unsigned queued() const{
+        return m_queued;
+    }
+
+private:
+    int m_fd{ -1 };
+    unsigned m_queued{ 0 }; // reads not submitted yet
+
+    void* m_sq_ring{ nullptr };
+    void* m_cq_ring{ nullptr };
+    size_t m_sq_ring_size{ 0 };
+    size_t m_cq_ring_size{ 0 };
+    io_uring_sqe* m_sqes{ nullptr };
+    size_t m_sqes_size{ 0 };
+
+    unsigned* m_sq_head{ nullptr };
+    unsigned* m_sq_tail{ nullptr };
+    unsigned* m_sq_mask{ nullptr };
+    unsigned* m_sq_entries{ nullptr };
+    unsigned* m_sq_array{ nullptr };
+
+    unsigned* m_cq_head{ nullptr };
+    unsigned* m_cq_tail{ nullptr };
+    unsigned* m_cq_mask{ nullptr };
+    io_uring_cqe* m_cqes{ nullptr };
+
+    bool m_files_registered{ false };
+    bool m_buffers_registered{ false };
+};
+
+}// file
+
+}// external_sort
+
+#endif
+
+#endif
@@ -0,0 +1,417 @@
+#ifndef URING_READER_HPP
+#define URING_READER_HPP
+
+#include "uring.hpp"
+
+#ifdef EXTERNAL_SORT_IO_URING
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unistd.h>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "file_chunk_reader.hpp"
+
+namespace external_sort
+{
+
+namespace file
+{
+
+// Reads chunks of several files through io_uring.
+// Every file has one read in flight: the chunk after the one being merged.
+// Reads of all files are queued together and submitted in batches, a file's
+// read is reaped whenever its chunk is asked for. Each file has two buffers
+// registered with the ring, so the kernel doesn't pin pages on every read.
+// The caller gives consumed chunks back with release() for them to be reused
+template< class T >
+class uring_reader
+{
+public:
+    using value_type = memory::buffer< T >;
+
+public:
+    // nullptr if io_uring can't be used here
+    static std::unique_ptr< uring_reader > create( size_t simul_readings, size_t block_size, memory::buffer_pool< T >* pool );
+
+    uring_reader( const uring_reader& ) = delete;
+    uring_reader& operator=( const uring_reader& ) = delete;
+    ~uring_reader();
+
+    void open( const std::vector< std::string >& files, const std::vector< item_range >& ranges );
+    void close();
+    value_type get_next_chunk( size_t file );
+    void release( value_type&& chunk );
+    inline bool completed( size_t file ) const NOEXCEPT;
+
+private:
+    struct run_file
+    {
+        int fd{ -1 };
+        size_t next{ 0 }; // next item to read
+        size_t end{ 0 };
+        value_type chunk; // being read
+        size_t wanted{ 0 }; // bytes
+        size_t done{ 0 };
+        bool in_flight{ false };
+        bool completed{ false };
+        int error{ 0 };
+    };
+
+    uring_reader( size_t simul_readings, size_t block_size, memory::buffer_pool< T >* pool );
+
+    void read_next( size_t file );
+    void queue( size_t file );
+    void reap();
+    void wait_for( size_t file );
+    value_type take_buffer();
+    int fixed_index( const value_type& b ) const;
+
+private:
+    uring m_ring;
+    std::vector< run_file > m_files;
+    size_t m_files_open{ 0 };
+    size_t m_block_size;
+    memory::buffer_pool< T >* m_pool;
+
+    std::vector< value_type > m_free; // buffers no chunk is read into
+    std::vector< iovec > m_registered;
+    std::unordered_map< const void*, int > m_fixed; // registered buffer by address
+};
+
+///// implementation
+
+template< class T >
+std::unique_ptr< uring_reader< T > > uring_reader< T >::create( size_t simul_readings, size_t block_size, memory::buffer_pool< T >* pool )
+{
+    std::unique_ptr< uring_reader > reader{ new uring_reader( simul_readings, block_size, pool ) };
+
+    // a read per file at most, plus room for the rest of short reads
+    unsigned entries = 1;
+    while( entries < 2 * simul_readings ){
+        entries *= 2;
+    }
+
+    if( !reader->m_ring.init( entries ) ){
+        reader.reset();
+    }
+
+    return reader;
+}
+
+template< class T >
+uring_reader< T >::uring_reader( size_t simul_readings, size_t block_size, memory::buffer_pool< T >* pool ) :
+    m_files( simul_readings ),
+    m_block_size( block_size ),
+    m_pool( pool )
+{
+
+}
+
+template< class T >
+uring_reader< T >::~uring_reader()
+{
+    try{
+        close();
+    }
+    catch( ... ){
+    }
+}
+
+template< class T >
+void uring_reader< T >::open( const std::vector< std::string >& files, const std::vector< item_range >& ranges )
+{
+    close();
+
+    if( files.size() > m_files.size() || ranges.size() != files.size() ){
+        throw std::invalid_argument( "Wring number of files to open" );
+    }
+
+    // an empty input leaves no runs, and io_uring takes no empty set of files
+    if( files.empty() ){
+        return;
+    }
+
+    std::vector< int > fds;
+    for( size_t file = 0; file < files.size(); ++file )
+    {
+        run_file& f = m_files[ file ];
+        f = run_file{};
+        m_files_open = file + 1;
+
+        f.fd = ::open( files[ file ].c_str(), O_RDONLY | O_CLOEXEC );
+        if( f.fd < 0 )
+        {
+            throw std::invalid_argument(
+                        files[ file ] + " doesn't exist or occupied by another process" );
+        }
+
+        off_t file_size = lseek( f.fd, 0, SEEK_END );
+        if( file_size < 0 || file_size % sizeof( T ) )
+        {
+            throw std::length_error{
+                files[ file ] + " has size incompatible with the specified type or is corrupted" };
+        }
+
+        size_t items = static_cast< size_t >( file_size ) / sizeof( T );
+        f.next = std::min( ranges[ file ].first, items );
+        f.end = std::max( std::min( ranges[ file ].second, items ), f.next );
+        f.completed = f.next == f.end;
+
+        fds.push_back( f.fd );
+    }
+
+    if( !m_ring.register_files( fds ) ){
+        throw std::runtime_error( "Couldn't register files with io_uring" );
+    }
+
+    // two buffers a file: one being merged, one being read
+    m_registered.clear();
+    m_fixed.clear();
+
+    for( size_t buffer = 0; buffer < 2 * files.size(); ++buffer )
+    {
+        m_free.emplace_back( m_pool ? m_pool->acquire( m_block_size ) : value_type{} );
+        m_free.back().reserve( m_block_size );
+        m_registered.push_back( iovec{ m_free.back().data(), m_free.back().capacity() * sizeof( T ) } );
+    }
+
+    if( m_ring.register_buffers( m_registered ) )
+    {
+        for( size_t buffer = 0; buffer < m_registered.size(); ++buffer ){
+            m_fixed[ m_registered[ buffer ].iov_base ] = static_cast< int >( buffer );
+        }
+    }
+
+    // the first chunks of all files go in one batch
+    for( size_t file = 0; file < files.size(); ++file ){
+        read_next( file );
+    }
+
+    m_ring.submit();
+}
+
+template< class T >
+void uring_reader< T >::close()
+{
+    // buffers can't be given away while the kernel writes into them
+    for( size_t file = 0; file < m_files_open; ++file )
+    {
+        while( m_files[ file ].in_flight )
+        {
+            m_ring.submit( 1 );
+            reap();
+        }
+    }
+
+    m_ring.unregister_buffers();
+    m_ring.unregister_files();
+    m_fixed.clear();
+
+    for( size_t file = 0; file < m_files_open; ++file )
+    {
+        run_file& f = m_files[ file ];
+        if( f.fd >= 0 ){
+            ::close( f.fd );
+        }
+
+        if( m_pool ){
+            m_pool->release( std::move( f.chunk ) );
+        }
+
+        f = run_file{};
+    }
+
+    m_files_open = 0;
+
+    for( auto& b : m_free )
+    {
+        if( m_pool ){
+            m_pool->release( std::move( b ) );
+        }
+    }
+
+    m_free.clear();
+}
+
+template< class T >
+typename uring_reader< T >::value_type uring_reader< T >::get_next_chunk( size_t file )
+{
+    run_file& f = m_files[ file ];
+    if( !f.in_flight && f.chunk.empty() ){
+        return value_type{};
+    }
+
+    {
+        statistics_details::stall_timer stall( m_pool ? &m_pool->counters() : nullptr, statistics_details::stall::read );
+        wait_for( file );
+    }
+
+    if( f.error ){
+        throw std::runtime_error( std::string( "Couldn't read a run: " ) + std::strerror( f.error ) );
+    }
+
+    value_type result = std::move( f.chunk );
+    f.chunk = value_type{};
+    result.resize( f.done / sizeof( T ) );
+    if( m_pool ){
+        m_pool->counters().bytes_read.fetch_add( f.done, std::memory_order_relaxed );
+    }
+
+    // a file that ended early has nothing more to give
+    if( f.done < f.wanted ){
+        f.completed = true;
+    }
+
+    read_next( file );
+
+    // a refill waits for other files' ones to be submitted together,
+    // they're all submitted anyway before anything is waited for
+    size_t batch = std::max< size_t >( m_files_open / 4, 1 );
+    if( m_ring.queued() >= batch ){
+        m_ring.submit();
+    }
+
+    return result;
+}
+
+template< class T >
+void uring_reader< T >::release( value_type&& chunk )
+{
+    if( m_fixed.count( chunk.data() ) )
+    {
+        chunk.clear();
+        m_free.emplace_back( std::move( chunk ) );
+    }
+    else if( m_pool ){
+        m_pool->release( std::move( chunk ) );
+    }
+}
+
+template< class T >
+inline bool uring_reader< T >::completed( size_t file ) const NOEXCEPT
+{
+    return m_files[ file ].completed && !m_files[ file ].in_flight && m_files[ file ].chunk.empty();
+}
+
+template< class T >
+void uring_reader< T >::read_next( size_t file )
+{
+    run_file& f = m_files[ file ];
+    if( f.completed ){
+        return;
+    }
+
+    size_t items = std::min( m_block_size, f.end - f.next );
+    f.chunk = take_buffer();
+    f.chunk.resize( items ); // no zeroing, the buffer allocator leaves items uninitialized
+    f.wanted = items * sizeof( T );
+    f.done = 0;
+    f.in_flight = true;
+
+    queue( file );
+
+    f.next += items;
+    f.completed = f.next == f.end;
+}
+
+template< class T >
+void uring_reader< T >::queue( size_t file )
+{
+    run_file& f = m_files[ file ];
+    size_t offset = f.next * sizeof( T );
+
+    // the rest of a short read goes after what has been read already
+    if( f.done ){
+        offset = ( f.next - f.chunk.size() ) * sizeof( T ) + f.done;
+    }
+
+    char* data = reinterpret_cast< char* >( f.chunk.data() ) + f.done;
+    unsigned size = static_cast< unsigned >( f.wanted - f.done );
+
+    while( !m_ring.read( static_cast< unsigned >( file ), data, size, offset, file, fixed_index( f.chunk ) ) )
+    {
+        // the submission ring is full, make room
+        m_ring.submit();
+    }
+}
+
+template< class T >
+void uring_reader< T >::reap()
+{
+    uint64_t file;
+    int result;
+
+    while( m_ring.pop_completion( file, result ) )
+    {
+        run_file& f = m_files[ file ];
+
+        if( result < 0 )
+        {
+            if( result == -EINTR || result == -EAGAIN )
+            {
+                queue( file );
+                continue;
+            }
+
+            f.error = -result;
+            f.in_flight = false;
+            continue;
+        }
+
+        f.done += static_cast< size_t >( result );
+
+        // a short read before the end of the file goes on from where it stopped
+        if( result > 0 && f.done < f.wanted ){
+            queue( file );
+        }
+        else{
+            f.in_flight = false;
+        }
+    }
+}
+
+template< class T >
+void uring_reader< T >::wait_for( size_t file )
+{
+    reap();
+
+    while( m_files[ file ].in_flight )
+    {
+        m_ring.submit( 1 );
+        reap();
+    }
+}
+
+template< class T >
+typename uring_reader< T >::value_type uring_reader< T >::take_buffer()
+{
+    if( m_free.empty() ){
+        return m_pool ? m_pool->acquire( m_block_size ) : value_type{};
+    }
+
+    value_type b = std::move( m_free.back() );
+    m_free.pop_back();
+    return b;
+}
+
+template< class T >
+int uring_reader< T >::fixed_index( const value_type& b ) const
+{
+    auto fixed = m_fixed.find( b.data() );
+    return fixed == m_fixed.end() ? -1 : fixed->second;
+}
+
+}// file
+
+}// external_sort
+
+#endif
+
+#endif
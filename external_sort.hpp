@@ -3,16 +3,47 @@
 
 #include "details/split_sorter.hpp"
 #include "details/merge_sorter.hpp"
+#include "details/pipeline.hpp"
+#include "details/record_sorter.hpp"
+#include "details/options.hpp"
+#include "details/statistics.hpp"
 
 namespace external_sort
 {
 
+namespace external_sort_details
+{
+
+// Statistics of a sort of items split into runs, from its snapshots
 template< typename T >
-void external_sort( const std::string& in_file,
-                    const std::string& out_file,
-                    size_t avail_mem,
-                    size_t merge_at_once,
-                    size_t threads_num = std::thread::hardware_concurrency() - 1 )
+statistics collect( const memory::buffer_pool< T >& pool,
+                    size_t runs,
+                    size_t items,
+                    const statistics_details::snapshot& start,
+                    const statistics_details::snapshot& split_end,
+                    const statistics_details::snapshot& end )
+{
+    statistics stats;
+    stats.pool_hits = pool.hits();
+    stats.pool_misses = pool.misses();
+    stats.peak_memory = pool.peak_bytes();
+    stats.runs = runs;
+    stats.merges = static_cast< size_t >( end.merges - start.merges );
+    stats.merge_passes = items ? static_cast< double >( end.items_merged - start.items_merged ) / items : 0;
+    stats.split = statistics_details::difference( start, split_end );
+    stats.merge = statistics_details::difference( split_end, end );
+
+    return stats;
+}
+
+template< typename T >
+statistics sort( const std::string& in_file,
+                 const std::string& out_file,
+                 size_t avail_mem,
+                 size_t merge_at_once,
+                 size_t threads_num,
+                 const options& opts,
+                 const merge::reducer< T >& reduce )
 {
     // if avail_mem < memory needed to merge 2 files + output buffer
     if( avail_mem < 3 * sizeof( T ) ){
@@ -33,8 +64,217 @@ void external_sort( const std::string& in_file,
 
     std::string work_folder = common::get_folder_from_path( out_file );
 
-    size_t files_num = split::split< T >( in_file, work_folder, avail_mem, threads_num );
-    merge::merge< T >( out_file, files_num, merge_at_once, avail_mem, threads_num );
+    // chunk buffers are recycled by both phases
+    memory::buffer_pool< T > pool( avail_mem );
+
+    size_t files_num = 0;
+    auto start = statistics_details::take( pool.counters() );
+    statistics_details::snapshot split_end;
+
+    if( opts.pipelined_merge ){
+        files_num = pipeline::sort< T >( in_file, out_file, avail_mem, merge_at_once, threads_num, opts, reduce, pool, split_end );
+    }
+    else
+    {
+        files_num = split::split< T >( in_file, work_folder, avail_mem, threads_num, opts, reduce, pool );
+        split_end = statistics_details::take( pool.counters() );
+        merge::merge< T >( out_file, files_num, merge_at_once, avail_mem, threads_num, opts, reduce, pool );
+    }
+
+    auto end = statistics_details::take( pool.counters() );
+
+    // split has checked the input is there
+    std::ifstream in( in_file, std::ios::in | std::ifstream::binary | std::ios::ate );
+    size_t items = static_cast< size_t >( in.tellg() ) / sizeof( T );
+
+    return collect( pool, files_num, items, start, split_end, end );
+}
+
+template< typename T >
+statistics sort_stream( const stream::producer< T >& producer,
+                        const stream::consumer< T >& consumer,
+                        const std::string& work_folder,
+                        size_t avail_mem,
+                        size_t merge_at_once,
+                        size_t threads_num,
+                        const options& opts )
+{
+    // the chunk being filled takes a share of memory as well
+    if( avail_mem < 3 * sizeof( T ) ){
+        throw std::invalid_argument( "Not enough memory to sort" );
+    }
+
+    if( merge_at_once < 2 ){
+        throw std::invalid_argument( "Cannot merge less that two files" );
+    }
+
+    if( !producer || !consumer ){
+        throw std::invalid_argument( "Producer and consumer should not be empty" );
+    }
+
+    if( threads_num == 0 ){
+        threads_num = 1;
+    }
+
+    memory::buffer_pool< T > pool( avail_mem );
+    merge::reducer< T > reduce;
+
+    size_t items = 0;
+    stream::producer< T > counted = [ &producer, &items ]( T* data, size_t max_items )
+    {
+        size_t produced = producer( data, max_items );
+        items += std::min( produced, max_items );
+        return produced;
+    };
+
+    auto start = statistics_details::take( pool.counters() );
+    size_t files_num = split::split_stream< T >( counted, work_folder, avail_mem, threads_num, opts, reduce, pool );
+    auto split_end = statistics_details::take( pool.counters() );
+    merge::merge< T >( consumer, work_folder, files_num, merge_at_once, avail_mem, threads_num, opts, reduce, pool );
+    auto end = statistics_details::take( pool.counters() );
+
+    return collect( pool, files_num, items, start, split_end, end );
+}
+
+}// external_sort_details
+
+template< typename T >
+statistics external_sort( const std::string& in_file,
+                          const std::string& out_file,
+                          size_t avail_mem,
+                          size_t merge_at_once,
+                          size_t threads_num = std::thread::hardware_concurrency() - 1,
+                          const options& opts = options() )
+{
+    return external_sort_details::sort( in_file, out_file, avail_mem, merge_at_once, threads_num, opts, merge::reducer< T >() );
+}
+
+// Sorts a file keeping only the first item of every group of equal ones:
+// combine( into, item ) is called for each of the others, they are just dropped
+// if it's empty. Equal items are reduced as soon as they meet, when a chunk
+// is sorted and in every merge pass, so runs shrink along the way. They are
+// combined in no particular order, combine has to be associative and commutative.
+// The final merge isn't split between threads then
+template< typename T >
+statistics external_sort_reduce( const std::string& in_file,
+                                 const std::string& out_file,
+                                 size_t avail_mem,
+                                 size_t merge_at_once,
+                                 const merge::combine_function< T >& combine,
+                                 size_t threads_num = std::thread::hardware_concurrency() - 1,
+                                 const options& opts = options() )
+{
+    return external_sort_details::sort( in_file, out_file, avail_mem, merge_at_once, threads_num, opts, merge::reducer< T >( combine ) );
+}
+
+// Writes the smallest n items of a file, sorted. Chunks are cut to the n
+// smallest items before they're sorted and merges stop after n items, so
+// runs are n items at most and the merge passes take time of the order of n
+// rather than of the size of the file. The final merge isn't split between threads
+template< typename T >
+statistics external_sort_top( const std::string& in_file,
+                              const std::string& out_file,
+                              size_t avail_mem,
+                              size_t merge_at_once,
+                              size_t n,
+                              size_t threads_num = std::thread::hardware_concurrency() - 1,
+                              const options& opts = options() )
+{
+    if( !n && !in_file.empty() && !out_file.empty() )
+    {
+        std::ofstream out( out_file, std::ios::out | std::ofstream::binary );
+        if( !out.good() ){
+            throw std::runtime_error{ "Couldn't write to file: " + out_file };
+        }
+
+        return statistics();
+    }
+
+    return external_sort_details::sort( in_file, out_file, avail_mem, merge_at_once, threads_num, opts, merge::reducer< T >::top( n ) );
+}
+
+// Sorts items pulled from producer, handing them sorted to consumer. Neither end
+// is a file, temp runs go to work_folder, a path ending with a delimiter.
+// Split chunks are filled straight from the producer on the calling thread.
+// The output goes to the consumer in order, so the final merge takes a single
+// thread. pipelined_merge doesn't apply
+template< typename T >
+statistics external_sort_stream( const stream::producer< T >& producer,
+                                 const stream::consumer< T >& consumer,
+                                 const std::string& work_folder,
+                                 size_t avail_mem,
+                                 size_t merge_at_once,
+                                 size_t threads_num = std::thread::hardware_concurrency() - 1,
+                                 const options& opts = options() )
+{
+    return external_sort_details::sort_stream( producer, consumer, work_folder, avail_mem, merge_at_once, threads_num, opts );
+}
+
+// external_sort_stream() of [ first, last ) into out
+template< typename T, typename InputIt, typename OutputIt >
+statistics external_sort_range( InputIt first,
+                                InputIt last,
+                                OutputIt out,
+                                const std::string& work_folder,
+                                size_t avail_mem,
+                                size_t merge_at_once,
+                                size_t threads_num = std::thread::hardware_concurrency() - 1,
+                                const options& opts = options() )
+{
+    stream::producer< T > producer = [ &first, &last ]( T* data, size_t max_items )
+    {
+        size_t items = 0;
+        for( ; items < max_items && first != last; ++items, ++first ){
+            data[ items ] = *first;
+        }
+
+        return items;
+    };
+
+    stream::consumer< T > consumer = [ &out ]( const T* data, size_t items ){
+        out = std::copy( data, data + items, out );
+    };
+
+    return external_sort_details::sort_stream( producer, consumer, work_folder, avail_mem, merge_at_once, threads_num, opts );
+}
+
+// Sorts a file of variable length records delimited by newlines, compared as byte strings.
+// Chunks are cut at record boundaries, sorted through arrays of record offsets
+// and merged record by record, nothing is padded. Options other than
+// write_buffers don't apply, of the statistics only runs and the pool's are kept
+statistics external_sort_records( const std::string& in_file,
+                                  const std::string& out_file,
+                                  size_t avail_mem,
+                                  size_t merge_at_once,
+                                  size_t threads_num = std::thread::hardware_concurrency() - 1,
+                                  const options& opts = options() )
+{
+    // a merge needs a few bytes per run at least
+    if( avail_mem < 3 * merge_at_once ){
+        throw std::invalid_argument( "Not enough memory to sort" );
+    }
+
+    if( merge_at_once < 2 ){
+        throw std::invalid_argument( "Cannot merge less that two files" );
+    }
+
+    if( in_file.empty() || out_file.empty()  ){
+        throw std::invalid_argument( "File name should not be empty" );
+    }
+
+    if( threads_num == 0 ){
+        threads_num = 1;
+    }
+
+    memory::buffer_pool< char > pool( avail_mem );
+
+    statistics stats;
+    stats.runs = records::sort( in_file, out_file, avail_mem, merge_at_once, threads_num, opts, pool );
+    stats.pool_hits = pool.hits();
+    stats.pool_misses = pool.misses();
+    stats.peak_memory = pool.peak_bytes();
+
+    return stats;
 }
 
 }// external_sort
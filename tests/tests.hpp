@@ -1,9 +1,14 @@
 #ifndef EXTERNAL_SORT_TESTS_HPP
 #define EXTERNAL_SORT_TESTS_HPP
 
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <random>
+#include <thread>
 
 #include "../external_sort.hpp"
 
@@ -61,6 +66,109 @@ std::vector< size_t > generate_file( const std::string& path, size_t number_of_i
     return numbers;
 }
 
+// A large record sorted through its key prefix
+struct record
+{
+    uint64_t id;
+    uint64_t sequence;
+    char payload[ 240 ];
+
+    bool operator<( const record& r ) const{
+        return id < r.id || ( id == r.id && sequence < r.sequence );
+    }
+};
+
+std::vector< record > generate_records( size_t size, uint64_t ids )
+{
+    std::default_random_engine e;
+    std::uniform_int_distribution< uint64_t > dist( 0, ids - 1 );
+
+    std::vector< record > records( size );
+    for( size_t i = 0; i < size; ++i )
+    {
+        records[ i ].id = dist( e );
+        records[ i ].sequence = size - i; // no two records are equal
+        std::memset( records[ i ].payload, static_cast< int >( i ), sizeof( records[ i ].payload ) );
+    }
+
+    return records;
+}
+
+bool same_records( const std::vector< record >& l, const std::vector< record >& r )
+{
+    return l.size() == r.size() && std::equal( l.begin(), l.end(), r.begin(), []( const record& a, const record& b ){
+        return a.id == b.id && a.sequence == b.sequence && !std::memcmp( a.payload, b.payload, sizeof( a.payload ) ); } );
+}
+
+}// test_details
+
+// the prefix is coarser than the order, so there are ties to settle
+template<> struct key_prefix_traits< test_details::record >
+{
+    using prefix_type = uint32_t;
+    static prefix_type prefix( const test_details::record& r ){ return static_cast< prefix_type >( r.id >> 8 ); }
+};
+
+namespace test_details
+{
+
+// Random, sorted, reversed and duplicate heavy inputs of T
+template< typename T >
+std::vector< std::vector< T > > sort_inputs( size_t size )
+{
+    std::default_random_engine e;
+    std::uniform_int_distribution< int64_t > dist( -1000000000, 1000000000 );
+
+    std::vector< T > random( size ), few_unique( size );
+    for( size_t i = 0; i < size; ++i )
+    {
+        // the division gives fractions to floating point values
+        random[ i ] = static_cast< T >( dist( e ) ) / static_cast< T >( 4 );
+        few_unique[ i ] = static_cast< T >( dist( e ) % 8 );
+    }
+
+    std::vector< T > sorted( random );
+    std::sort( sorted.begin(), sorted.end() );
+    std::vector< T > reversed( sorted.rbegin(), sorted.rend() );
+
+    return { random, sorted, reversed, few_unique };
+}
+
+// Checks an in-memory sort against std::sort
+template< typename T, typename Sort >
+void check_sort( Sort sort, const std::string& error )
+{
+    for( size_t size : { 0, 1, 2, 63, 64, 1000, 1001, 4099, 100000 } )
+    {
+        for( auto& input : sort_inputs< T >( size ) )
+        {
+            std::vector< T > expected( input );
+            std::sort( expected.begin(), expected.end() );
+
+            sort( input.data(), input.data() + input.size() );
+            throw_assert( input == expected, error + " : size " + std::to_string( size ) );
+        }
+    }
+}
+
+// Checks the vectorized sort with every instruction set the cpu has, not only the best one
+template< typename T >
+void check_simd_sort( const std::string& error )
+{
+    check_sort< T >( []( T* first, T* last ){ sorting::simd_sort( first, last ); }, error );
+
+#ifdef EXTERNAL_SORT_SIMD
+    using sorting_details::simd::level;
+    for( level l : { level::sse42, level::avx2 } )
+    {
+        if( l <= sorting_details::simd::supported_level() ){
+            check_sort< T >( [ l ]( T* first, T* last ){ sorting_details::simd::sort( first, last, ( T* )nullptr, l ); },
+                             error + " : level " + std::to_string( static_cast< int >( l ) ) );
+        }
+    }
+#endif
+}
+
 bool verify( std::string sorted_file_path, std::vector< size_t >& numbers )
 {
     std::vector< size_t > numbers2( numbers.size() );
@@ -74,6 +182,38 @@ bool verify( std::string sorted_file_path, std::vector< size_t >& numbers )
     return numbers == numbers2;
 }
 
+// A key along with the number of times it's been seen
+struct counted
+{
+    uint64_t key;
+    uint64_t count;
+
+    bool operator<( const counted& r ) const{
+        return key < r.key;
+    }
+};
+
+template< typename T >
+void write_items( const std::string& path, const std::vector< T >& items )
+{
+    std::ofstream out( path, std::ios::out | std::ofstream::binary );
+    out.write( reinterpret_cast< const char* >( items.data() ), items.size() * sizeof( T ) );
+    throw_assert( out.good(), "write_items() : out stream not good()" );
+}
+
+template< typename T >
+std::vector< T > read_items( const std::string& path )
+{
+    std::ifstream in( path, std::ios::in | std::ifstream::binary | std::ios::ate );
+    throw_assert( in.good(), "read_items() : in stream not good()" );
+
+    std::vector< T > items( static_cast< size_t >( in.tellg() ) / sizeof( T ) );
+    in.seekg( 0, in.beg );
+    in.read( reinterpret_cast< char* >( items.data() ), items.size() * sizeof( T ) );
+
+    return items;
+}
+
 }
 
 namespace tests
@@ -148,7 +288,13 @@ void test_invalid_args()
     std::cout<<"test_invalid_args PASSED"<<std::endl;
 }
 
-void test_sort( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+statistics test_sort( const std::string& work_folder,
+                      size_t avail_mem,
+                      size_t merge_at_once,
+                      size_t threads_num,
+                      const options& opts = options(),
+                      size_t items = 10000000,
+                      const std::string& test_name = "test_sort" )
 {
     using namespace test_details;
     std::string file_path = work_folder + "external_sort_test_file";
@@ -156,7 +302,7 @@ void test_sort( const std::string& work_folder, size_t avail_mem, size_t merge_a
 
     std::vector< size_t > data;
     try{
-        data = generate_file( file_path, 10000000 );
+        data = generate_file( file_path, items );
     }
     catch(...)
     {
@@ -166,9 +312,10 @@ void test_sort( const std::string& work_folder, size_t avail_mem, size_t merge_a
 
     bool exception_thrown{ false };
     std::string exception_str;
+    statistics stats;
 
     try{
-        external_sort< size_t >( file_path, sorted_file_path, avail_mem, merge_at_once, threads_num );
+        stats = external_sort< size_t >( file_path, sorted_file_path, avail_mem, merge_at_once, threads_num, opts );
     }
     catch( const std::exception& e )
     {
@@ -180,8 +327,8 @@ void test_sort( const std::string& work_folder, size_t avail_mem, size_t merge_a
 
     try
     {
-        throw_assert( verify( sorted_file_path, data ), "test_sort FAILED : data invalid"  );
-        throw_assert( !exception_thrown, "test_sort FAILED : exception thrown : " + exception_str );
+        throw_assert( verify( sorted_file_path, data ), test_name + " FAILED : data invalid"  );
+        throw_assert( !exception_thrown, test_name + " FAILED : exception thrown : " + exception_str );
     }
     catch(...)
     {
@@ -191,7 +338,947 @@ void test_sort( const std::string& work_folder, size_t avail_mem, size_t merge_a
 
     std::remove( sorted_file_path.c_str() );
 
-    std::cout<<"test_sort PASSED"<<std::endl;
+    std::cout<<test_name<<" PASSED"<<std::endl;
+    return stats;
+}
+
+void test_sort_no_prefetch( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    options opts;
+    opts.prefetch = false;
+
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000000, "test_sort_no_prefetch" );
+}
+
+void test_sort_write_behind( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    options opts;
+    opts.write_buffers = 3;
+
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000000, "test_sort_write_behind" );
+}
+
+void test_sort_final_merge( const std::string& work_folder, size_t avail_mem, size_t merge_at_once )
+{
+    // several threads even if the machine has few cores, the last pass is cut between them
+    test_sort( work_folder, avail_mem, merge_at_once, 4, options(), 1000000, "test_sort_final_merge" );
+}
+
+void test_sort_io_uring( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    // falls back to the usual readers where io_uring isn't there
+    options opts;
+    opts.io_uring = true;
+
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000000, "test_sort_io_uring" );
+
+    // the last pass reads ranges of the runs
+    test_sort( work_folder, avail_mem, merge_at_once, 4, opts, 1000000, "test_sort_io_uring 4 threads" );
+
+    // no runs to read
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 0, "test_sort_io_uring empty" );
+}
+
+void test_sort_direct_io( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    options opts;
+    opts.direct_io = true;
+
+    // the files end in the middle of a block
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000003, "test_sort_direct_io" );
+
+    // ranges of the last pass start in the middle of blocks
+    test_sort( work_folder, avail_mem, merge_at_once, 4, opts, 1000003, "test_sort_direct_io 4 threads" );
+
+    opts.write_buffers = 3;
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000003, "test_sort_direct_io write behind" );
+
+    // merge buffers would be smaller than a block of the disk
+    std::string file_path = work_folder + "external_sort_test_file";
+    std::string sorted_file_path = work_folder + "sorted";
+    test_details::generate_file( file_path, 100003 );
+
+    bool exception_thrown{ false };
+
+    try{
+        external_sort< size_t >( file_path, sorted_file_path, 40000, merge_at_once, 1, opts );
+    }
+    catch( const std::exception& ){
+        exception_thrown = true;
+    }
+
+    std::remove( file_path.c_str() );
+    std::remove( sorted_file_path.c_str() );
+    test_details::throw_assert( exception_thrown, "test_sort_direct_io FAILED : buffers smaller than a disk block" );
+}
+
+void test_sort_mmap( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    options opts;
+    opts.mmap = true;
+
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000003, "test_sort_mmap" );
+
+    // windows of the last pass start in the middle of pages
+    test_sort( work_folder, avail_mem, merge_at_once, 4, opts, 1000003, "test_sort_mmap 4 threads" );
+
+    opts.parallel_chunk_sort = true;
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000003, "test_sort_mmap parallel chunks" );
+}
+
+void test_compression()
+{
+    using namespace test_details;
+
+    // sorted integers shrink, random ones of any sign survive the way back
+    auto inputs64 = sort_inputs< int64_t >( 100000 );
+    inputs64.push_back( { std::numeric_limits< int64_t >::min(), std::numeric_limits< int64_t >::max(), 0, -1,
+                          std::numeric_limits< int64_t >::min() } );
+
+    for( auto& input : inputs64 )
+    {
+        memory::buffer< char > blocks;
+        compression::compress( input.data(), input.size(), blocks );
+
+        std::vector< int64_t > output;
+        for( size_t pos = 0; pos < blocks.size(); )
+        {
+            compression::block_header header;
+            std::memcpy( &header, blocks.data() + pos, sizeof( header ) );
+            pos += sizeof( header );
+
+            output.resize( output.size() + header.items );
+            compression::decompress( header, blocks.data() + pos, output.data() + output.size() - header.items );
+            pos += header.bytes;
+        }
+
+        throw_assert( output == input, "test_compression FAILED : delta codec" );
+    }
+
+    std::vector< uint32_t > sorted( 10000 );
+    for( size_t i = 0; i < sorted.size(); ++i ){
+        sorted[ i ] = static_cast< uint32_t >( i * 3 );
+    }
+
+    memory::buffer< char > blocks;
+    compression::compress( sorted.data(), sorted.size(), blocks );
+    throw_assert( blocks.size() < sorted.size() * sizeof( uint32_t ) / 2, "test_compression FAILED : sorted data isn't compressed" );
+
+    // repeats, overlapping matches, long literals and the empty input
+    std::default_random_engine e;
+    std::uniform_int_distribution< int > byte( 0, 255 );
+
+    std::vector< std::string > inputs{ "", "a", std::string( 1000, 'x' ), "abcabcabcabcabcabcabcd" };
+    std::string random;
+    for( size_t i = 0; i < 5000; ++i ){
+        random.push_back( static_cast< char >( byte( e ) ) );
+    }
+
+    inputs.push_back( random );
+    inputs.push_back( random + random.substr( 100, 3000 ) + random );
+
+    for( auto& input : inputs )
+    {
+        std::vector< char > compressed( compression::lz_bound( input.size() ) );
+        compressed.resize( compression::lz_compress( input.data(), input.size(), compressed.data() ) );
+
+        std::string output( input.size(), 0 );
+        compression::lz_decompress( compressed.data(), compressed.size(), &output[ 0 ], output.size() );
+        throw_assert( output == input, "test_compression FAILED : lz codec, size " + std::to_string( input.size() ) );
+    }
+
+    // a corrupted block is reported rather than read past
+    bool exception_thrown{ false };
+    try
+    {
+        std::string output( 1000, 0 );
+        std::vector< char > compressed( compression::lz_bound( 1000 ) );
+        compressed.resize( compression::lz_compress( inputs[ 2 ].data(), 1000, compressed.data() ) );
+        compressed[ 2 ] = 0x7f; // a match distance longer than the data
+        compression::lz_decompress( compressed.data(), compressed.size(), &output[ 0 ], output.size() );
+    }
+    catch( const std::exception& ){
+        exception_thrown = true;
+    }
+
+    throw_assert( exception_thrown, "test_compression FAILED : corrupted block" );
+
+    std::cout<<"test_compression PASSED"<<std::endl;
+}
+
+void test_sort_compressed( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    options opts;
+    opts.compress_runs = true;
+
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000000, "test_sort_compressed" );
+    test_sort( work_folder, avail_mem, merge_at_once, 4, opts, 1000000, "test_sort_compressed 4 threads" );
+
+    // a single run still ends up decompressed
+    test_sort( work_folder, avail_mem * 16, merge_at_once, 1, opts, 100000, "test_sort_compressed single run" );
+
+    opts.write_buffers = 3;
+    opts.direct_io = true;
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000003, "test_sort_compressed direct io" );
+
+    opts.prefetch = false;
+    opts.pipelined_merge = true;
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000000, "test_sort_compressed pipelined" );
+
+    // records aren't integral, they go through the byte codec
+    using namespace test_details;
+
+    std::string file_path = work_folder + "external_sort_test_file";
+    std::string sorted_file_path = work_folder + "sorted";
+
+    auto records = generate_records( 50000, 100000 );
+    {
+        std::ofstream out( file_path, std::ios::out | std::ofstream::binary );
+        out.write( reinterpret_cast< const char* >( records.data() ), records.size() * sizeof( record ) );
+        throw_assert( out.good(), "test_sort_compressed FAILED : couldn't write input" );
+    }
+
+    options record_opts;
+    record_opts.compress_runs = true;
+    external_sort< record >( file_path, sorted_file_path, avail_mem, merge_at_once, threads_num, record_opts );
+    std::remove( file_path.c_str() );
+
+    std::vector< record > sorted( records.size() );
+    {
+        std::ifstream in( sorted_file_path, std::ios::in | std::ifstream::binary );
+        in.read( reinterpret_cast< char* >( sorted.data() ), sorted.size() * sizeof( record ) );
+    }
+
+    std::remove( sorted_file_path.c_str() );
+
+    std::sort( records.begin(), records.end() );
+    throw_assert( same_records( sorted, records ), "test_sort_compressed FAILED : records" );
+
+    std::cout<<"test_sort_compressed records PASSED"<<std::endl;
+}
+
+void test_sort_reduce( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    using namespace test_details;
+
+    std::string file_path = work_folder + "external_sort_test_file";
+    std::string sorted_file_path = work_folder + "sorted";
+
+    std::default_random_engine e;
+    std::uniform_int_distribution< uint64_t > dist( 0, 9999 );
+
+    std::vector< counted > items( 1000000 );
+    std::vector< uint64_t > counts( 10000, 0 );
+    for( auto& item : items )
+    {
+        item = counted{ dist( e ), 1 };
+        ++counts[ item.key ];
+    }
+
+    write_items( file_path, items );
+
+    auto check = [ & ]( bool combined, const std::string& test_name )
+    {
+        auto sorted = read_items< counted >( sorted_file_path );
+        std::remove( sorted_file_path.c_str() );
+
+        size_t keys = static_cast< size_t >( std::count_if( counts.begin(), counts.end(), []( uint64_t c ){ return c > 0; } ) );
+        throw_assert( sorted.size() == keys, test_name + " FAILED : duplicates left" );
+
+        for( size_t i = 0; i < sorted.size(); ++i )
+        {
+            throw_assert( !i || sorted[ i - 1 ].key < sorted[ i ].key, test_name + " FAILED : not sorted" );
+            throw_assert( sorted[ i ].count == ( combined ? counts[ sorted[ i ].key ] : 1 ), test_name + " FAILED : wrong count" );
+        }
+
+        std::cout<<test_name<<" PASSED"<<std::endl;
+    };
+
+    auto sum = []( counted& into, const counted& item ){ into.count += item.count; };
+
+    options opts;
+    external_sort_reduce< counted >( file_path, sorted_file_path, avail_mem, merge_at_once, sum, threads_num, opts );
+    check( true, "test_sort_reduce" );
+
+    external_sort_reduce< counted >( file_path, sorted_file_path, avail_mem, merge_at_once, sum, 4, opts );
+    check( true, "test_sort_reduce 4 threads" );
+
+    external_sort_reduce< counted >( file_path, sorted_file_path, avail_mem, merge_at_once, nullptr, threads_num, opts );
+    check( false, "test_sort_reduce unique" );
+
+    opts.parallel_chunk_sort = true;
+    external_sort_reduce< counted >( file_path, sorted_file_path, avail_mem, merge_at_once, sum, threads_num, opts );
+    check( true, "test_sort_reduce parallel chunks" );
+
+    // equal items split between output buffers
+    opts.parallel_chunk_sort = false;
+    opts.replacement_selection = true;
+    opts.write_buffers = 3;
+    external_sort_reduce< counted >( file_path, sorted_file_path, avail_mem, merge_at_once, sum, threads_num, opts );
+    check( true, "test_sort_reduce replacement selection" );
+
+    opts.replacement_selection = false;
+    opts.pipelined_merge = true;
+    external_sort_reduce< counted >( file_path, sorted_file_path, avail_mem, merge_at_once, sum, threads_num, opts );
+    check( true, "test_sort_reduce pipelined" );
+
+    std::remove( file_path.c_str() );
+}
+
+void test_sort_top( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    using namespace test_details;
+
+    std::string file_path = work_folder + "external_sort_test_file";
+    std::string sorted_file_path = work_folder + "sorted";
+
+    auto data = generate_file( file_path, 1000000 );
+    std::sort( data.begin(), data.end() );
+
+    auto check = [ & ]( size_t n, size_t threads, const options& opts, const std::string& test_name )
+    {
+        external_sort_top< size_t >( file_path, sorted_file_path, avail_mem, merge_at_once, n, threads, opts );
+
+        auto sorted = read_items< size_t >( sorted_file_path );
+        std::remove( sorted_file_path.c_str() );
+
+        std::vector< size_t > expected( data.begin(), data.begin() + std::min( n, data.size() ) );
+        throw_assert( sorted == expected, test_name + " FAILED : n " + std::to_string( n ) );
+    };
+
+    options opts;
+    for( size_t n : { 0, 1, 1000, 100000, 2000000 } ){
+        check( n, threads_num, opts, "test_sort_top" );
+    }
+
+    check( 1000, 4, opts, "test_sort_top 4 threads" );
+
+    opts.parallel_chunk_sort = true;
+    check( 1000, threads_num, opts, "test_sort_top parallel chunks" );
+
+    opts.parallel_chunk_sort = false;
+    opts.replacement_selection = true;
+    opts.write_buffers = 3;
+    check( 1000, threads_num, opts, "test_sort_top replacement selection" );
+    check( 100000, threads_num, opts, "test_sort_top replacement selection" );
+
+    opts.replacement_selection = false;
+    opts.pipelined_merge = true;
+    check( 1000, threads_num, opts, "test_sort_top pipelined" );
+
+    std::remove( file_path.c_str() );
+
+    std::cout<<"test_sort_top PASSED"<<std::endl;
+}
+
+void test_presorted( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    using namespace test_details;
+
+    // sorted, reversed and made of a few ascending runs, with equal items
+    std::vector< std::vector< int64_t > > chunks;
+    for( size_t runs : { 1, 2, 5, 15, 16, 17, 100 } )
+    {
+        std::vector< int64_t > chunk;
+        for( size_t run = 0; run < runs; ++run )
+        {
+            for( size_t i = 0; i < 1000; ++i ){
+                chunk.push_back( static_cast< int64_t >( ( i * 7 + run * 13 ) / 3 ) );
+            }
+        }
+
+        chunks.push_back( chunk );
+        chunks.emplace_back( chunk.rbegin(), chunk.rend() );
+    }
+
+    chunks.push_back( { 2, 1 } );
+    chunks.push_back( { 3, 3, 2, 2, 1 } );
+    chunks.push_back( { 3, 2, 2, 4 } );
+    chunks.push_back( { 5, 6, 7, 8, 9, 9, 1, 2, 10, 0, 4, 4, 4, 4, 4, 11 } );
+
+    for( auto& chunk : chunks )
+    {
+        auto expected = chunk;
+        std::sort( expected.begin(), expected.end() );
+
+        sorting::sort( chunk.data(), chunk.data() + chunk.size() );
+        throw_assert( chunk == expected, "test_presorted FAILED : chunk of " + std::to_string( chunk.size() ) );
+    }
+
+    // presorted input gives runs that are put together without a merge
+    std::string file_path = work_folder + "external_sort_test_file";
+    std::string sorted_file_path = work_folder + "sorted";
+
+    std::vector< size_t > data( 1000000 );
+    for( size_t i = 0; i < data.size(); ++i ){
+        data[ i ] = i / 3;
+    }
+
+    auto check = [ & ]( const std::vector< size_t >& input, size_t threads, const options& opts, const std::string& test_name )
+    {
+        write_items( file_path, input );
+        external_sort< size_t >( file_path, sorted_file_path, avail_mem, merge_at_once, threads, opts );
+
+        auto sorted = read_items< size_t >( sorted_file_path );
+        std::remove( sorted_file_path.c_str() );
+        throw_assert( sorted == data, test_name + " FAILED" );
+    };
+
+    std::vector< size_t > reversed( data.rbegin(), data.rend() );
+
+    // the halves swapped, the runs are sorted but out of order
+    std::vector< size_t > swapped( data.begin() + data.size() / 2, data.end() );
+    swapped.insert( swapped.end(), data.begin(), data.begin() + data.size() / 2 );
+
+    options opts;
+    check( data, threads_num, opts, "test_presorted sorted" );
+    check( reversed, threads_num, opts, "test_presorted reversed" );
+    check( swapped, threads_num, opts, "test_presorted swapped" );
+    check( data, 4, opts, "test_presorted 4 threads" );
+
+    opts.parallel_chunk_sort = true;
+    check( data, threads_num, opts, "test_presorted parallel chunks" );
+
+    opts.parallel_chunk_sort = false;
+    opts.replacement_selection = true;
+    check( data, threads_num, opts, "test_presorted replacement selection" );
+
+    opts.replacement_selection = false;
+    opts.direct_io = true;
+    opts.write_buffers = 3;
+    check( data, threads_num, opts, "test_presorted direct io" );
+
+    // equal items at the ends of runs are combined by a merge
+    write_items( file_path, data );
+    external_sort_reduce< size_t >( file_path, sorted_file_path, avail_mem, merge_at_once, nullptr, threads_num );
+
+    auto unique = read_items< size_t >( sorted_file_path );
+    std::remove( sorted_file_path.c_str() );
+    std::remove( file_path.c_str() );
+
+    throw_assert( unique.size() == data.back() + 1 && std::is_sorted( unique.begin(), unique.end() ),
+                  "test_presorted FAILED : unique" );
+
+    std::cout<<"test_presorted PASSED"<<std::endl;
+}
+
+void test_sort_stream( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    std::vector< size_t > data( 1000003 );
+    std::default_random_engine engine( 17 );
+    std::uniform_int_distribution< size_t > dist( 1, data.size() );
+    for( auto& item : data ){
+        item = dist( engine );
+    }
+
+    std::vector< size_t > expected( data );
+    std::sort( expected.begin(), expected.end() );
+
+    auto check = [ & ]( size_t mem, size_t threads, const options& opts, const std::string& name )
+    {
+        // the producer gives away less than asked for now and then
+        size_t next = 0;
+        stream::producer< size_t > producer = [ & ]( size_t* out, size_t max_items )
+        {
+            size_t items = std::min( { max_items, data.size() - next, next % 7 ? max_items : size_t( 777 ) } );
+            std::copy( data.begin() + next, data.begin() + next + items, out );
+            next += items;
+            return items;
+        };
+
+        std::vector< size_t > sorted;
+        stream::consumer< size_t > consumer = [ & ]( const size_t* items, size_t size ){
+            sorted.insert( sorted.end(), items, items + size );
+        };
+
+        external_sort_stream< size_t >( producer, consumer, work_folder, mem, merge_at_once, threads, opts );
+        test_details::throw_assert( sorted == expected, name + " FAILED" );
+    };
+
+    options opts;
+    check( avail_mem, threads_num, opts, "test_sort_stream" );
+    check( avail_mem, 4, opts, "test_sort_stream 4 threads" );
+
+    opts.write_buffers = 3;
+    check( avail_mem, threads_num, opts, "test_sort_stream write behind" );
+
+    opts.compress_runs = true;
+    check( avail_mem, threads_num, opts, "test_sort_stream compressed" );
+
+    // a single run is merged on its way out as well
+    check( avail_mem * 20, 1, options(), "test_sort_stream single run" );
+
+    std::vector< size_t > empty;
+    std::vector< size_t > sorted;
+    external_sort_range< size_t >( empty.begin(), empty.end(), std::back_inserter( sorted ), work_folder, avail_mem, merge_at_once, threads_num );
+    test_details::throw_assert( sorted.empty(), "test_sort_stream FAILED : empty range" );
+
+    external_sort_range< size_t >( data.begin(), data.end(), std::back_inserter( sorted ), work_folder, avail_mem, merge_at_once, threads_num );
+    test_details::throw_assert( sorted == expected, "test_sort_stream FAILED : range" );
+
+    std::cout<<"test_sort_stream PASSED"<<std::endl;
+}
+
+void test_sort_pipelined( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    options opts;
+    opts.pipelined_merge = true;
+
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000000, "test_sort_pipelined" );
+    test_sort( work_folder, avail_mem, merge_at_once, 4, opts, 1000000, "test_sort_pipelined 4 threads" );
+
+    // replacement selection reports its runs as well
+    opts.replacement_selection = true;
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000000, "test_sort_pipelined replacement selection" );
+
+    // the phases don't take each other's memory when there is little of it
+    test_sort( work_folder, 20000, 8, threads_num, opts, 100000, "test_sort_pipelined little memory" );
+    opts.replacement_selection = false;
+    test_sort( work_folder, 20000, 8, threads_num, opts, 100000, "test_sort_pipelined little memory chunks" );
+}
+
+void test_run_scheduler()
+{
+    using namespace test_details;
+
+    std::vector< merge::sorted_run > runs;
+    for( size_t size : { 10, 1, 7, 3, 2, 9, 4 } ){
+        runs.push_back( merge::sorted_run{ std::to_string( size ), size } );
+    }
+
+    // 7 runs 3 at a time: the first job takes just 3 for the next ones to be full
+    merge::run_scheduler scheduler( runs, 3, "" );
+    merge::merge_job job;
+
+    throw_assert( scheduler.next_job( job ), "test_run_scheduler FAILED : no first job" );
+    throw_assert( job.inputs.size() == 3 && job.output.size == 6, "test_run_scheduler FAILED : first job isn't the smallest runs" );
+    throw_assert( job.output.path == common::merged_file_path( "", 1 ), "test_run_scheduler FAILED : output name" );
+    scheduler.complete( job );
+
+    // 4 7 6 9 10 left
+    throw_assert( scheduler.next_job( job ), "test_run_scheduler FAILED : no second job" );
+    throw_assert( job.inputs.size() == 3 && job.output.size == 17, "test_run_scheduler FAILED : second job isn't the smallest runs" );
+    scheduler.complete( job );
+
+    // 9 10 17 are left to the final merge
+    throw_assert( !scheduler.next_job( job ), "test_run_scheduler FAILED : job for the final merge" );
+
+    auto left = scheduler.runs();
+    throw_assert( left.size() == 3 && left[ 0 ].size == 9 && left[ 2 ].size == 17, "test_run_scheduler FAILED : runs left" );
+
+    std::cout<<"test_run_scheduler PASSED"<<std::endl;
+}
+
+void test_radix_sort()
+{
+    using namespace test_details;
+
+    check_sort< uint8_t >( &sorting::radix_sort< uint8_t >, "test_radix_sort FAILED : uint8_t" );
+    check_sort< int16_t >( &sorting::radix_sort< int16_t >, "test_radix_sort FAILED : int16_t" );
+    check_sort< uint32_t >( &sorting::radix_sort< uint32_t >, "test_radix_sort FAILED : uint32_t" );
+    check_sort< int32_t >( &sorting::radix_sort< int32_t >, "test_radix_sort FAILED : int32_t" );
+    check_sort< uint64_t >( &sorting::radix_sort< uint64_t >, "test_radix_sort FAILED : uint64_t" );
+    check_sort< int64_t >( &sorting::radix_sort< int64_t >, "test_radix_sort FAILED : int64_t" );
+    check_sort< float >( &sorting::radix_sort< float >, "test_radix_sort FAILED : float" );
+    check_sort< double >( &sorting::radix_sort< double >, "test_radix_sort FAILED : double" );
+
+    std::cout<<"test_radix_sort PASSED"<<std::endl;
+}
+
+void test_simd_sort()
+{
+    using namespace test_details;
+
+    check_simd_sort< uint32_t >( "test_simd_sort FAILED : uint32_t" );
+    check_simd_sort< int32_t >( "test_simd_sort FAILED : int32_t" );
+    check_simd_sort< float >( "test_simd_sort FAILED : float" );
+    check_simd_sort< uint64_t >( "test_simd_sort FAILED : uint64_t" );
+    check_simd_sort< int64_t >( "test_simd_sort FAILED : int64_t" );
+    check_simd_sort< double >( "test_simd_sort FAILED : double" );
+
+    // the scalar path
+    check_sort< int16_t >( []( int16_t* first, int16_t* last ){ sorting::simd_sort( first, last ); },
+                           "test_simd_sort FAILED : int16_t" );
+
+    std::cout<<"test_simd_sort PASSED"<<std::endl;
+}
+
+void test_indirect_sort( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    using namespace test_details;
+
+    for( size_t size : { 0, 1, 2, 1000, 100000 } )
+    {
+        for( uint64_t ids : { 1ull << 40, 1000ull, 1ull } )
+        {
+            auto records = generate_records( size, ids );
+            auto expected = records;
+            std::sort( expected.begin(), expected.end() );
+
+            sorting::sort( records.data(), records.data() + records.size() );
+            throw_assert( same_records( records, expected ), "test_indirect_sort FAILED : size " + std::to_string( size ) );
+        }
+    }
+
+    // chunks of a whole sort go through it as well
+    std::string file_path = work_folder + "external_sort_test_file";
+    std::string sorted_file_path = work_folder + "sorted";
+
+    auto records = generate_records( 50000, 100000 );
+    {
+        std::ofstream out( file_path, std::ios::out | std::ofstream::binary );
+        out.write( reinterpret_cast< const char* >( records.data() ), records.size() * sizeof( record ) );
+        throw_assert( out.good(), "test_indirect_sort FAILED : couldn't write input" );
+    }
+
+    external_sort< record >( file_path, sorted_file_path, avail_mem, merge_at_once, threads_num );
+    std::remove( file_path.c_str() );
+
+    std::vector< record > sorted( records.size() );
+    {
+        std::ifstream in( sorted_file_path, std::ios::in | std::ifstream::binary );
+        in.read( reinterpret_cast< char* >( sorted.data() ), sorted.size() * sizeof( record ) );
+    }
+
+    std::remove( sorted_file_path.c_str() );
+
+    std::sort( records.begin(), records.end() );
+    throw_assert( same_records( sorted, records ), "test_indirect_sort FAILED : external sort" );
+
+    std::cout<<"test_indirect_sort PASSED"<<std::endl;
+}
+
+void test_sort_records( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    using namespace test_details;
+
+    std::string file_path = work_folder + "external_sort_test_file";
+    std::string sorted_file_path = work_folder + "sorted";
+
+    // sorts the records, checks the output and the memory taken
+    auto check = [ & ]( std::vector< std::string >& records, const std::string& test_name )
+    {
+        {
+            std::ofstream out( file_path, std::ios::out | std::ofstream::binary );
+            for( size_t record = 0; record < records.size(); ++record )
+            {
+                out.write( records[ record ].data(), records[ record ].size() );
+
+                // the last one goes without a delimiter
+                if( record + 1 < records.size() ){
+                    out.put( '\n' );
+                }
+            }
+
+            throw_assert( out.good(), test_name + " FAILED : couldn't write input" );
+        }
+
+        statistics stats = external_sort_records( file_path, sorted_file_path, avail_mem, merge_at_once, threads_num );
+        std::remove( file_path.c_str() );
+
+        std::string sorted;
+        {
+            std::ifstream in( sorted_file_path, std::ios::in | std::ifstream::binary );
+            sorted.assign( std::istreambuf_iterator< char >( in ), std::istreambuf_iterator< char >() );
+        }
+
+        std::remove( sorted_file_path.c_str() );
+
+        // std::string compares chars as unsigned, as the records are
+        std::sort( records.begin(), records.end() );
+
+        std::string expected;
+        for( auto& record : records ){
+            expected += record + '\n';
+        }
+
+        throw_assert( stats.runs > merge_at_once, test_name + " FAILED : too few runs to merge in passes" );
+        throw_assert( sorted == expected, test_name + " FAILED : data invalid" );
+
+        std::cout<<test_name<<" PASSED"<<std::endl;
+        return stats;
+    };
+
+    std::default_random_engine e;
+    std::uniform_int_distribution< size_t > length( 0, 100 );
+    std::uniform_int_distribution< int > byte( 0, 255 );
+
+    std::vector< std::string > records( 200000 );
+    for( auto& record : records )
+    {
+        record.resize( length( e ) );
+        for( auto& c : record ){
+            c = static_cast< char >( byte( e ) );
+            c = c == '\n' ? ' ' : c;
+        }
+    }
+
+    // longer than the memory given to a chunk or a block
+    records[ 1000 ] = std::string( 2 * avail_mem, 'z' );
+    check( records, "test_sort_records" );
+
+    // the entries of short records take more memory than the records
+    records.assign( 400000, std::string( 3, ' ' ) );
+    for( auto& record : records )
+    {
+        for( auto& c : record ){
+            c = static_cast< char >( 'a' + byte( e ) % 26 );
+        }
+    }
+
+    statistics stats = check( records, "test_sort_records short" );
+    throw_assert( stats.peak_memory && stats.peak_memory <= avail_mem, "test_sort_records FAILED : memory exceeded" );
+}
+
+void test_sort_parallel_chunks( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    options opts;
+    opts.parallel_chunk_sort = true;
+
+    test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, 1000000, "test_sort_parallel_chunks" );
+
+    // several threads even if the machine has few cores, with chunks large enough to share
+    opts.write_buffers = 2;
+    test_sort( work_folder, 8 * avail_mem, merge_at_once, 4, opts, 1000000, "test_sort_parallel_chunks 4 threads" );
+}
+
+void test_parallel_sort()
+{
+    using namespace test_details;
+
+    std::default_random_engine e;
+    std::uniform_int_distribution< size_t > dist( 0, 1000 ); // plenty of duplicates
+    memory::buffer< size_t > data( 1000000 );
+    for( auto& v : data ){
+        v = dist( e );
+    }
+
+    std::vector< size_t > expected( data.begin(), data.end() );
+    std::sort( expected.begin(), expected.end() );
+
+    concurrency::async async( 4 );
+    memory::buffer_pool< size_t > pool( data.size() * sizeof( size_t ) );
+    sorting::parallel_sort( data, async, 4, pool );
+
+    throw_assert( std::equal( expected.begin(), expected.end(), data.begin() ), "test_parallel_sort FAILED" );
+    pool.release( std::move( data ) );
+
+    std::cout<<"test_parallel_sort PASSED"<<std::endl;
+}
+
+void test_async()
+{
+    using namespace test_details;
+
+    std::atomic_size_t counter{ 0 };
+    const size_t tasks_num = 10000; // more than the queues hold
+
+    {
+        concurrency::async async( 4 );
+        for( size_t task = 0; task < tasks_num; ++task )
+        {
+            // move-only, and posting from a worker goes to its own queue
+            std::unique_ptr< size_t > one{ new size_t( 1 ) };
+            auto add = std::bind( [ &counter, &async ]( std::unique_ptr< size_t >& v )
+            {
+                counter += *v;
+                async.post( [ &counter ](){ ++counter; } );
+            }, std::move( one ) );
+
+            async.post( std::move( add ) );
+        }
+    }
+
+    throw_assert( counter == 2 * tasks_num, "test_async FAILED : not every task has been run" );
+
+    std::cout<<"test_async PASSED"<<std::endl;
+}
+
+void test_buffer_pool( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    using namespace test_details;
+    statistics stats = test_sort( work_folder, avail_mem, merge_at_once, threads_num, options(), 1000000, "test_buffer_pool sort" );
+
+    // buffers are only allocated while the pool warms up
+    throw_assert( stats.pool_misses < stats.pool_hits, "test_buffer_pool FAILED : buffers are not reused" );
+
+    // a buffer over the cap waits for one given out to come back,
+    // one the pool didn't give out makes no room
+    memory::buffer_pool< size_t > pool( 1000 * sizeof( size_t ) );
+    memory::buffer< size_t > first = pool.acquire( 600 );
+    pool.release( memory::buffer< size_t >( 600 ) );
+
+    std::atomic< bool > acquired{ false };
+    std::thread second( [ &pool, &acquired ]()
+    {
+        memory::buffer< size_t > b = pool.acquire( 600 );
+        acquired = true;
+        pool.release( std::move( b ) );
+    });
+
+    std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+    bool waited = !acquired;
+    pool.release( std::move( first ) );
+    second.join();
+
+    throw_assert( waited && acquired, "test_buffer_pool FAILED : a buffer over the cap is given out" );
+    throw_assert( pool.peak_bytes() <= 1000 * sizeof( size_t ), "test_buffer_pool FAILED : peak over the cap" );
+
+    bool exception_thrown{ false };
+
+    try{
+        pool.acquire( 1001 );
+    }
+    catch( const std::exception& ){
+        exception_thrown = true;
+    }
+
+    throw_assert( exception_thrown, "test_buffer_pool FAILED : a buffer larger than the pool is given out" );
+
+    // a larger idle buffer isn't given out for a smaller request,
+    // it would take more than the caller counted on
+    memory::buffer< size_t > large = pool.acquire( 400 );
+    pool.release( std::move( large ) );
+    memory::buffer< size_t > small = pool.acquire( 300 );
+    throw_assert( small.capacity() == 300, "test_buffer_pool FAILED : a larger buffer is reused" );
+    pool.release( std::move( small ) );
+
+    // the split and the merge of a pipelined sort waited for each other's buffers
+    std::string file_path = work_folder + "external_sort_test_file";
+    std::string sorted_file_path = work_folder + "sorted";
+
+    std::default_random_engine e;
+    std::uniform_int_distribution< uint32_t > dist( 0, 6 );
+    std::vector< uint32_t > items( 400000 );
+
+    options opts;
+    opts.replacement_selection = true;
+    opts.pipelined_merge = true;
+
+    for( size_t run = 0; run < 5; ++run )
+    {
+        for( auto& item : items ){
+            item = dist( e );
+        }
+
+        write_items( file_path, items );
+        external_sort< uint32_t >( file_path, sorted_file_path, 20000, 8, 1, opts );
+        std::sort( items.begin(), items.end() );
+        throw_assert( read_items< uint32_t >( sorted_file_path ) == items, "test_buffer_pool FAILED : pipelined sort with little memory" );
+    }
+
+    std::remove( file_path.c_str() );
+    std::remove( sorted_file_path.c_str() );
+
+    std::cout<<"test_buffer_pool PASSED"<<std::endl;
+}
+
+void test_statistics( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    using namespace test_details;
+    const size_t items = 1000000;
+    const size_t bytes = items * sizeof( size_t );
+
+    statistics stats = test_sort( work_folder, avail_mem, merge_at_once, threads_num, options(), items, "test_statistics sort" );
+
+    throw_assert( stats.split.bytes_read == bytes && stats.split.bytes_written == bytes,
+                  "test_statistics FAILED : split traffic" );
+
+    // every merge reads all of its runs, the final one writes the output
+    throw_assert( stats.merge.bytes_read == stats.merge.bytes_written && stats.merge.bytes_written >= bytes,
+                  "test_statistics FAILED : merge traffic" );
+
+    throw_assert( stats.runs > merge_at_once && stats.merges > 1 && stats.merge_passes > 1,
+                  "test_statistics FAILED : merges" );
+
+    throw_assert( stats.merge_passes == static_cast< double >( stats.merge.bytes_written ) / bytes,
+                  "test_statistics FAILED : merge passes" );
+
+    throw_assert( stats.peak_memory && stats.peak_memory <= avail_mem, "test_statistics FAILED : peak memory" );
+
+    throw_assert( stats.split.seconds > 0 && stats.merge.seconds > 0 && stats.split.cpu_seconds >= 0 &&
+                  stats.split.read_wait_seconds <= stats.split.seconds * ( threads_num + 1 ),
+                  "test_statistics FAILED : times" );
+
+    // stalls are kept by thread too, they add up to the totals
+    for( auto* phase : { &stats.split, &stats.merge } )
+    {
+        double read_wait = 0, write_wait = 0, vacancy_wait = 0;
+        for( auto& t : phase->threads )
+        {
+            read_wait += t.read_wait_seconds;
+            write_wait += t.write_wait_seconds;
+            vacancy_wait += t.vacancy_wait_seconds;
+        }
+
+        throw_assert( std::abs( read_wait - phase->read_wait_seconds ) < 1e-6 &&
+                      std::abs( write_wait - phase->write_wait_seconds ) < 1e-6 &&
+                      std::abs( vacancy_wait - phase->vacancy_wait_seconds ) < 1e-6,
+                      "test_statistics FAILED : stalls by thread" );
+    }
+
+    throw_assert( !stats.split.threads.empty() && stats.split.threads.size() <= std::max< size_t >( threads_num, 1 ) + 1,
+                  "test_statistics FAILED : stalled threads" );
+
+    // a single run is renamed to the output
+    statistics single = test_sort( work_folder, avail_mem * 16, merge_at_once, 1, options(), items / 10, "test_statistics single run" );
+    throw_assert( single.runs == 1 && !single.merges && !single.merge_passes && !single.merge.bytes_written,
+                  "test_statistics FAILED : single run" );
+
+    // the stream output doesn't go to disk
+    std::vector< size_t > data( items );
+    std::vector< size_t > sorted;
+    for( size_t i = 0; i < items; ++i ){
+        data[ i ] = ( i * 7919 ) % items;
+    }
+
+    stats = external_sort_range< size_t >( data.begin(), data.end(), std::back_inserter( sorted ), work_folder, avail_mem, merge_at_once, threads_num );
+    throw_assert( !stats.split.bytes_read && stats.split.bytes_written == bytes && stats.merge.bytes_read >= bytes &&
+                  stats.merge_passes == static_cast< double >( stats.merge.bytes_read ) / bytes,
+                  "test_statistics FAILED : stream" );
+
+    std::cout<<"test_statistics PASSED"<<std::endl;
+}
+
+void test_sort_replacement_selection( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
+{
+    using namespace test_details;
+
+    options opts;
+    opts.replacement_selection = true;
+
+    // runs of random data are longer than the memory
+    size_t items = 1000000;
+    statistics stats = test_sort( work_folder, avail_mem, merge_at_once, threads_num, opts, items, "test_sort_replacement_selection random" );
+    throw_assert( stats.runs < items * sizeof( size_t ) / avail_mem, "test_sort_replacement_selection FAILED : runs are too short" );
+
+    // nearly sorted data is a single run
+    std::string file_path = work_folder + "external_sort_test_file";
+    std::string sorted_file_path = work_folder + "sorted";
+
+    std::default_random_engine e;
+    std::uniform_int_distribution< size_t > noise( 0, 1000 );
+    std::vector< size_t > data( items );
+    for( size_t i = 0; i < items; ++i ){
+        data[ i ] = i * 10 + noise( e );
+    }
+
+    {
+        std::ofstream out( file_path, std::ios::out | std::ofstream::binary );
+        out.write( reinterpret_cast< const char* >( &data[0] ), data.size() * sizeof( size_t ) );
+        throw_assert( out.good(), "test_sort_replacement_selection FAILED : couldn't write input" );
+    }
+
+    stats = external_sort< size_t >( file_path, sorted_file_path, avail_mem, merge_at_once, threads_num, opts );
+    std::remove( file_path.c_str() );
+
+    bool valid = verify( sorted_file_path, data );
+    std::remove( sorted_file_path.c_str() );
+
+    throw_assert( valid, "test_sort_replacement_selection FAILED : nearly sorted data invalid" );
+    throw_assert( stats.runs == 1, "test_sort_replacement_selection FAILED : nearly sorted data is not a single run" );
+
+    std::cout<<"test_sort_replacement_selection PASSED"<<std::endl;
 }
 
 void run_all_tests( const std::string& work_folder, size_t avail_mem, size_t merge_at_once, size_t threads_num )
@@ -203,6 +1290,30 @@ void run_all_tests( const std::string& work_folder, size_t avail_mem, size_t mer
         test_corrupted_file( work_folder );
         test_invalid_args();
         test_sort( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_no_prefetch( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_write_behind( work_folder, avail_mem, merge_at_once, threads_num );
+        test_buffer_pool( work_folder, avail_mem, merge_at_once, threads_num );
+        test_statistics( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_final_merge( work_folder, avail_mem, merge_at_once );
+        test_run_scheduler();
+        test_sort_pipelined( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_io_uring( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_direct_io( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_mmap( work_folder, avail_mem, merge_at_once, threads_num );
+        test_compression();
+        test_sort_compressed( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_reduce( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_top( work_folder, avail_mem, merge_at_once, threads_num );
+        test_presorted( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_stream( work_folder, avail_mem, merge_at_once, threads_num );
+        test_radix_sort();
+        test_simd_sort();
+        test_indirect_sort( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_records( work_folder, avail_mem, merge_at_once, threads_num );
+        test_async();
+        test_parallel_sort();
+        test_sort_parallel_chunks( work_folder, avail_mem, merge_at_once, threads_num );
+        test_sort_replacement_selection( work_folder, avail_mem, merge_at_once, threads_num );
     }
     catch( const std::exception& e )
     {